@@ -154,6 +154,48 @@ actor_commands (
         zstr_free (&answer);
     }
     else
+    if (streq (cmd, "NATIVE_FUNCTIONS")) {
+        char *answer = zmsg_popstr (message);
+        if (!answer) {
+            log_error (
+                    "Expected multipart string format: NATIVE_FUNCTIONS/answer."
+                    "Received NATIVE_FUNCTIONS/nullptr");
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        c_metric_conf_set_native (cfg, streq (answer, "true"));
+        zstr_free (&answer);
+    }
+    else
+    if (streq (cmd, "HIERARCHICAL")) {
+        char *answer = zmsg_popstr (message);
+        if (!answer) {
+            log_error (
+                    "Expected multipart string format: HIERARCHICAL/answer."
+                    "Received HIERARCHICAL/nullptr");
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        c_metric_conf_set_hierarchical (cfg, streq (answer, "true"));
+        zstr_free (&answer);
+    }
+    else
+    if (streq (cmd, "COMBINED")) {
+        char *answer = zmsg_popstr (message);
+        if (!answer) {
+            log_error (
+                    "Expected multipart string format: COMBINED/answer."
+                    "Received COMBINED/nullptr");
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        c_metric_conf_set_combined (cfg, streq (answer, "true"));
+        zstr_free (&answer);
+    }
+    else
     if (streq (cmd, "LOAD")) {
         if (streq (c_metric_conf_statefile (cfg), "")) {
             log_error (
@@ -312,6 +354,78 @@ actor_commands_test (bool verbose)
     assert (streq (c_metric_conf_statefile (cfg), ""));
     assert (streq (c_metric_conf_cfgdir (cfg), ""));
 
+    // --------------------------------------------------------------
+    // NATIVE_FUNCTIONS - expected fail
+    assert (c_metric_conf_native (cfg));
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, "NATIVE_FUNCTIONS");
+    // missing answer here
+    rv = actor_commands (cfg, &data, &message);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (c_metric_conf_native (cfg));
+
+    // --------------------------------------------------------------
+    // NATIVE_FUNCTIONS
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, "NATIVE_FUNCTIONS");
+    zmsg_addstr (message, "false");
+    rv = actor_commands (cfg, &data, &message);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (!c_metric_conf_native (cfg));
+    c_metric_conf_set_native (cfg, true);
+
+    // --------------------------------------------------------------
+    // HIERARCHICAL - expected fail
+    assert (!c_metric_conf_hierarchical (cfg));
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, "HIERARCHICAL");
+    // missing answer here
+    rv = actor_commands (cfg, &data, &message);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (!c_metric_conf_hierarchical (cfg));
+
+    // --------------------------------------------------------------
+    // HIERARCHICAL
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, "HIERARCHICAL");
+    zmsg_addstr (message, "true");
+    rv = actor_commands (cfg, &data, &message);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (c_metric_conf_hierarchical (cfg));
+    c_metric_conf_set_hierarchical (cfg, false);
+
+    // --------------------------------------------------------------
+    // COMBINED - expected fail
+    assert (!c_metric_conf_combined (cfg));
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, "COMBINED");
+    // missing answer here
+    rv = actor_commands (cfg, &data, &message);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (!c_metric_conf_combined (cfg));
+
+    // --------------------------------------------------------------
+    // COMBINED
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, "COMBINED");
+    zmsg_addstr (message, "true");
+    rv = actor_commands (cfg, &data, &message);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (c_metric_conf_combined (cfg));
+    c_metric_conf_set_combined (cfg, false);
+
     // --------------------------------------------------------------
     // CONNECT - expected fail
     message = zmsg_new ();
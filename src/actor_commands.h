@@ -50,6 +50,22 @@ extern "C" {
 //  CFG_DIRECTORY/cfg_directory
 //      set pathname of output config files to 'cfg_directory'
 //
+//  NATIVE_FUNCTIONS/true|false
+//      generate configurations evaluated by built-in functions (default)
+//      or by Lua scripts
+//
+//  HIERARCHICAL/true|false
+//      with propagation, configuration of asset above rack averages outputs
+//      of its children with partial sums and counts instead of all sensors
+//      below it; configurations are meant for one engine process on the
+//      configuration directory, per configuration services are not started
+//      (default false)
+//
+//  COMBINED/true|false
+//      generate one configuration per asset with both temperature and
+//      humidity outputs instead of one per quantity, halving number of
+//      processes and subscriptions (default false)
+//
 
 // Performs the actor commands logic
 // Destroys the message
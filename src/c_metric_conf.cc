@@ -38,6 +38,9 @@ struct _c_metric_conf_t {
     char *statefile_name;           // state file name
     char *configuration_dir;        // configuration directory
     bool is_propagation_needed;     // should sensors be propagated in topology?
+    bool is_native;                 // generate built-in functions instead of Lua?
+    bool is_hierarchical;           // generate hierarchy of partial averages for engine?
+    bool is_combined;               // generate one configuration per asset for all quantities?
 };
 
 //  --------------------------------------------------------------------------
@@ -62,6 +65,9 @@ c_metric_conf_new (const char *name)
         if (self->configuration_dir) {
             self->verbose = false;
             self->is_propagation_needed = true;
+            self->is_native = true;
+            self->is_hierarchical = false;
+            self->is_combined = false;
         }
         else
             c_metric_conf_destroy (&self);
@@ -203,6 +209,66 @@ c_metric_conf_set_propagation (c_metric_conf_t *self, bool is_propagation_needed
     self->is_propagation_needed = is_propagation_needed;
 }
 
+//  --------------------------------------------------------------------------
+//  Get whether configurations use built-in functions instead of Lua
+
+bool
+c_metric_conf_native (c_metric_conf_t *self)
+{
+    assert (self);
+    return self->is_native;
+}
+
+//  --------------------------------------------------------------------------
+//  Set whether configurations use built-in functions instead of Lua
+
+void
+c_metric_conf_set_native (c_metric_conf_t *self, bool is_native)
+{
+    assert (self);
+    self->is_native = is_native;
+}
+
+//  --------------------------------------------------------------------------
+//  Get whether configurations form hierarchy evaluated by one engine
+
+bool
+c_metric_conf_hierarchical (c_metric_conf_t *self)
+{
+    assert (self);
+    return self->is_hierarchical;
+}
+
+//  --------------------------------------------------------------------------
+//  Set whether configurations form hierarchy evaluated by one engine
+
+void
+c_metric_conf_set_hierarchical (c_metric_conf_t *self, bool is_hierarchical)
+{
+    assert (self);
+    self->is_hierarchical = is_hierarchical;
+}
+
+//  --------------------------------------------------------------------------
+//  Get whether one configuration per asset covers all quantities
+
+bool
+c_metric_conf_combined (c_metric_conf_t *self)
+{
+    assert (self);
+    return self->is_combined;
+}
+
+//  --------------------------------------------------------------------------
+//  Set whether one configuration per asset covers all quantities
+
+void
+c_metric_conf_set_combined (c_metric_conf_t *self, bool is_combined)
+{
+    assert (self);
+    self->is_combined = is_combined;
+}
+
 //  --------------------------------------------------------------------------
 //  Get path to configuration directory
 
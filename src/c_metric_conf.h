@@ -73,6 +73,34 @@ FTY_METRIC_COMPOSITE_EXPORT bool
 FTY_METRIC_COMPOSITE_EXPORT void
     c_metric_conf_set_propagation (c_metric_conf_t *self, bool is_propagation_needed);
 
+//  Get whether generated configurations use built-in functions instead of Lua
+FTY_METRIC_COMPOSITE_EXPORT bool
+    c_metric_conf_native (c_metric_conf_t *self);
+
+//  Set whether generated configurations use built-in functions instead of Lua
+FTY_METRIC_COMPOSITE_EXPORT void
+    c_metric_conf_set_native (c_metric_conf_t *self, bool is_native);
+
+//  Get whether generated configurations form hierarchy (asset above rack
+//  averages outputs of its children) evaluated by one engine process
+FTY_METRIC_COMPOSITE_EXPORT bool
+    c_metric_conf_hierarchical (c_metric_conf_t *self);
+
+//  Set whether generated configurations form hierarchy evaluated by one
+//  engine process
+FTY_METRIC_COMPOSITE_EXPORT void
+    c_metric_conf_set_hierarchical (c_metric_conf_t *self, bool is_hierarchical);
+
+//  Get whether one generated configuration per asset covers both
+//  temperature and humidity (composite with more outputs)
+FTY_METRIC_COMPOSITE_EXPORT bool
+    c_metric_conf_combined (c_metric_conf_t *self);
+
+//  Set whether one generated configuration per asset covers both
+//  temperature and humidity
+FTY_METRIC_COMPOSITE_EXPORT void
+    c_metric_conf_set_combined (c_metric_conf_t *self, bool is_combined);
+
 //  Get path to confuration directory
 FTY_METRIC_COMPOSITE_EXPORT const char *
     c_metric_conf_cfgdir (c_metric_conf_t *self);
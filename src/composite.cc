@@ -0,0 +1,2200 @@
+/*  =========================================================================
+    composite - composite metric evaluation context
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    composite - composite metric evaluation context
+@discuss
+    Holds everything one composite metric needs between two messages:
+    parsed configuration, cache of input values and Lua state.
+
+    Values of inputs live in one contiguous array. Every distinct input
+    topic gets its slot when configuration is loaded, server resolves the
+    slot once per topic (see topic_index) and updates it directly.
+
+    Configuration either names one of built-in aggregation functions
+
+        {
+          "in": [ "temperature.TH1@rc", "temperature.TH2@rc" ],
+          "function": "avg",
+          "offsets": { "temperature.TH1@rc": 0.5 },
+          "output": "average.temperature@rack",
+          "unit": "C"
+        }
+
+    which is evaluated natively (avg, min, max, sum or count of valid inputs,
+    each corrected by its calibration offset, default 0), or contains Lua
+    script in 'evaluation' for custom formulas. Script returns either one
+    output as topic, value and unit, or list of any number of outputs
+
+        return { { 'average.temperature@rack', t, 'C' },
+                 { 'average.humidity@rack', h, '%' } }
+
+    Built-in functions get more outputs from 'outputs' list, each with its
+    own 'function', 'output', 'unit' and optional 'in' - subset of inputs,
+    all of them by default
+
+        {
+          "in": [ "temperature.TH1@rc", "humidity.TH1@rc" ],
+          "outputs": [
+            { "function": "avg", "in": [ "temperature.TH1@rc" ],
+              "output": "average.temperature@rack", "unit": "C" },
+            { "function": "avg", "in": [ "humidity.TH1@rc" ],
+              "output": "average.humidity@rack", "unit": "%" }
+          ]
+        }
+
+    so one composite (and one subscription per input topic) serves all
+    quantities of an asset. Output which has no valid input is left out,
+    evaluation fails only when no output is left. Optional 'period' (seconds)
+    asks the server to evaluate the composite on that cadence instead of on
+    every update. Optional 'deadband' suppresses outputs which moved by no
+    more than deadband since the last published one, until 'max_silence'
+    (seconds) passes.
+
+    Optional 'windows' lists lengths (seconds) of sliding windows, i.e.
+    [ 60, 300, 900 ]; server keeps every successful output in them and
+    publishes their mean, minimum and maximum along with the output.
+    'window_samples' limits the number of outputs one window keeps
+    (default 1024), the oldest ones are dropped first.
+
+    Input can be output of another composite evaluated in the same process.
+    With 'partials' set to true such input contributes to running sum and
+    count by the partial sum and count of its producer instead of by its
+    value as one reading, so average of rack averages equals average of
+    all sensors in the racks, without listing them all. It is meant for
+    composites with the same built-in function as their producers. Partial
+    of min and max producer is its result as one reading, partial of count
+    producer is its count as both sum and count, so sum or count of counts
+    is the number of all sensors.
+
+    Composite keeps running sum and count of valid inputs - update replaces
+    old contribution of the input by the new one and expiry heap removes
+    contributions of inputs which are no longer valid, so native avg, sum
+    and count cost the same for two inputs and for two thousand. The same
+    heap tells the server whether anything expired (composite_expire) when
+    its timer fires and when the next input expires (composite_next_expiry),
+    so the server keeps just one timer per composite. Time is expected not to go backwards, expired value
+    counts again only after next update.
+
+    Lua state is created once per loaded configuration and the evaluation
+    script is compiled into it right away, the resulting function is kept
+    in the registry and only called on every update. Between evaluations
+    the state is only reset - globals and fields of library tables (math,
+    string, ...) and of the metatable of strings created or replaced by the
+    evaluation script are restored from the snapshot taken right after the
+    libraries are opened, and metatables the script set on the globals and
+    library tables are removed, so every evaluation sees the same
+    environment as a freshly created state would.
+
+    Scripts run in a sandbox. State gets only base, math, string and table
+    libraries, without the base functions which load code or touch the
+    garbage collector and environments, so script can neither reach files
+    and processes nor load anything. One evaluation may run at most
+    LUA_INSTRUCTIONS virtual machine instructions and allocate at most
+    LUA_MEMORY bytes more than the state held before it. Script which
+    exceeds either budget is reported once and the composite is quarantined
+    - its evaluation fails without running the script until configuration
+    is loaded again, so one runaway formula does not hold the others up.
+    State takes its memory from a pool of its own (see memory_pool), which
+    is given back as a whole when the state is closed; steady evaluations
+    reuse blocks freed by the previous ones and don't call malloc at all.
+
+    Every input carries version which grows only when its value (or partial
+    sum and count) changes or when it becomes valid or expires - not when
+    sensor just repeats the same value with new timestamp. Composite keeps
+    the sum of input versions seen by the last successful evaluation; while
+    it stays the same, evaluation returns the previous outputs without
+    running the function or script (only their time follows the newest
+    input) and such outputs are published only to keep them alive, after
+    'max_silence'. Scripts are therefore expected to depend on inputs only.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <fstream>
+#include <cxxtools/jsondeserializer.h>
+
+#if LUA_VERSION_NUM > 501
+#define s_lua_push_globals(L) lua_pushglobaltable (L)
+#define s_lua_rawlen(L, i) lua_rawlen (L, i)
+#else
+#define s_lua_push_globals(L) lua_pushvalue (L, LUA_GLOBALSINDEX)
+#define s_lua_rawlen(L, i) lua_objlen (L, i)
+#endif
+
+#define WINDOW_SAMPLES  1024                    // default max outputs kept in one window
+#define LUA_INSTRUCTIONS 1000000                // max instructions of one evaluation
+#define LUA_MEMORY      (4 * 1024 * 1024)       // max bytes one evaluation may allocate
+
+struct value {
+    double value;
+    time_t valid_till;
+    time_t time;                                // timestamp of the reading, 0 - not known
+    double offset;                              // calibration offset, native functions only
+    bool counted;                               // valid, contributes to running sum
+    double sum;                                 // contribution to running sum
+    double weight;                              // contribution to running count
+    std::vector <size_t> outputs;               // native outputs the value contributes to
+    uint64_t version;                           // changes of value or validity
+};
+
+//  Pending expiry of one value, min-heap ordered by valid_till
+typedef std::pair <time_t, value *> expiry_t;
+
+typedef enum {
+    FUNCTION_LUA = 0,                           // custom 'evaluation' script
+    FUNCTION_AVG,
+    FUNCTION_MIN,
+    FUNCTION_MAX,
+    FUNCTION_SUM,
+    FUNCTION_COUNT
+} function_t;
+
+//  One output of built-in function
+typedef struct {
+    function_t function;
+    std::string topic;
+    std::string unit;
+    std::vector <std::string> inputs;           // input topics of this output
+    std::vector <int> slots;                    // slots of inputs of this output
+    double sum;                                 // running sum of counted values with offsets
+    double count;                               // running count of counted values
+} native_output_t;
+
+//  Last published output
+typedef struct {
+    composite_output_t output;
+    time_t at;
+} published_t;
+
+static const struct {
+    const char *name;
+    function_t function;
+} s_functions [] = {
+    { "avg",    FUNCTION_AVG },
+    { "min",    FUNCTION_MIN },
+    { "max",    FUNCTION_MAX },
+    { "sum",    FUNCTION_SUM },
+    { "count",  FUNCTION_COUNT },
+    { NULL,     FUNCTION_LUA }
+};
+
+struct _composite_t {
+    std::string name;                           // name of the composite
+    std::vector <std::string> inputs;           // input topics
+    std::vector <std::string> topics;           // slot -> input topic, sorted, unique
+    std::vector <value> values;                 // slot -> last known value
+    std::vector <native_output_t> native;       // built-in outputs, empty for Lua
+    std::vector <std::string> output_topics;    // configured ones, for Lua the ones of last successful evaluation
+    int period;                                 // evaluation period [s], 0 - on every update
+    double deadband;                            // min change worth publishing, -1 - publish all
+    int max_silence;                            // max time without publishing [s], 0 - not set
+    std::map <std::string, published_t> published;  // output topic -> last published output
+    bool partials;                              // merge partial sums and counts of inputs?
+    std::vector <int> windows;                  // lengths of sliding windows of output [s]
+    size_t window_samples;                      // max outputs kept in one window
+    std::vector <expiry_t> expiry;              // heap of pending expiries
+    uint64_t version;                           // number of updates
+    uint64_t evaluated;                         // version seen by last evaluation
+    uint64_t observable;                        // sum of input versions
+    uint64_t observed;                          // observable seen by last successful evaluation
+    bool cached;                                // last evaluation succeeded, 'last' is valid
+    bool reused;                                // last evaluation returned 'last'
+    std::vector <composite_output_t> last;      // outputs of last successful evaluation
+    uint64_t evaluations;                       // number of evaluations which ran
+    uint64_t skipped;                           // number of evaluations which reused 'last'
+    lua_State *L;                               // evaluation context
+    memory_pool_t *pool;                        // memory of L
+    size_t lua_limit;                           // max memory of L in use, SIZE_MAX - no limit
+    const char *violation;                      // budget exceeded by running evaluation, if any
+    bool quarantined;                           // script exceeded budget, no longer evaluated
+    int mt_ref;                                 // registry ref of 'mt' table
+    int evaluation_ref;                         // registry ref of compiled script
+    int globals_ref;                            // registry ref of globals snapshot
+    int libraries_ref;                          // registry ref of library table -> its snapshot
+};
+
+//  --------------------------------------------------------------------------
+//  Close Lua state, if any
+
+static void
+s_lua_close (composite_t *self)
+{
+    if (self->L) {
+        lua_close (self->L);
+        self->L = NULL;
+    }
+    memory_pool_destroy (&self->pool);
+    self->mt_ref = LUA_NOREF;
+    self->evaluation_ref = LUA_NOREF;
+    self->globals_ref = LUA_NOREF;
+    self->libraries_ref = LUA_NOREF;
+}
+
+//  --------------------------------------------------------------------------
+//  Allocator of Lua state, takes blocks from pool of the composite and
+//  refuses to grow it beyond lua_limit
+
+static void *
+s_lua_alloc (void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    composite_t *self = (composite_t *) ud;
+    if (!ptr)
+        osize = 0;      // Lua 5.2+ passes type of new object
+    if (nsize > osize && memory_pool_in_use (self->pool) - osize + nsize > self->lua_limit) {
+        self->violation = "memory";
+        return NULL;
+    }
+    return memory_pool_realloc (self->pool, ptr, osize, nsize);
+}
+
+//  --------------------------------------------------------------------------
+//  Count hook, called once evaluation used up its instructions
+
+static void
+s_lua_hook (lua_State *L, lua_Debug *)
+{
+    void *ud;
+    lua_getallocf (L, &ud);
+    composite_t *self = (composite_t *) ud;
+    self->violation = "instruction";
+    // from now on every instruction fails, so the script can't keep
+    // running by catching the error with pcall
+    lua_sethook (L, s_lua_hook, LUA_MASKCOUNT, 1);
+    luaL_error (L, "instruction budget exceeded");
+}
+
+//  --------------------------------------------------------------------------
+//  Error outside of protected call, state can't be used anymore
+
+static int
+s_lua_panic (lua_State *L)
+{
+    log_error ("unprotected error in Lua state: %s", lua_tostring (L, -1));
+    return 0;
+}
+
+//  Libraries available to scripts
+static const luaL_Reg s_lua_libs [] = {
+    { "_G",             luaopen_base },
+    { LUA_MATHLIBNAME,  luaopen_math },
+    { LUA_STRLIBNAME,   luaopen_string },
+    { LUA_TABLIBNAME,   luaopen_table },
+    { NULL,             NULL }
+};
+
+//  Base functions removed from the sandbox
+static const char *s_lua_unsafe [] = {
+    "collectgarbage", "coroutine", "dofile", "gcinfo", "getfenv", "load",
+    "loadfile", "loadstring", "module", "newproxy", "require", "setfenv",
+    NULL
+};
+
+//  --------------------------------------------------------------------------
+//  Push shallow copy of table at absolute 'index'
+
+static void
+s_lua_copy (lua_State *L, int index)
+{
+    lua_newtable (L);
+    lua_pushnil (L);
+    while (lua_next (L, index) != 0) {
+        // copy, key, value
+        lua_pushvalue (L, -2);
+        lua_insert (L, -2);
+        lua_rawset (L, -4);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Make table at absolute 'index' equal to its shallow copy at 'snapshot'
+
+static void
+s_lua_restore (lua_State *L, int index, int snapshot)
+{
+    // drop fields created by the script, restore replaced ones
+    lua_pushnil (L);
+    while (lua_next (L, index) != 0) {
+        // key, value
+        lua_pushvalue (L, -2);
+        lua_rawget (L, snapshot);
+        if (lua_rawequal (L, -2, -1)) {
+            lua_pop (L, 2);
+            continue;
+        }
+        // modification of existing fields is allowed during traversal
+        lua_pushvalue (L, -3);
+        lua_insert (L, -2);
+        lua_rawset (L, index);
+        lua_pop (L, 1);
+    }
+
+    // restore fields removed by the script
+    lua_pushnil (L);
+    while (lua_next (L, snapshot) != 0) {
+        lua_pushvalue (L, -2);
+        lua_rawget (L, index);
+        if (!lua_isnil (L, -1)) {
+            lua_pop (L, 2);
+            continue;
+        }
+        lua_pop (L, 1);
+        lua_pushvalue (L, -2);
+        lua_insert (L, -2);
+        lua_rawset (L, index);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Create sandboxed Lua state, 'mt' table, compiled 'lua_code' and snapshot
+//  of pristine globals
+//  0 - success, -1 - error
+
+static int
+s_lua_open (composite_t *self, const std::string &lua_code)
+{
+    s_lua_close (self);
+    self->pool = memory_pool_new ();
+    self->lua_limit = SIZE_MAX;
+    self->L = lua_newstate (s_lua_alloc, self);
+    if (!self->L) {
+        log_error ("%s: cannot create Lua state", self->name.c_str ());
+        return -1;
+    }
+    lua_State *L = self->L;
+    lua_atpanic (L, s_lua_panic);
+    for (const luaL_Reg *lib = s_lua_libs; lib->func; lib++) {
+#if LUA_VERSION_NUM > 501
+        luaL_requiref (L, lib->name, lib->func, 1);
+        lua_pop (L, 1);
+#else
+        lua_pushcfunction (L, lib->func);
+        lua_pushstring (L, lib->name);
+        lua_call (L, 1, 0);
+#endif
+    }
+    for (int i = 0; s_lua_unsafe [i]; i++) {
+        lua_pushnil (L);
+        lua_setglobal (L, s_lua_unsafe [i]);
+    }
+
+    lua_newtable (L);
+    self->mt_ref = luaL_ref (L, LUA_REGISTRYINDEX);
+
+    if (luaL_loadbuffer (L, lua_code.c_str (), lua_code.length (), "line") != 0) {
+        log_error ("%s: %s", self->name.c_str (), lua_tostring (L, -1));
+        s_lua_close (self);
+        return -1;
+    }
+    self->evaluation_ref = luaL_ref (L, LUA_REGISTRYINDEX);
+
+    lua_settop (L, 0);
+    s_lua_push_globals (L);                                 // 1
+    s_lua_copy (L, 1);                                      // 2
+    // library tables one level deep, globals table itself is the snapshot above
+    lua_newtable (L);                                       // 3
+    lua_pushnil (L);
+    while (lua_next (L, 1) != 0) {
+        // 4 - key, 5 - value
+        if (lua_istable (L, 5) && !lua_rawequal (L, 1, 5)) {
+            lua_pushvalue (L, 5);
+            s_lua_copy (L, 5);
+            lua_rawset (L, 3);
+        }
+        lua_pop (L, 1);
+    }
+    // metatable shared by all strings, script can reach it by getmetatable
+    lua_pushliteral (L, "");                                // 4
+    if (lua_getmetatable (L, 4)) {
+        // 5 - metatable
+        lua_pushvalue (L, 5);
+        s_lua_copy (L, 5);
+        lua_rawset (L, 3);
+    }
+    lua_settop (L, 3);
+    self->libraries_ref = luaL_ref (L, LUA_REGISTRYINDEX);
+    self->globals_ref = luaL_ref (L, LUA_REGISTRYINDEX);
+    lua_settop (L, 0);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Bring globals, library tables and metatable of strings back to the state
+//  right after s_lua_open
+
+static void
+s_lua_reset (composite_t *self)
+{
+    lua_State *L = self->L;
+    lua_settop (L, 0);
+    s_lua_push_globals (L);                                     // 1
+    lua_rawgeti (L, LUA_REGISTRYINDEX, self->globals_ref);      // 2
+    s_lua_restore (L, 1, 2);
+    // none of the snapshotted tables has metatable of its own
+    lua_pushnil (L);
+    lua_setmetatable (L, 1);
+
+    lua_rawgeti (L, LUA_REGISTRYINDEX, self->libraries_ref);    // 3
+    lua_pushnil (L);
+    while (lua_next (L, 3) != 0) {
+        // 4 - library table, 5 - its snapshot
+        s_lua_restore (L, 4, 5);
+        lua_pushnil (L);
+        lua_setmetatable (L, 4);
+        lua_pop (L, 1);
+    }
+    lua_settop (L, 0);
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new composite named 'name' without any configuration
+
+composite_t *
+composite_new (const char *name)
+{
+    assert (name);
+
+    composite_t *self = new _composite_t ();
+    self->name = name;
+    self->deadband = -1;
+    self->window_samples = WINDOW_SAMPLES;
+    self->L = NULL;
+    self->pool = NULL;
+    self->lua_limit = SIZE_MAX;
+    self->violation = NULL;
+    self->quarantined = false;
+    self->mt_ref = LUA_NOREF;
+    self->evaluation_ref = LUA_NOREF;
+    self->globals_ref = LUA_NOREF;
+    self->libraries_ref = LUA_NOREF;
+    self->observable = 0;
+    self->observed = 0;
+    self->cached = false;
+    self->reused = false;
+    self->evaluations = 0;
+    self->skipped = 0;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Get name of the composite
+
+const char *
+composite_name (composite_t *self)
+{
+    assert (self);
+    return self->name.c_str ();
+}
+
+//  --------------------------------------------------------------------------
+//  Read 'function', 'output', 'unit' and optional subset of 'inputs' of one
+//  built-in output from 'si'
+//  0 - success, -1 - error
+
+static int
+s_load_output (
+        composite_t *self,
+        const cxxtools::SerializationInfo &si,
+        const std::vector <std::string> &inputs,
+        const char *filename,
+        native_output_t &output)
+{
+    std::string function_name;
+    si.getMember ("function") >>= function_name;
+    output.function = FUNCTION_LUA;
+    for (int i = 0; s_functions [i].name; i++) {
+        if (function_name == s_functions [i].name)
+            output.function = s_functions [i].function;
+    }
+    if (output.function == FUNCTION_LUA) {
+        log_error ("%s: unknown function '%s' in config file '%s'", self->name.c_str (), function_name.c_str (), filename);
+        return -1;
+    }
+    si.getMember ("output") >>= output.topic;
+    si.getMember ("unit") >>= output.unit;
+    if (output.topic.find ('@') == std::string::npos) {
+        log_error ("%s: invalid output topic '%s' in config file '%s'", self->name.c_str (), output.topic.c_str (), filename);
+        return -1;
+    }
+    const cxxtools::SerializationInfo *inputs_si = si.findMember ("in");
+    if (!inputs_si) {
+        output.inputs = inputs;
+        return 0;
+    }
+    for (const auto &it : *inputs_si) {
+        std::string topic;
+        it >>= topic;
+        if (std::find (inputs.begin (), inputs.end (), topic) == inputs.end ()) {
+            log_error ("%s: input '%s' of '%s' is not listed in 'in' in config file '%s'",
+                    self->name.c_str (), topic.c_str (), output.topic.c_str (), filename);
+            return -1;
+        }
+        output.inputs.push_back (topic);
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Load configuration file
+
+int
+composite_load (composite_t *self, const char *filename)
+{
+    assert (self);
+    assert (filename);
+
+    std::ifstream f (filename);
+    if (!f.good ()) {
+        log_error ("%s: cannot open config file '%s' correctly", self->name.c_str (), filename);
+        return -1;
+    }
+
+    std::string lua_code;
+    std::vector <std::string> inputs;
+    std::vector <native_output_t> native;
+    std::map <std::string, double> offsets;
+    int period = 0;
+    double deadband = -1;
+    int max_silence = 0;
+    bool partials = false;
+    std::vector <int> windows;
+    int window_samples = WINDOW_SAMPLES;
+    try {
+        cxxtools::JsonDeserializer json (f);
+        json.deserialize ();
+        const cxxtools::SerializationInfo *si = json.si ();
+        for (const auto &it : si->getMember ("in")) {
+            std::string buff;
+            it >>= buff;
+            inputs.push_back (buff);
+        }
+        if (si->findMember ("period")) {
+            si->getMember ("period") >>= period;
+            if (period < 0) {
+                log_error ("%s: invalid period %d in config file '%s'", self->name.c_str (), period, filename);
+                return -1;
+            }
+        }
+        if (si->findMember ("deadband")) {
+            si->getMember ("deadband") >>= deadband;
+            if (deadband < 0) {
+                log_error ("%s: invalid deadband %f in config file '%s'", self->name.c_str (), deadband, filename);
+                return -1;
+            }
+        }
+        if (si->findMember ("max_silence")) {
+            si->getMember ("max_silence") >>= max_silence;
+            if (max_silence <= 0) {
+                log_error ("%s: invalid max_silence %d in config file '%s'", self->name.c_str (), max_silence, filename);
+                return -1;
+            }
+        }
+        if (si->findMember ("partials"))
+            si->getMember ("partials") >>= partials;
+        const cxxtools::SerializationInfo *windows_si = si->findMember ("windows");
+        if (windows_si) {
+            for (const auto &it : *windows_si) {
+                int length;
+                it >>= length;
+                if (length <= 0) {
+                    log_error ("%s: invalid window %d in config file '%s'", self->name.c_str (), length, filename);
+                    return -1;
+                }
+                windows.push_back (length);
+            }
+        }
+        if (si->findMember ("window_samples")) {
+            si->getMember ("window_samples") >>= window_samples;
+            if (window_samples <= 0) {
+                log_error ("%s: invalid window_samples %d in config file '%s'", self->name.c_str (), window_samples, filename);
+                return -1;
+            }
+        }
+        if (si->findMember ("evaluation")) {
+            si->getMember ("evaluation") >>= lua_code;
+            if (partials) {
+                log_error ("%s: partials need built-in function in config file '%s'", self->name.c_str (), filename);
+                return -1;
+            }
+        }
+        else {
+            const cxxtools::SerializationInfo *outputs_si = si->findMember ("outputs");
+            if (outputs_si) {
+                for (const auto &it : *outputs_si) {
+                    native_output_t output;
+                    if (s_load_output (self, it, inputs, filename, output) != 0)
+                        return -1;
+                    for (const auto &other : native) {
+                        if (other.topic == output.topic) {
+                            log_error ("%s: duplicate output topic '%s' in config file '%s'", self->name.c_str (), output.topic.c_str (), filename);
+                            return -1;
+                        }
+                    }
+                    native.push_back (output);
+                }
+                if (native.empty ()) {
+                    log_error ("%s: empty 'outputs' in config file '%s'", self->name.c_str (), filename);
+                    return -1;
+                }
+            }
+            else {
+                native_output_t output;
+                if (s_load_output (self, *si, inputs, filename, output) != 0)
+                    return -1;
+                native.push_back (output);
+            }
+            const cxxtools::SerializationInfo *offsets_si = si->findMember ("offsets");
+            if (offsets_si) {
+                for (const auto &it : *offsets_si) {
+                    double offset;
+                    it >>= offset;
+                    offsets [it.name ()] = offset;
+                }
+            }
+        }
+    }
+    catch (const std::exception &e) {
+        log_error ("%s: cannot deserialize config file '%s' with '%s'", self->name.c_str (), filename, e.what ());
+        return -1;
+    }
+
+    self->quarantined = false;
+    if (native.empty ()) {
+        if (s_lua_open (self, lua_code) != 0) {
+            // old script is gone, so are its outputs
+            self->cached = false;
+            return -1;
+        }
+    }
+    else {
+        // native function does not need interpreter at all
+        s_lua_close (self);
+    }
+    self->inputs = inputs;
+    self->native = native;
+    self->output_topics.clear ();
+    for (const auto &output : native)
+        self->output_topics.push_back (output.topic);
+    self->period = period;
+    self->deadband = deadband;
+    self->max_silence = max_silence;
+    self->published.clear ();
+    self->partials = partials;
+    self->windows = windows;
+    self->window_samples = window_samples;
+    self->expiry.clear ();
+    self->version = 0;
+    self->evaluated = 0;
+    self->cached = false;
+    self->reused = false;
+    self->last.clear ();
+
+    // one slot with expired value for every input
+    self->topics = inputs;
+    std::sort (self->topics.begin (), self->topics.end ());
+    self->topics.erase (std::unique (self->topics.begin (), self->topics.end ()), self->topics.end ());
+    self->values.clear ();
+    for (const auto &topic : self->topics) {
+        value expired;
+        expired.value = 0;
+        expired.valid_till = 0;
+        expired.time = 0;
+        expired.counted = false;
+        expired.sum = 0;
+        expired.weight = 0;
+        expired.version = 0;
+        auto offset = offsets.find (topic);
+        expired.offset = offset == offsets.end () ? 0 : offset->second;
+        self->values.push_back (expired);
+    }
+    for (size_t i = 0; i < self->native.size (); i++) {
+        native_output_t &output = self->native [i];
+        output.sum = 0;
+        output.count = 0;
+        for (const auto &topic : output.inputs)
+            output.slots.push_back (composite_slot (self, topic.c_str ()));
+        std::sort (output.slots.begin (), output.slots.end ());
+        output.slots.erase (std::unique (output.slots.begin (), output.slots.end ()), output.slots.end ());
+        for (int slot : output.slots)
+            self->values [slot].outputs.push_back (i);
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Get list of input topics of the loaded configuration
+
+const std::vector <std::string> &
+composite_inputs (composite_t *self)
+{
+    assert (self);
+    return self->inputs;
+}
+
+//  --------------------------------------------------------------------------
+//  Get slot of input 'topic', -1 if it is not an input
+
+int
+composite_slot (composite_t *self, const char *topic)
+{
+    assert (self);
+    assert (topic);
+    auto it = std::lower_bound (self->topics.begin (), self->topics.end (), topic,
+            [] (const std::string &a, const char *b) { return strcmp (a.c_str (), b) < 0; });
+    if (it == self->topics.end () || *it != topic)
+        return -1;
+    return it - self->topics.begin ();
+}
+
+//  --------------------------------------------------------------------------
+//  Is 'topic' one of inputs of the loaded configuration?
+
+bool
+composite_has_input (composite_t *self, const char *topic)
+{
+    return composite_slot (self, topic) != -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Store new value of input 'topic'
+
+void
+composite_update (composite_t *self, const char *topic, double value, time_t valid_till)
+{
+    int slot = composite_slot (self, topic);
+    if (slot == -1) {
+        log_debug ("%s: '%s' is not an input", self->name.c_str (), topic);
+        return;
+    }
+    composite_update_slot (self, slot, value, 0, valid_till);
+}
+
+//  --------------------------------------------------------------------------
+//  Store 'value' of input in 'slot' read at 'time' contributing 'sum' and
+//  'count', unless valid value in the slot is newer
+//  0 - stored, -1 - dropped
+
+static int
+s_update_slot (composite_t *self, int slot, double value, double sum, double count, time_t time, time_t valid_till)
+{
+    assert (slot >= 0 && (size_t) slot < self->values.size ());
+
+    struct value &val = self->values [slot];
+    // delayed or replayed reading; once the newer one expires, sensor
+    // with clock set back is heard again
+    if (val.counted && time < val.time) {
+        log_debug ("%s: reading from %ld is older than %ld, dropped",
+                self->name.c_str (), (long) time, (long) val.time);
+        return -1;
+    }
+    // repeated value only extends validity, evaluation would not change
+    if (!val.counted || val.value != value || val.sum != sum + val.offset * count || val.weight != count) {
+        val.version++;
+        self->observable++;
+    }
+    for (size_t i : val.outputs) {
+        if (val.counted) {
+            self->native [i].sum -= val.sum;
+            self->native [i].count -= val.weight;
+        }
+        self->native [i].sum += sum + val.offset * count;
+        self->native [i].count += count;
+    }
+    val.sum = sum + val.offset * count;
+    val.weight = count;
+    val.counted = true;
+
+    // Superseded expiries stay in the heap until they are due, don't
+    // let frequently updated inputs grow it without bounds
+    if (self->expiry.size () > 4 * self->values.size () + 64) {
+        self->expiry.clear ();
+        for (auto &i : self->values) {
+            if (i.counted && &i != &val)
+                self->expiry.push_back (expiry_t (i.valid_till, &i));
+        }
+        std::make_heap (self->expiry.begin (), self->expiry.end (), std::greater <expiry_t> ());
+    }
+    self->expiry.push_back (expiry_t (valid_till, &val));
+    std::push_heap (self->expiry.begin (), self->expiry.end (), std::greater <expiry_t> ());
+    val.value = value;
+    val.valid_till = valid_till;
+    val.time = time;
+    self->version++;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Store new value of input in 'slot' read at 'time'
+
+int
+composite_update_slot (composite_t *self, int slot, double value, time_t time, time_t valid_till)
+{
+    assert (self);
+    return s_update_slot (self, slot, value, value, 1, time, valid_till);
+}
+
+//  --------------------------------------------------------------------------
+//  Store output of another composite as input in 'slot'
+
+int
+composite_update_slot_partial (composite_t *self, int slot, const composite_output_t &partial, time_t valid_till)
+{
+    assert (self);
+    if (self->partials)
+        return s_update_slot (self, slot, partial.value, partial.sum, partial.count, partial.time, valid_till);
+    return s_update_slot (self, slot, partial.value, partial.value, 1, partial.time, valid_till);
+}
+
+//  --------------------------------------------------------------------------
+//  Take over values of inputs 'previous' has too, still valid at 'now'
+
+size_t
+composite_inherit (composite_t *self, composite_t *previous, time_t now, std::vector <time_t> &valid_till)
+{
+    assert (self);
+    assert (previous);
+    valid_till.clear ();
+    for (size_t i = 0; i < previous->values.size (); i++) {
+        const value &val = previous->values [i];
+        if (!val.counted || val.valid_till < now)
+            continue;
+        int slot = composite_slot (self, previous->topics [i].c_str ());
+        if (slot == -1)
+            continue;
+        // contribution is rebuilt with the new offset
+        if (self->partials)
+            s_update_slot (self, slot, val.value, val.sum - val.offset * val.weight, val.weight, val.time, val.valid_till);
+        else
+            s_update_slot (self, slot, val.value, val.value, 1, val.time, val.valid_till);
+        valid_till.push_back (val.valid_till);
+    }
+    return valid_till.size ();
+}
+
+//  --------------------------------------------------------------------------
+//  Was any input updated since last evaluation?
+
+bool
+composite_changed (composite_t *self)
+{
+    assert (self);
+    return self->version != self->evaluated;
+}
+
+//  --------------------------------------------------------------------------
+//  Remove contributions of values which expired before 'now'
+//  Returns number of removed values
+
+static size_t
+s_expire (composite_t *self, time_t now)
+{
+    size_t expired = 0;
+    while (!self->expiry.empty () && self->expiry.front ().first < now) {
+        expiry_t due = self->expiry.front ();
+        std::pop_heap (self->expiry.begin (), self->expiry.end (), std::greater <expiry_t> ());
+        self->expiry.pop_back ();
+        value *val = due.second;
+        // value was updated since or already removed
+        if (!val->counted || val->valid_till != due.first)
+            continue;
+        for (size_t i : val->outputs) {
+            self->native [i].sum -= val->sum;
+            self->native [i].count -= val->weight;
+            // don't carry rounding errors over periods without data
+            if (self->native [i].count == 0)
+                self->native [i].sum = 0;
+        }
+        val->counted = false;
+        val->version++;
+        self->observable++;
+        expired++;
+    }
+    return expired;
+}
+
+//  --------------------------------------------------------------------------
+//  Drop inputs which are no longer valid at 'now'
+
+size_t
+composite_expire (composite_t *self, time_t now)
+{
+    assert (self);
+    return s_expire (self, now);
+}
+
+//  --------------------------------------------------------------------------
+//  Get validity of the input which expires first
+
+time_t
+composite_next_expiry (composite_t *self)
+{
+    assert (self);
+    // drop superseded expiries from the top of the heap
+    while (!self->expiry.empty ()) {
+        const expiry_t &next = self->expiry.front ();
+        if (next.second->counted && next.second->valid_till == next.first)
+            return next.first;
+        std::pop_heap (self->expiry.begin (), self->expiry.end (), std::greater <expiry_t> ());
+        self->expiry.pop_back ();
+    }
+    return -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Did the last evaluation reuse outputs of the previous one?
+
+bool
+composite_reused (composite_t *self)
+{
+    assert (self);
+    return self->reused;
+}
+
+//  --------------------------------------------------------------------------
+//  Did the script exceed its budget?
+
+bool
+composite_quarantined (composite_t *self)
+{
+    assert (self);
+    return self->quarantined;
+}
+
+//  --------------------------------------------------------------------------
+//  Get memory statistics of Lua state
+
+void
+composite_memory (composite_t *self, size_t &in_use, size_t &reserved, uint64_t &mallocs)
+{
+    assert (self);
+    in_use = self->pool ? memory_pool_in_use (self->pool) : 0;
+    reserved = self->pool ? memory_pool_reserved (self->pool) : 0;
+    mallocs = self->pool ? memory_pool_mallocs (self->pool) : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of evaluations which ran and which reused previous outputs
+
+void
+composite_evaluations (composite_t *self, uint64_t &evaluated, uint64_t &skipped)
+{
+    assert (self);
+    evaluated = self->evaluations;
+    skipped = self->skipped;
+}
+
+//  --------------------------------------------------------------------------
+//  Get configured evaluation period
+
+int
+composite_period (composite_t *self)
+{
+    assert (self);
+    return self->period;
+}
+
+//  --------------------------------------------------------------------------
+//  Get configured lengths of sliding windows
+
+const std::vector <int> &
+composite_windows (composite_t *self)
+{
+    assert (self);
+    return self->windows;
+}
+
+//  --------------------------------------------------------------------------
+//  Get configured max number of outputs kept in one window
+
+size_t
+composite_window_samples (composite_t *self)
+{
+    assert (self);
+    return self->window_samples;
+}
+
+//  --------------------------------------------------------------------------
+//  Should 'output' evaluated at 'now' be published? Remembers it if so.
+
+bool
+composite_should_publish (composite_t *self, const composite_output_t &output, time_t now, int max_silence)
+{
+    assert (self);
+    if (self->max_silence > 0)
+        max_silence = self->max_silence;
+    auto last = self->published.find (output.topic);
+    // reused output is news only when it has to be heard again
+    double deadband = self->reused ? std::max (self->deadband, 0.0) : self->deadband;
+    bool publish = deadband < 0
+        || last == self->published.end ()
+        || output.unit != last->second.output.unit
+        || fabs (output.value - last->second.output.value) > deadband
+        || (max_silence > 0 && now - last->second.at >= max_silence);
+    if (publish)
+        self->published [output.topic] = { output, now };
+    return publish;
+}
+
+//  --------------------------------------------------------------------------
+//  Get output topic, empty if not known yet
+
+const char *
+composite_output_topic (composite_t *self)
+{
+    assert (self);
+    return self->output_topics.empty () ? "" : self->output_topics [0].c_str ();
+}
+
+//  --------------------------------------------------------------------------
+//  Get all output topics, empty if not known yet
+
+const std::vector <std::string> &
+composite_output_topics (composite_t *self)
+{
+    assert (self);
+    return self->output_topics;
+}
+
+//  --------------------------------------------------------------------------
+//  Get the newest timestamp of valid values in 'slots', 0 if none is known
+
+static time_t
+s_newest (composite_t *self, const std::vector <int> &slots)
+{
+    time_t newest = 0;
+    for (int slot : slots) {
+        const value &i = self->values [slot];
+        if (i.counted)
+            newest = std::max (newest, i.time);
+    }
+    return newest;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate built-in functions over inputs still valid at 'now'
+
+static int
+s_native_evaluate (composite_t *self, time_t now, std::vector <composite_output_t> &outputs)
+{
+    s_expire (self, now);
+
+    for (const auto &native : self->native) {
+        double result = native.sum;
+        double count = native.count;
+        if (native.function == FUNCTION_MIN || native.function == FUNCTION_MAX) {
+            bool first = true;
+            for (int slot : native.slots) {
+                const value &i = self->values [slot];
+                if (!i.counted)
+                    continue;
+                double v = i.value + i.offset;
+                if (first
+                ||  (native.function == FUNCTION_MIN && v < result)
+                ||  (native.function == FUNCTION_MAX && v > result))
+                    result = v;
+                first = false;
+            }
+        }
+        if (native.function == FUNCTION_COUNT)
+            result = count;
+        else
+        if (count == 0) {
+            log_error ("%s: all sensors of '%s' lost", self->name.c_str (), native.topic.c_str ());
+            continue;
+        }
+        else
+        if (native.function == FUNCTION_AVG)
+            result /= count;
+
+        composite_output_t output;
+        output.topic = native.topic;
+        output.value = result;
+        output.unit = native.unit;
+        output.time = s_newest (self, native.slots);
+        // partial of min and max is one reading, of count the count itself
+        if (native.function == FUNCTION_MIN || native.function == FUNCTION_MAX) {
+            output.sum = result;
+            output.count = 1;
+        }
+        else {
+            output.sum = native.function == FUNCTION_COUNT ? count : native.sum;
+            output.count = count;
+        }
+        outputs.push_back (output);
+    }
+    return outputs.empty () ? -1 : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Read one output of Lua script - topic, value and unit - from stack
+//  'index', 'index' + 1 and 'index' + 2
+//  0 - success, -1 - error
+
+static int
+s_lua_output (composite_t *self, lua_State *L, int index, composite_output_t &output)
+{
+    if (!lua_isstring (L, index) || strrchr (lua_tostring (L, index), '@') == NULL) {
+        log_error ("%s: invalid output topic", self->name.c_str ());
+        return -1;
+    }
+    if (!lua_isnumber (L, index + 1) || !lua_isstring (L, index + 2)) {
+        log_error ("%s: output '%s' needs topic, value and unit", self->name.c_str (), lua_tostring (L, index));
+        return -1;
+    }
+    output.topic = lua_tostring (L, index);
+    output.value = lua_tonumber (L, index + 1);
+    output.unit = lua_tostring (L, index + 2);
+    output.sum = output.value;
+    output.count = 1;
+    output.time = 0;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate Lua script over inputs still valid at 'now'
+
+static int
+s_lua_evaluate (composite_t *self, time_t now, std::vector <composite_output_t> &outputs)
+{
+    if (!self->L) {
+        log_error ("%s: evaluation before configuration", self->name.c_str ());
+        return -1;
+    }
+    if (self->quarantined)
+        return -1;
+    lua_State *L = self->L;
+    s_expire (self, now);
+
+    // Prepare data for computation, table is reused between evaluations
+    lua_settop (L, 0);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, self->mt_ref);
+    lua_pushnil (L);
+    lua_setmetatable (L, 1);
+    lua_pushnil (L);
+    while (lua_next (L, 1) != 0) {
+        lua_pop (L, 1);
+        lua_pushvalue (L, -1);
+        lua_pushnil (L);
+        lua_rawset (L, 1);
+    }
+    time_t newest = 0;
+    for (size_t slot = 0; slot < self->values.size (); slot++) {
+        const value &i = self->values [slot];
+        if (now > i.valid_till) {
+            // can't count average, missing measurements from sensor
+            continue;
+        }
+        newest = std::max (newest, i.time);
+        log_debug ("%s - %s, %f", self->name.c_str (), self->topics [slot].c_str (), i.value);
+        lua_pushlstring (L, self->topics [slot].c_str (), self->topics [slot].size ());
+        lua_pushnumber (L, i.value);
+        lua_rawset (L, 1);
+    }
+    lua_setglobal (L, "mt");
+
+    // Do the real processing
+    int rv = -1;
+    lua_rawgeti (L, LUA_REGISTRYINDEX, self->evaluation_ref);
+    self->violation = NULL;
+    self->lua_limit = memory_pool_in_use (self->pool) + LUA_MEMORY;
+    lua_sethook (L, s_lua_hook, LUA_MASKCOUNT, LUA_INSTRUCTIONS);
+    int error = lua_pcall (L, 0, LUA_MULTRET, 0);
+    lua_sethook (L, NULL, 0, 0);
+    self->lua_limit = SIZE_MAX;
+    if (self->violation) {
+        // even when the script caught the error and returned normally
+        log_error ("%s: evaluation exceeded %s budget, composite quarantined till next load",
+                self->name.c_str (), self->violation);
+        self->quarantined = true;
+    }
+    else
+    if (error != 0) {
+        log_error ("%s: %s", self->name.c_str (), lua_tostring (L, -1));
+    }
+    else
+    if (lua_gettop (L) == 0) {
+        log_error ("%s: not enough valid data", self->name.c_str ());
+    }
+    else
+    if (lua_istable (L, 1)) {
+        // list of { topic, value, unit }
+        rv = 0;
+        int count = (int) s_lua_rawlen (L, 1);
+        for (int i = 1; i <= count && rv == 0; i++) {
+            lua_rawgeti (L, 1, i);
+            if (!lua_istable (L, -1)) {
+                log_error ("%s: output %d is not a table", self->name.c_str (), i);
+                lua_pop (L, 1);
+                rv = -1;
+                continue;
+            }
+            for (int j = 1; j <= 3; j++)
+                lua_rawgeti (L, -j, j);
+            composite_output_t output;
+            rv = s_lua_output (self, L, lua_gettop (L) - 2, output);
+            if (rv == 0)
+                outputs.push_back (output);
+            lua_pop (L, 4);
+        }
+        if (rv == 0 && outputs.empty ()) {
+            log_error ("%s: not enough valid data", self->name.c_str ());
+            rv = -1;
+        }
+    }
+    else {
+        // one output, anything after unit is ignored
+        lua_settop (L, 3);
+        composite_output_t output;
+        rv = s_lua_output (self, L, 1, output);
+        if (rv == 0)
+            outputs.push_back (output);
+    }
+    if (rv == 0) {
+        self->output_topics.clear ();
+        for (auto &output : outputs) {
+            output.time = newest;
+            self->output_topics.push_back (output.topic);
+        }
+    }
+    else
+        outputs.clear ();
+    s_lua_reset (self);
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Move time of reused 'outputs' to the newest timestamp of their inputs
+//  valid at 'now'
+
+static void
+s_refresh_time (composite_t *self, time_t now, std::vector <composite_output_t> &outputs)
+{
+    if (self->native.empty ()) {
+        time_t newest = 0;
+        for (const auto &i : self->values) {
+            if (now <= i.valid_till)
+                newest = std::max (newest, i.time);
+        }
+        for (auto &output : outputs)
+            output.time = newest;
+        return;
+    }
+    // outputs without valid input are left out, the rest keeps the order
+    size_t i = 0;
+    for (const auto &native : self->native) {
+        if (i < outputs.size () && outputs [i].topic == native.topic)
+            outputs [i++].time = s_newest (self, native.slots);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate composite over inputs still valid at 'now', all outputs
+
+int
+composite_evaluate_all (composite_t *self, time_t now, std::vector <composite_output_t> &outputs)
+{
+    assert (self);
+    self->evaluated = self->version;
+    outputs.clear ();
+    s_expire (self, now);
+    if (self->cached && self->observable == self->observed) {
+        outputs = self->last;
+        s_refresh_time (self, now, outputs);
+        self->reused = true;
+        self->skipped++;
+        return 0;
+    }
+    self->reused = false;
+    self->evaluations++;
+    int rv;
+    if (!self->native.empty ())
+        rv = s_native_evaluate (self, now, outputs);
+    else
+        rv = s_lua_evaluate (self, now, outputs);
+    self->cached = rv == 0;
+    if (self->cached) {
+        self->last = outputs;
+        self->observed = self->observable;
+    }
+
+    // output disappeared, next one is news whatever the value
+    for (auto it = self->published.begin (); it != self->published.end (); ) {
+        bool present = false;
+        for (const auto &output : outputs)
+            present = present || output.topic == it->first;
+        if (present)
+            ++it;
+        else
+            it = self->published.erase (it);
+    }
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate composite over inputs still valid at 'now', first output only
+
+int
+composite_evaluate (composite_t *self, time_t now, composite_output_t &output)
+{
+    assert (self);
+    std::vector <composite_output_t> outputs;
+    if (composite_evaluate_all (self, now, outputs) != 0)
+        return -1;
+    output = outputs [0];
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the composite
+
+void
+composite_destroy (composite_t **self_p)
+{
+    if (!self_p)
+        return;
+    if (*self_p) {
+        composite_t *self = *self_p;
+        s_lua_close (self);
+        delete self;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Helper test function
+//  Evaluate 'lua_code' over 'cache' the way server did before composite_t
+//  existed - with brand new Lua state for every message
+
+static int
+test_reference_evaluate (
+        const std::string &lua_code,
+        const std::map <std::string, value> &cache,
+        time_t now,
+        composite_output_t &output)
+{
+#if LUA_VERSION_NUM > 501
+    lua_State *L = luaL_newstate ();
+#else
+    lua_State *L = lua_open ();
+#endif
+    luaL_openlibs (L);
+    lua_newtable (L);
+    for (const auto &i : cache) {
+        if (now > i.second.valid_till)
+            continue;
+        lua_pushstring (L, i.first.c_str ());
+        lua_pushnumber (L, i.second.value);
+        lua_settable (L, -3);
+    }
+    lua_setglobal (L, "mt");
+
+    int rv = -1;
+    int error = luaL_loadbuffer (L, lua_code.c_str (), lua_code.length (), "line") ||
+        lua_pcall (L, 0, 3, 0);
+    if (!error && lua_gettop (L) == 3 && lua_isstring (L, -3)) {
+        output.topic = lua_tostring (L, -3);
+        output.value = lua_tonumber (L, -2);
+        output.unit = lua_isstring (L, -1) ? lua_tostring (L, -1) : "";
+        rv = 0;
+    }
+    lua_close (L);
+    return rv;
+}
+
+//  Helper test function
+//  Cached value 'v' valid till 'valid_till' with calibration 'offset', the
+//  rest of fields is zero
+
+static value
+test_value (double v, time_t valid_till, double offset = 0)
+{
+    value result = value ();
+    result.value = v;
+    result.valid_till = valid_till;
+    result.offset = offset;
+    return result;
+}
+
+//  Helper test function
+//  Write config file with 'inputs' and 'lua_code'
+
+static void
+test_write_config (const char *filename, const std::vector <std::string> &inputs, const std::string &lua_code)
+{
+    std::ofstream f (filename);
+    f << "{\n  \"in\": [";
+    for (size_t i = 0; i < inputs.size (); i++)
+        f << (i ? ", " : " ") << "\"" << inputs [i] << "\"";
+    f << " ],\n  \"evaluation\": \"" << lua_code << "\"\n}\n";
+    f.close ();
+}
+
+//  Helper test function
+//  Write config file with built-in 'function' over 'inputs'
+
+static void
+test_write_native_config (
+        const char *filename,
+        const std::vector <std::string> &inputs,
+        const char *function,
+        const std::map <std::string, double> &offsets)
+{
+    std::ofstream f (filename);
+    f << "{\n  \"in\": [";
+    for (size_t i = 0; i < inputs.size (); i++)
+        f << (i ? ", " : " ") << "\"" << inputs [i] << "\"";
+    f << " ],\n  \"function\": \"" << function << "\",\n  \"offsets\": {";
+    size_t i = 0;
+    for (const auto &it : offsets)
+        f << (i++ ? ", " : " ") << "\"" << it.first << "\": " << it.second;
+    f << " },\n  \"output\": \"" << function << ".temperature@world\",\n  \"unit\": \"C\"\n}\n";
+    f.close ();
+}
+
+void
+composite_test (bool verbose)
+{
+    if (verbose)
+        log_set_level (LOG_DEBUG);
+    printf (" * composite: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    zsys_dir_create ("src/selftest-rw");
+    const char *cfg = "src/selftest-rw/composite-test.cfg";
+
+    std::vector <std::string> inputs = { "temperature@TH1", "temperature@TH2", "temperature@TH3" };
+    // Script deliberately pollutes globals - counter of runs, removal of
+    // standard library table - persistent state must hide it
+    std::string lua_code =
+        "if runs == nil then runs = 0; end;"
+        "runs = runs + 1;"
+        "offsets = {};"
+        "offsets['temperature@TH1'] = 1;"
+        "offsets['temperature@TH2'] = 0;"
+        "offsets['temperature@TH3'] = -2.5;"
+        "sum = 0;"
+        "num = 0;"
+        "for key,value in pairs(mt) do "
+        "    sum = sum + value + offsets[key];"
+        "    num = num + 1;"
+        "end;"
+        "if num == 0 then error('all sensors lost'); end;"
+        "local unit = string.upper('c');"
+        "string = nil;"
+        "return 'average.temperature@world', sum / num + runs * 1000, unit, 0;";
+    test_write_config (cfg, inputs, lua_code);
+
+    composite_t *self = composite_new ("composite-test");
+    assert (self);
+    assert (streq (composite_name (self), "composite-test"));
+
+    composite_output_t output;
+    assert (composite_evaluate (self, 0, output) == -1);    // not configured yet
+
+    assert (composite_load (self, "src/selftest-rw/does-not-exist.cfg") == -1);
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_inputs (self) == inputs);
+    assert (composite_has_input (self, "temperature@TH2"));
+    assert (!composite_has_input (self, "temperature@TH4"));
+    assert (composite_slot (self, "temperature@TH1") == 0);
+    assert (composite_slot (self, "temperature@TH3") == 2);
+    assert (composite_slot (self, "temperature@TH4") == -1);
+    composite_update (self, "temperature@TH4", 1, 1000);    // not an input, ignored
+
+    // Feed the same sequence to composite and to the reference evaluation
+    struct {
+        const char *topic;
+        double value;
+        time_t valid_till;
+        time_t now;
+    } steps [] = {
+        { "temperature@TH1", 40,    160, 100 },
+        { "temperature@TH2", 100,   160, 110 },
+        { "temperature@TH1", 70,    200, 120 },
+        { "temperature@TH3", 21.25, 180, 170 },     // TH2 expired
+        { "temperature@TH2", -5,    300, 190 },     // TH3 expired
+        { "temperature@TH2", 0.1,   210, 250 },     // everything expired
+        { "temperature@TH3", 33.3,  400, 260 }
+    };
+    std::map <std::string, value> reference_cache;
+    for (const auto &topic : inputs)
+        reference_cache [topic] = test_value (0, 0);
+
+    for (const auto &step : steps) {
+        composite_update (self, step.topic, step.value, step.valid_till);
+        reference_cache [step.topic] = test_value (step.value, step.valid_till);
+
+        composite_output_t expected, actual;
+        int expected_rv = test_reference_evaluate (lua_code, reference_cache, step.now, expected);
+        int actual_rv = composite_evaluate (self, step.now, actual);
+        if (verbose)
+            printf ("%s = %f -> %d %f / %d %f\n", step.topic, step.value, expected_rv, expected.value, actual_rv, actual.value);
+        assert (actual_rv == expected_rv);
+        if (expected_rv == 0) {
+            assert (actual.topic == expected.topic);
+            assert (actual.value == expected.value);
+            assert (actual.unit == expected.unit);
+        }
+    }
+
+    // Script which does not compile is refused at load time
+    test_write_config (cfg, inputs, "return 'average.temperature@world', ");
+    assert (composite_load (self, cfg) == -1);
+    assert (composite_evaluate (self, 1, output) == -1);
+    test_write_config (cfg, inputs, lua_code);
+
+    // Reload rebuilds the context and drops cached values
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_evaluate (self, 1, output) == -1);
+    composite_update (self, "temperature@TH2", 20, 100);
+    assert (composite_evaluate (self, 50, output) == 0);
+    assert (output.topic == "average.temperature@world");
+    assert (output.value == 1020);
+    assert (output.unit == "C");
+
+    // Expiry is reported once for every input which is no longer valid
+    assert (composite_load (self, cfg) == 0);
+    assert (streq (composite_output_topic (self), ""));
+    assert (composite_next_expiry (self) == -1);
+    composite_update (self, "temperature@TH1", 10, 100);
+    composite_update (self, "temperature@TH2", 20, 200);
+    assert (composite_next_expiry (self) == 100);
+    assert (composite_expire (self, 100) == 0);
+    assert (composite_expire (self, 101) == 1);
+    assert (composite_next_expiry (self) == 200);
+    assert (composite_expire (self, 150) == 0);
+    composite_update (self, "temperature@TH1", 30, 300);
+    assert (composite_changed (self));
+    assert (composite_evaluate (self, 201, output) == 0);   // drops TH2
+    assert (!composite_changed (self));
+    assert (streq (composite_output_topic (self), "average.temperature@world"));
+    assert (composite_next_expiry (self) == 300);
+    assert (composite_expire (self, 250) == 0);
+    assert (composite_expire (self, 301) == 1);
+    assert (composite_next_expiry (self) == -1);
+    assert (composite_evaluate (self, 301, output) == -1);
+
+    // Updates of an input supersede its previous expiry
+    assert (composite_load (self, cfg) == 0);
+    composite_update (self, "temperature@TH1", 10, 100);
+    composite_update (self, "temperature@TH2", 20, 150);
+    for (int i = 0; i < 1000; i++)
+        composite_update (self, "temperature@TH1", 10, 200 + i);
+    assert (composite_next_expiry (self) == 150);
+    composite_update (self, "temperature@TH2", 20, 2000);
+    assert (composite_next_expiry (self) == 1199);
+
+    // Built-in average gives the same results as script generated by
+    // configurator for the same offsets
+    std::map <std::string, double> offsets = {
+        { "temperature@TH1", 1 },
+        { "temperature@TH3", -2.5 }
+    };
+    std::string average_code =
+        "sum = 0;"
+        "num = 0;"
+        "offsets = {};"
+        "offsets['temperature@TH1'] = 1;"
+        "offsets['temperature@TH2'] = 0;"
+        "offsets['temperature@TH3'] = -2.5;"
+        "for key,value in pairs(mt) do "
+        "    sum = sum + value + offsets[key];"
+        "    num = num + 1;"
+        "end;"
+        "if num == 0 then error('all sensors lost'); end;"
+        "return 'avg.temperature@world', sum / num, 'C';";
+    test_write_native_config (cfg, inputs, "avg", offsets);
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_inputs (self) == inputs);
+    for (auto &it : reference_cache)
+        it.second = test_value (0, 0);
+    for (const auto &step : steps) {
+        composite_update (self, step.topic, step.value, step.valid_till);
+        reference_cache [step.topic] = test_value (step.value, step.valid_till);
+
+        composite_output_t expected, actual;
+        int expected_rv = test_reference_evaluate (average_code, reference_cache, step.now, expected);
+        int actual_rv = composite_evaluate (self, step.now, actual);
+        assert (actual_rv == expected_rv);
+        if (expected_rv == 0) {
+            assert (actual.topic == expected.topic);
+            assert (fabs (actual.value - expected.value) < 1e-9);
+            assert (actual.unit == expected.unit);
+        }
+    }
+
+    // Other built-in functions, TH1 = 10 + 1, TH2 = 20, TH3 = 30 - 2.5
+    const struct {
+        const char *function;
+        double all;
+        double th2_only;
+    } functions [] = {
+        { "min",    11,     20 },
+        { "max",    27.5,   20 },
+        { "sum",    58.5,   20 },
+        { "count",  3,      1 }
+    };
+    for (const auto &function : functions) {
+        test_write_native_config (cfg, inputs, function.function, offsets);
+        assert (composite_load (self, cfg) == 0);
+        composite_update (self, "temperature@TH1", 10, 100);
+        composite_update (self, "temperature@TH2", 20, 200);
+        composite_update (self, "temperature@TH3", 30, 100);
+        assert (composite_evaluate (self, 50, output) == 0);
+        assert (output.topic == std::string (function.function) + ".temperature@world");
+        assert (output.value == function.all);
+        assert (output.unit == "C");
+        assert (streq (composite_output_topic (self), output.topic.c_str ()));
+        assert (composite_expire (self, 150) == 2);
+        assert (composite_evaluate (self, 150, output) == 0);
+        assert (output.value == function.th2_only);
+        // no valid input left
+        if (streq (function.function, "count")) {
+            assert (composite_evaluate (self, 250, output) == 0);
+            assert (output.value == 0);
+        }
+        else
+            assert (composite_evaluate (self, 250, output) == -1);
+    }
+
+    // Running aggregates match full recomputation over many inputs, with
+    // updates, overwritten and expiring values in random order
+    {
+        std::vector <std::string> many_inputs;
+        std::map <std::string, double> many_offsets;
+        for (int i = 0; i < 200; i++) {
+            many_inputs.push_back ("temperature@TH" + std::to_string (i));
+            many_offsets [many_inputs.back ()] = (i % 7) * 0.25;
+        }
+        const char *many_functions [] = { "avg", "sum", "count", "min", "max" };
+        for (const char *function : many_functions) {
+            test_write_native_config (cfg, many_inputs, function, many_offsets);
+            assert (composite_load (self, cfg) == 0);
+            std::map <std::string, value> expected_cache;
+            unsigned int seed = 42;
+            for (time_t now = 1; now < 3000; now++) {
+                seed = seed * 1103515245 + 12345;
+                const std::string &topic = many_inputs [(seed >> 8) % many_inputs.size ()];
+                double v = ((seed >> 4) % 1000) / 10.0;
+                time_t valid_till = now + (seed >> 16) % 60;
+                composite_update (self, topic.c_str (), v, valid_till);
+                expected_cache [topic] = test_value (v, valid_till, many_offsets [topic]);
+
+                double sum = 0, min = 0, max = 0;
+                size_t count = 0;
+                for (const auto &i : expected_cache) {
+                    if (now > i.second.valid_till)
+                        continue;
+                    double x = i.second.value + i.second.offset;
+                    min = count == 0 || x < min ? x : min;
+                    max = count == 0 || x > max ? x : max;
+                    sum += x;
+                    count++;
+                }
+                double expected = 0;
+                if (streq (function, "avg"))
+                    expected = sum / count;
+                else
+                if (streq (function, "sum"))
+                    expected = sum;
+                else
+                if (streq (function, "count"))
+                    expected = count;
+                else
+                if (streq (function, "min"))
+                    expected = min;
+                else
+                    expected = max;
+                assert (composite_evaluate (self, now, output) == 0);
+                assert (fabs (output.value - expected) < 1e-6);
+            }
+        }
+    }
+
+    // Evaluation period
+    assert (composite_period (self) == 0);
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@world\", \"unit\": \"C\", \"period\": 5 }\n";
+    }
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_period (self) == 5);
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@world\", \"unit\": \"C\", \"period\": -5 }\n";
+    }
+    assert (composite_load (self, cfg) == -1);
+
+    // Sliding windows
+    assert (composite_windows (self).empty ());
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@world\", \"unit\": \"C\", "
+          << "\"windows\": [ 60, 300, 900 ], \"window_samples\": 100 }\n";
+    }
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_windows (self) == std::vector <int> ({60, 300, 900}));
+    assert (composite_window_samples (self) == 100);
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@world\", \"unit\": \"C\", "
+          << "\"windows\": [ 60, 0 ] }\n";
+    }
+    assert (composite_load (self, cfg) == -1);
+
+    // Deadband with max silence
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@world\", \"unit\": \"C\", "
+          << "\"deadband\": 0.5, \"max_silence\": 60 }\n";
+    }
+    assert (composite_load (self, cfg) == 0);
+    const struct {
+        double value;
+        time_t now;
+        bool published;
+    } publish_steps [] = {
+        { 20,   100, true },        // first output
+        { 20.3, 110, false },       // within deadband
+        { 20.6, 120, true },        // 0.6 from published 20
+        { 20.2, 130, false },
+        { 20.2, 179, false },
+        { 20.2, 180, true },        // 60 s without publishing
+        { 19.6, 181, true }
+    };
+    for (const auto &step : publish_steps) {
+        composite_update (self, "temperature@TH1", step.value, 200);
+        assert (composite_evaluate (self, step.now, output) == 0);
+        assert (composite_should_publish (self, output, step.now, 0) == step.published);
+    }
+    // output lost in between is published again whatever the value
+    assert (composite_evaluate (self, 201, output) == -1);
+    composite_update (self, "temperature@TH1", 19.6, 300);
+    assert (composite_evaluate (self, 202, output) == 0);
+    assert (composite_should_publish (self, output, 202, 0));
+    assert (!composite_should_publish (self, output, 203, 0));
+    // default max silence applies when config has none
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@world\", \"unit\": \"C\", \"deadband\": 0 }\n";
+    }
+    assert (composite_load (self, cfg) == 0);
+    composite_update (self, "temperature@TH1", 20, 300);
+    assert (composite_evaluate (self, 100, output) == 0);
+    assert (composite_should_publish (self, output, 100, 10));
+    assert (!composite_should_publish (self, output, 109, 10));
+    assert (composite_should_publish (self, output, 110, 10));
+    output.value = 20.01;
+    assert (composite_should_publish (self, output, 111, 10));
+
+    // Partial sums and counts of other composites
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\", \"temperature@TH2\" ], \"function\": \"avg\", "
+          << "\"output\": \"average.temperature@rack1\", \"unit\": \"C\" }\n";
+    }
+    composite_t *rack1 = composite_new ("rack1");
+    assert (composite_load (rack1, cfg) == 0);
+    composite_update (rack1, "temperature@TH1", 10, 200);
+    composite_update (rack1, "temperature@TH2", 20, 200);
+    composite_output_t rack1_output;
+    assert (composite_evaluate (rack1, 100, rack1_output) == 0);
+    assert (rack1_output.value == 15 && rack1_output.sum == 30 && rack1_output.count == 2);
+    composite_output_t rack2_output;
+    rack2_output.value = rack2_output.sum = 40;
+    rack2_output.count = 1;
+    rack2_output.time = 0;
+    for (bool partials : {false, true}) {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"average.temperature@rack1\", \"average.temperature@rack2\" ], "
+          << "\"function\": \"avg\", \"offsets\": { \"average.temperature@rack2\": 1 }, "
+          << "\"partials\": " << (partials ? "true" : "false") << ", "
+          << "\"output\": \"average.temperature@dc\", \"unit\": \"C\" }\n";
+        f.close ();
+        assert (composite_load (self, cfg) == 0);
+        composite_update_slot_partial (self, composite_slot (self, "average.temperature@rack1"), rack1_output, 200);
+        composite_update_slot_partial (self, composite_slot (self, "average.temperature@rack2"), rack2_output, 150);
+        assert (composite_evaluate (self, 100, output) == 0);
+        if (partials) {
+            // (10 + 20 + 40 + 1) / 3, offset applies to every reading
+            assert (fabs (output.value - 71.0 / 3) < 1e-9);
+            assert (output.sum == 71 && output.count == 3);
+        }
+        else
+            assert (output.value == (15 + 41) / 2.0);
+        // partial expires as a whole
+        assert (composite_evaluate (self, 151, output) == 0);
+        assert (output.value == 15);
+    }
+    composite_destroy (&rack1);
+
+    // Partials of min, max and count producers
+    {
+        const struct {
+            const char *producer;
+            const char *consumer;
+            double expected;
+        } cases [] = {
+            { "min",   "avg",   (10 + 40) / 2.0 },
+            { "max",   "avg",   (20 + 40) / 2.0 },
+            { "min",   "sum",   10 + 40 },
+            { "max",   "min",   20 },
+            { "count", "sum",   3 },
+            { "count", "count", 3 }
+        };
+        for (const auto &c : cases) {
+            test_write_native_config (cfg, {"temperature@TH1", "temperature@TH2"}, c.producer, {});
+            composite_t *rack = composite_new ("rack1");
+            assert (composite_load (rack, cfg) == 0);
+            composite_update (rack, "temperature@TH1", 10, 200);
+            composite_update (rack, "temperature@TH2", 20, 200);
+            composite_output_t partial;
+            assert (composite_evaluate (rack, 100, partial) == 0);
+            composite_destroy (&rack);
+            test_write_native_config (cfg, {"temperature@TH3"}, c.producer, {});
+            rack = composite_new ("rack2");
+            assert (composite_load (rack, cfg) == 0);
+            composite_update (rack, "temperature@TH3", 40, 200);
+            composite_output_t partial2;
+            assert (composite_evaluate (rack, 100, partial2) == 0);
+            composite_destroy (&rack);
+
+            std::ofstream f (cfg);
+            f << "{ \"in\": [ \"x@rack1\", \"x@rack2\" ], \"function\": \"" << c.consumer << "\", "
+              << "\"partials\": true, \"output\": \"x@dc\", \"unit\": \"C\" }\n";
+            f.close ();
+            assert (composite_load (self, cfg) == 0);
+            composite_update_slot_partial (self, composite_slot (self, "x@rack1"), partial, 200);
+            composite_update_slot_partial (self, composite_slot (self, "x@rack2"), partial2, 200);
+            assert (composite_evaluate (self, 100, output) == 0);
+            if (verbose)
+                printf ("%s of %s partials = %f\n", c.consumer, c.producer, output.value);
+            assert (output.value == c.expected);
+        }
+    }
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"partials\": true, "
+          << "\"evaluation\": \"return 'x@y', 1, 'C';\" }\n";
+    }
+    assert (composite_load (self, cfg) == -1);
+
+    // Unknown function is refused
+    test_write_native_config (cfg, inputs, "median", offsets);
+    assert (composite_load (self, cfg) == -1);
+
+    // Values of inputs which stay are taken over by reloaded composite,
+    // with offsets of the new configuration
+    test_write_native_config (cfg, {"temperature@TH1", "temperature@TH2"}, "avg", {{"temperature@TH2", 1}});
+    assert (composite_load (self, cfg) == 0);
+    composite_update (self, "temperature@TH1", 10, 100);
+    composite_update (self, "temperature@TH2", 20, 200);
+    composite_update (self, "temperature@TH3", 30, 200);      // not an input yet
+    composite_t *reloaded = composite_new ("composite-test");
+    test_write_native_config (cfg, {"temperature@TH2", "temperature@TH3"}, "avg", {{"temperature@TH2", 2}});
+    assert (composite_load (reloaded, cfg) == 0);
+    std::vector <time_t> inherited;
+    assert (composite_inherit (reloaded, self, 50, inherited) == 1);
+    assert (inherited == std::vector <time_t> ({200}));
+    assert (composite_changed (reloaded));
+    assert (composite_evaluate (reloaded, 50, output) == 0);
+    assert (output.value == 22);
+    assert (composite_expire (reloaded, 201) == 1);
+    assert (composite_evaluate (reloaded, 201, output) == -1);
+    // expired values are not taken over
+    composite_update (reloaded, "temperature@TH3", 30, 100);
+    assert (composite_inherit (self, reloaded, 150, inherited) == 0);
+    composite_destroy (&reloaded);
+
+    // Readings older than the stored one are dropped until it expires,
+    // output carries the newest timestamp of its inputs
+    test_write_native_config (cfg, {"temperature@TH1", "temperature@TH2"}, "avg", {});
+    assert (composite_load (self, cfg) == 0);
+    int th1 = composite_slot (self, "temperature@TH1");
+    int th2 = composite_slot (self, "temperature@TH2");
+    assert (composite_update_slot (self, th1, 10, 100, 400) == 0);
+    assert (composite_update_slot (self, th2, 20, 90, 390) == 0);
+    assert (composite_evaluate (self, 200, output) == 0);
+    assert (output.value == 15 && output.time == 100);
+    assert (composite_update_slot (self, th1, 50, 95, 395) == -1);
+    assert (!composite_changed (self));
+    assert (composite_update_slot (self, th1, 30, 100, 400) == 0);
+    assert (composite_evaluate (self, 200, output) == 0);
+    assert (output.value == 25 && output.time == 100);
+    assert (composite_evaluate (self, 395, output) == 0);
+    assert (output.value == 30 && output.time == 100);
+    assert (composite_evaluate (self, 401, output) == -1);
+    assert (composite_update_slot (self, th1, 40, 50, 500) == 0);
+    assert (composite_evaluate (self, 401, output) == 0);
+    assert (output.value == 40 && output.time == 50);
+    output.time = 10;
+    assert (composite_update_slot_partial (self, th1, output, 500) == -1);
+    test_write_config (cfg, {"temperature@TH1", "temperature@TH2"},
+        "return 'max.temperature@rack', math.max (mt['temperature@TH1'] or 0, mt['temperature@TH2'] or 0), 'C'");
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_update_slot (self, composite_slot (self, "temperature@TH1"), 10, 100, 400) == 0);
+    assert (composite_update_slot (self, composite_slot (self, "temperature@TH2"), 20, 120, 300) == 0);
+    assert (composite_evaluate (self, 200, output) == 0);
+    assert (output.value == 20 && output.time == 120);
+    assert (composite_evaluate (self, 301, output) == 0);
+    assert (output.value == 10 && output.time == 100);
+    assert (!composite_reused (self));
+    assert (composite_should_publish (self, output, 301, 60));
+
+    // Repeated value doesn't run the script again and the output is kept
+    // alive only; time follows the newest reading
+    uint64_t evaluated, skipped, evaluated_before, skipped_before;
+    composite_evaluations (self, evaluated_before, skipped_before);
+    th1 = composite_slot (self, "temperature@TH1");
+    assert (composite_update_slot (self, th1, 10, 130, 430) == 0);
+    assert (composite_evaluate (self, 302, output) == 0);
+    assert (composite_reused (self));
+    assert (output.value == 10 && output.time == 130);
+    assert (!composite_should_publish (self, output, 302, 60));
+    assert (composite_should_publish (self, output, 361, 60));
+    composite_evaluations (self, evaluated, skipped);
+    assert (evaluated == evaluated_before && skipped == skipped_before + 1);
+    assert (composite_update_slot (self, th1, 11, 140, 440) == 0);
+    assert (composite_evaluate (self, 362, output) == 0);
+    assert (!composite_reused (self));
+    assert (output.value == 11 && output.time == 140);
+    composite_evaluations (self, evaluated, skipped);
+    assert (evaluated == evaluated_before + 1);
+    // so does expiry of an input
+    assert (composite_update_slot (self, composite_slot (self, "temperature@TH2"), 5, 150, 400) == 0);
+    assert (composite_evaluate (self, 363, output) == 0);
+    assert (!composite_reused (self) && output.value == 11);
+    assert (composite_evaluate (self, 364, output) == 0);
+    assert (composite_reused (self));
+    assert (composite_evaluate (self, 401, output) == 0);
+    assert (!composite_reused (self) && output.value == 11 && output.time == 140);
+
+    // More outputs from one Lua script, old three value form still works
+    std::vector <composite_output_t> outputs;
+    test_write_config (cfg, {"temperature@TH1", "humidity@TH1"},
+        "return { { 'average.temperature@rack', mt['temperature@TH1'], 'C' }, "
+        "{ 'average.humidity@rack', mt['humidity@TH1'], '%' } }");
+    assert (composite_load (self, cfg) == 0);
+    composite_update (self, "temperature@TH1", 21, 200);
+    composite_update (self, "humidity@TH1", 45, 200);
+    assert (composite_evaluate_all (self, 100, outputs) == 0);
+    assert (outputs.size () == 2);
+    assert (outputs [0].topic == "average.temperature@rack" && outputs [0].value == 21 && outputs [0].unit == "C");
+    assert (outputs [1].topic == "average.humidity@rack" && outputs [1].value == 45 && outputs [1].unit == "%");
+    assert (composite_output_topics (self) == std::vector <std::string> ({"average.temperature@rack", "average.humidity@rack"}));
+    assert (composite_evaluate (self, 100, output) == 0);
+    assert (output.topic == "average.temperature@rack");
+    test_write_config (cfg, {"temperature@TH1"}, "return { { 'x@y', 1, 'C' }, 'oops' }");
+    assert (composite_load (self, cfg) == 0);
+    composite_update (self, "temperature@TH1", 21, 200);
+    assert (composite_evaluate_all (self, 100, outputs) == -1);
+    assert (outputs.empty ());
+    // topic, value and unit are all required
+    for (const char *lua_code : { "return 'x@y'", "return 'x@y', 1", "return 'x@y', nil, 'C'", "return { { 'x@y', 1 } }" }) {
+        test_write_config (cfg, {"temperature@TH1"}, lua_code);
+        assert (composite_load (self, cfg) == 0);
+        composite_update (self, "temperature@TH1", 21, 200);
+        assert (composite_evaluate_all (self, 100, outputs) == -1);
+    }
+    test_write_config (cfg, {"temperature@TH1"}, "return {}");
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_evaluate_all (self, 100, outputs) == -1);
+    test_write_config (cfg, {"temperature@TH1"}, "return 'x@y', 1, 'C', 0");
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_evaluate_all (self, 100, outputs) == 0);
+    assert (outputs.size () == 1 && outputs [0].topic == "x@y" && outputs [0].unit == "C");
+
+    // More outputs of built-in functions over subsets of inputs
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\", \"temperature@TH2\", \"humidity@TH1\" ], "
+          << "\"offsets\": { \"temperature@TH1\": 1 }, \"deadband\": 1, \"outputs\": [ "
+          << "{ \"function\": \"avg\", \"in\": [ \"temperature@TH1\", \"temperature@TH2\" ], "
+          << "\"output\": \"average.temperature@rack\", \"unit\": \"C\" }, "
+          << "{ \"function\": \"max\", \"in\": [ \"temperature@TH1\", \"temperature@TH2\" ], "
+          << "\"output\": \"max.temperature@rack\", \"unit\": \"C\" }, "
+          << "{ \"function\": \"avg\", \"in\": [ \"humidity@TH1\" ], "
+          << "\"output\": \"average.humidity@rack\", \"unit\": \"%\" }, "
+          << "{ \"function\": \"count\", \"output\": \"count.sensors@rack\", \"unit\": \"\" } ] }\n";
+    }
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_output_topics (self).size () == 4);
+    assert (streq (composite_output_topic (self), "average.temperature@rack"));
+    composite_update (self, "temperature@TH1", 20, 200);
+    composite_update (self, "temperature@TH2", 30, 300);
+    composite_update (self, "humidity@TH1", 40, 150);
+    assert (composite_evaluate_all (self, 100, outputs) == 0);
+    assert (outputs.size () == 4);
+    assert (outputs [0].value == 25.5 && outputs [0].count == 2);
+    assert (outputs [1].value == 30);
+    assert (outputs [2].value == 40 && outputs [2].unit == "%");
+    assert (outputs [3].value == 3);
+    for (const auto &it : outputs)
+        assert (composite_should_publish (self, it, 100, 0));
+    // deadband is kept per output
+    assert (!composite_should_publish (self, outputs [0], 101, 0));
+    // humidity lost, the rest is still evaluated and humidity is news again
+    assert (composite_evaluate_all (self, 151, outputs) == 0);
+    assert (outputs.size () == 3);
+    assert (outputs [0].topic == "average.temperature@rack" && outputs [2].value == 2);
+    assert (!composite_should_publish (self, outputs [0], 151, 0));
+    composite_update (self, "humidity@TH1", 40, 250);
+    assert (composite_evaluate_all (self, 152, outputs) == 0);
+    assert (outputs [2].topic == "average.humidity@rack");
+    assert (composite_should_publish (self, outputs [2], 152, 0));
+    // only count is left at the end
+    assert (composite_evaluate_all (self, 400, outputs) == 0);
+    assert (outputs.size () == 1 && outputs [0].value == 0);
+    // output input must be one of composite inputs, topics must differ
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"outputs\": [ "
+          << "{ \"function\": \"avg\", \"in\": [ \"temperature@TH9\" ], "
+          << "\"output\": \"average.temperature@rack\", \"unit\": \"C\" } ] }\n";
+    }
+    assert (composite_load (self, cfg) == -1);
+    {
+        std::ofstream f (cfg);
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"outputs\": [ "
+          << "{ \"function\": \"avg\", \"output\": \"average.temperature@rack\", \"unit\": \"C\" }, "
+          << "{ \"function\": \"max\", \"output\": \"average.temperature@rack\", \"unit\": \"C\" } ] }\n";
+    }
+    assert (composite_load (self, cfg) == -1);
+
+    // Changes of library tables and of 'mt' are gone by the next evaluation
+    test_write_config (cfg, {"temperature@TH1"},
+        "local value = math.max(mt['temperature@TH1'], 0) + #string.format('%d', 1) + (mt['temperature@TH9'] or 0);"
+        "math.max = nil; string.format = function () return 'xx' end; table.concat = nil;"
+        "mt.extra = 1; setmetatable(mt, { __index = function () return 100 end });"
+        "return 'x@y', value, 'C'");
+    assert (composite_load (self, cfg) == 0);
+    for (double value : { 20, 21, 22 }) {
+        composite_update (self, "temperature@TH1", value, 200);
+        assert (composite_evaluate (self, 100, output) == 0);
+        assert (!composite_reused (self) && output.value == value + 1);
+    }
+    // so are metatables set on globals, library tables and strings
+    test_write_config (cfg, {"temperature@TH1"},
+        "local value = mt['temperature@TH1'] + (undefined or 0) + (math.undefined or 0) "
+        "+ (('x').undefined or 0) + (('x').len and 1 or 0);"
+        "setmetatable(_G, { __index = function () return 100 end });"
+        "setmetatable(math, { __index = function () return 100 end });"
+        "getmetatable('').__index = { undefined = 100 };"
+        "getmetatable('').__metatable = false;"
+        "return 'x@y', value, 'C'");
+    assert (composite_load (self, cfg) == 0);
+    for (double value : { 20, 21, 22 }) {
+        composite_update (self, "temperature@TH1", value, 200);
+        assert (composite_evaluate (self, 100, output) == 0);
+        assert (!composite_reused (self) && output.value == value + 1);
+    }
+
+    // Sandbox has no access to files and processes and can't load code
+    test_write_config (cfg, {"temperature@TH1"},
+        "return 'x@y', (os or io or dofile or loadstring or load or require) and -1 or "
+        "math.max(#table.concat({'a', 'b'}), 1), string.lower('C')");
+    assert (composite_load (self, cfg) == 0);
+    assert (!composite_quarantined (self));
+    assert (composite_evaluate (self, 100, output) == 0);
+    assert (output.value == 2 && output.unit == "c");
+    // ordinary error does not quarantine
+    test_write_config (cfg, {"temperature@TH1"}, "error('all sensors lost')");
+    assert (composite_load (self, cfg) == 0);
+    assert (composite_evaluate (self, 100, output) == -1);
+    assert (!composite_quarantined (self));
+    // runaway loop, even one catching the error, and memory hog are
+    // stopped and their composites quarantined till next load
+    for (const char *lua_code : {
+            "while true do end",
+            "while true do pcall(function () while true do end end) end",
+            "local t = {} for i = 1, 100000000 do t[i] = string.rep('x', 100) .. i end",
+            "return 'x@y', #string.rep('x', 100000000), 'C'",
+            "pcall(function () return string.rep('x', 100000000) end) return 'x@y', 1, 'C'" }) {
+        test_write_config (cfg, {"temperature@TH1"}, lua_code);
+        assert (composite_load (self, cfg) == 0);
+        composite_update (self, "temperature@TH1", 21, 200);
+        assert (composite_evaluate (self, 100, output) == -1);
+        assert (composite_quarantined (self));
+        composite_update (self, "temperature@TH1", 22, 200);
+        assert (composite_evaluate (self, 101, output) == -1);
+        assert (composite_quarantined (self));
+    }
+    test_write_config (cfg, {"temperature@TH1"}, "return 'x@y', mt['temperature@TH1'], 'C'");
+    assert (composite_load (self, cfg) == 0);
+    assert (!composite_quarantined (self));
+    composite_update (self, "temperature@TH1", 21, 200);
+    assert (composite_evaluate (self, 100, output) == 0 && output.value == 21);
+
+    // Steady evaluations take no memory from the system
+    test_write_config (cfg, inputs, average_code);
+    assert (composite_load (self, cfg) == 0);
+    size_t in_use, reserved;
+    uint64_t mallocs, warm = 0;
+    for (int i = 0; i < 1000; i++) {
+        composite_update (self, "temperature@TH1", 20 + i % 7, 1000);
+        composite_update (self, "temperature@TH2", 30 - i % 5, 1000);
+        assert (composite_evaluate (self, 100, output) == 0);
+        assert (!composite_reused (self));
+        composite_memory (self, in_use, reserved, mallocs);
+        // after few garbage collection cycles
+        if (i == 500)
+            warm = mallocs;
+        if (i > 500)
+            assert (mallocs == warm);
+    }
+    assert (warm > 0 && in_use > 0 && reserved >= in_use);
+    if (verbose)
+        printf ("in use %zu, reserved %zu, mallocs %llu\n", in_use, reserved, (unsigned long long) mallocs);
+    // built-in function has no Lua state
+    test_write_native_config (cfg, inputs, "avg", offsets);
+    assert (composite_load (self, cfg) == 0);
+    composite_memory (self, in_use, reserved, mallocs);
+    assert (in_use == 0 && reserved == 0 && mallocs == 0);
+
+    composite_destroy (&self);
+    assert (self == NULL);
+    composite_destroy (&self);
+    zsys_file_delete (cfg);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,200 @@
+/*  =========================================================================
+    composite - composite metric evaluation context
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef COMPOSITE_H_INCLUDED
+#define COMPOSITE_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _composite_t composite_t;
+
+//  Result of one evaluation
+typedef struct {
+    std::string topic;      // output topic, i.e. 'average.temperature@rack'
+    double value;
+    std::string unit;
+    double sum;             // partial sum of inputs, for composites merging partials
+    double count;           // partial count of inputs
+    time_t time;            // timestamp of the newest input evaluated, 0 - not known
+} composite_output_t;
+
+//  @interface
+//  Create a new composite named 'name' without any configuration
+FTY_METRIC_COMPOSITE_EXPORT composite_t *
+    composite_new (const char *name);
+
+//  Get name of the composite
+FTY_METRIC_COMPOSITE_EXPORT const char *
+    composite_name (composite_t *self);
+
+//  Load configuration file (json with 'in' and either 'evaluation' Lua
+//  script or built-in 'function' - avg, min, max, sum, count - with
+//  'output' topic and 'unit', or list of such 'outputs', each with optional
+//  subset of 'in', and optional per input 'offsets' and 'partials';
+//  optional evaluation 'period', publishing 'deadband' and 'max_silence',
+//  sliding 'windows' of output and 'window_samples').
+//  Lua evaluation context is (re)built and 'evaluation' compiled here and
+//  both are kept for all following evaluations, cached input values are
+//  dropped. Script which fails to compile is reported here, once.
+//  Built-in functions run without Lua state.
+//  0 - success, -1 - error
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_load (composite_t *self, const char *filename);
+
+//  Get list of input topics of the loaded configuration
+FTY_METRIC_COMPOSITE_EXPORT const std::vector <std::string> &
+    composite_inputs (composite_t *self);
+
+//  Is 'topic' one of inputs of the loaded configuration?
+FTY_METRIC_COMPOSITE_EXPORT bool
+    composite_has_input (composite_t *self, const char *topic);
+
+//  Get slot of input 'topic' for composite_update_slot, -1 if it is not
+//  an input. Slots are valid until next load.
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_slot (composite_t *self, const char *topic);
+
+//  Store new value of input 'topic', valid until 'valid_till' (unix time),
+//  without timestamp of the reading. Topics which are not inputs are ignored.
+FTY_METRIC_COMPOSITE_EXPORT void
+    composite_update (composite_t *self, const char *topic, double value, time_t valid_till);
+
+//  Store new value of input in 'slot' read at 'time', valid until
+//  'valid_till' (unix time). Reading older than the one still stored in
+//  the slot is dropped. 'time' 0 - not known, never dropped.
+//  0 - stored, -1 - dropped as out of order
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_update_slot (composite_t *self, int slot, double value, time_t time, time_t valid_till);
+
+//  Store 'partial' output of another composite as input in 'slot', valid
+//  until 'valid_till'. Configuration with 'partials' merges its partial sum
+//  and count, otherwise it is one more value. Partial is ordered by its
+//  'time' the same way as readings of composite_update_slot.
+//  0 - stored, -1 - dropped as out of order
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_update_slot_partial (composite_t *self, int slot, const composite_output_t &partial, time_t valid_till);
+
+//  Take over values of inputs which 'previous' (composite replaced by this
+//  one, i.e. before reload of its config) has too and which are still
+//  valid at 'now'. 'valid_till' is filled with validity of every value
+//  taken over. Returns number of values taken over.
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    composite_inherit (composite_t *self, composite_t *previous, time_t now, std::vector <time_t> &valid_till);
+
+//  Was any input updated since last evaluation?
+FTY_METRIC_COMPOSITE_EXPORT bool
+    composite_changed (composite_t *self);
+
+//  Drop inputs which are no longer valid at 'now'
+//  Returns number of inputs which expired since last evaluation or expire
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    composite_expire (composite_t *self, time_t now);
+
+//  Get 'valid_till' of the input which expires first, -1 if no input
+//  holds a valid value
+FTY_METRIC_COMPOSITE_EXPORT time_t
+    composite_next_expiry (composite_t *self);
+
+//  Should 'output' evaluated at 'now' be published? It should when the
+//  configuration has no 'deadband', output moved by more than deadband
+//  since the last published output with the same topic (any change when
+//  the output was reused, see composite_reused), or 'max_silence'
+//  seconds passed since it ('max_silence' argument is used when
+//  configuration has none, 0 - no limit). Output is remembered as published
+//  if so. Evaluation which does not produce the topic anymore forgets it.
+FTY_METRIC_COMPOSITE_EXPORT bool
+    composite_should_publish (composite_t *self, const composite_output_t &output, time_t now, int max_silence);
+
+//  Did the last evaluation return outputs of the previous one, because no
+//  input changed its value or validity since? Such outputs are published
+//  only after max_silence (see composite_should_publish).
+FTY_METRIC_COMPOSITE_EXPORT bool
+    composite_reused (composite_t *self);
+
+//  Did the script exceed instruction or memory budget of one evaluation?
+//  Such composite fails every evaluation until its configuration is loaded
+//  again.
+FTY_METRIC_COMPOSITE_EXPORT bool
+    composite_quarantined (composite_t *self);
+
+//  Get memory of Lua state - bytes in use, bytes taken from the system and
+//  number of allocations from the system; all 0 for built-in functions
+FTY_METRIC_COMPOSITE_EXPORT void
+    composite_memory (composite_t *self, size_t &in_use, size_t &reserved, uint64_t &mallocs);
+
+//  Get number of evaluations which ran the function or script ('evaluated')
+//  and which reused outputs of the previous one ('skipped')
+FTY_METRIC_COMPOSITE_EXPORT void
+    composite_evaluations (composite_t *self, uint64_t &evaluated, uint64_t &skipped);
+
+//  Get evaluation period [s] from configuration, 0 if not set
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_period (composite_t *self);
+
+//  Get lengths [s] of sliding windows of output, empty if not configured
+FTY_METRIC_COMPOSITE_EXPORT const std::vector <int> &
+    composite_windows (composite_t *self);
+
+//  Get max number of outputs kept in one sliding window
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    composite_window_samples (composite_t *self);
+
+//  Get (first) output topic - configured one for built-in functions, the
+//  one produced by last successful evaluation for Lua. Empty if not known yet.
+FTY_METRIC_COMPOSITE_EXPORT const char *
+    composite_output_topic (composite_t *self);
+
+//  Get all output topics, the same way as composite_output_topic
+FTY_METRIC_COMPOSITE_EXPORT const std::vector <std::string> &
+    composite_output_topics (composite_t *self);
+
+//  Evaluate composite over inputs still valid at 'now', fill 'outputs' with
+//  every output which could be evaluated. Output time is the newest
+//  timestamp of inputs it was evaluated from.
+//  0 - success, -1 - error, no output (already logged)
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_evaluate_all (composite_t *self, time_t now, std::vector <composite_output_t> &outputs);
+
+//  Evaluate composite over inputs still valid at 'now', first output only
+//  0 - success, 'output' is filled, -1 - error (already logged)
+FTY_METRIC_COMPOSITE_EXPORT int
+    composite_evaluate (composite_t *self, time_t now, composite_output_t &output);
+
+//  Destroy the composite
+FTY_METRIC_COMPOSITE_EXPORT void
+    composite_destroy (composite_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    composite_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
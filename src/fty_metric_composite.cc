@@ -23,6 +23,9 @@
 @header
     fty_metric_composite - Metrics calculator
 @discuss
+    SIGHUP reloads the configuration (see RELOAD of
+    fty_metric_composite_server) without restarting the process, values
+    cached for inputs which stay are kept.
 @end
 */
 
@@ -35,6 +38,8 @@ extern "C" {
 }
 #include <string.h>
 #include <stdio.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <vector>
 #include <string>
 #include <map>
@@ -44,39 +49,93 @@ extern "C" {
 #include <cxxtools/directory.h>
 #include <fty_proto.h>
 
+static volatile sig_atomic_t s_reload = 0;
+
+static void
+s_handle_sighup (int signum)
+{
+    s_reload = 1;
+}
+
 int
 main (int argc, char** argv) {
 
     // Read configuration
     if(argc < 2) {
         printf("Syntax: %s config\n", argv[0]);
+        printf("        %s config_directory\n", argv[0]);
         exit(0);
     }
 
-    char *tmp_arg = strdup(argv[1]);
+    // Engine mode - one process for all configs in the directory
+    struct stat st;
+    bool is_engine = (stat (argv[1], &st) == 0 && S_ISDIR (st.st_mode));
+
     char *name;
-    char *tmp_basename = tmp_arg;
-    for (int tmp_i = 0; tmp_arg[tmp_i] != '\0'; tmp_i++) {
-        if (tmp_arg[tmp_i] == '/') { tmp_basename = tmp_arg + tmp_i + 1; }
+    if (is_engine) {
+        name = strdup ("fty-metric-composite");
     }
-    if(asprintf(&name, "fty-metric-composite-%s", tmp_basename) < 0) {
-        zsys_error("Can't allocate name of agent\n");
-        exit(1);
+    else {
+        char *tmp_arg = strdup(argv[1]);
+        char *tmp_basename = tmp_arg;
+        for (int tmp_i = 0; tmp_arg[tmp_i] != '\0'; tmp_i++) {
+            if (tmp_arg[tmp_i] == '/') { tmp_basename = tmp_arg + tmp_i + 1; }
+        }
+        if(asprintf(&name, "fty-metric-composite-%s", tmp_basename) < 0) {
+            zsys_error("Can't allocate name of agent\n");
+            exit(1);
+        }
+        free(tmp_arg);
+        tmp_basename = NULL;
     }
     zactor_t *cm_server = zactor_new (fty_metric_composite_server, (void*) name);
     free(name);
-    free(tmp_arg);
-    tmp_basename = NULL;
 
+    // queue [records] between receiving thread and evaluation, must precede CONNECT
+    char *pipeline = getenv ("FTY_METRIC_COMPOSITE_PIPELINE");
+    if (pipeline)
+        zstr_sendx (cm_server, "PIPELINE", pipeline, NULL);
     zstr_sendx (cm_server, "CONNECT", "ipc://@/malamute", NULL);
     zclock_sleep (500);  // to settle down the things
     if(strcmp(getenv("BIOS_LOG_LEVEL"), "LOG_DEBUG") == 0)
         zstr_sendx (cm_server, "VERBOSE", NULL);
-    zstr_sendx (cm_server, "CONFIG", argv[1], NULL);
+    // max delay [ms] of coalesced evaluation of metric bursts
+    char *coalesce = getenv ("FTY_METRIC_COMPOSITE_COALESCE");
+    if (coalesce)
+        zstr_sendx (cm_server, "COALESCE", coalesce, NULL);
+    // decimal places of published values
+    char *precision = getenv ("FTY_METRIC_COMPOSITE_PRECISION");
+    if (precision)
+        zstr_sendx (cm_server, "PRECISION", precision, NULL);
+    // threads evaluating composites along with the actor one
+    char *workers = getenv ("FTY_METRIC_COMPOSITE_WORKERS");
+    if (workers)
+        zstr_sendx (cm_server, "WORKERS", workers, NULL);
+    if (is_engine)
+        zstr_sendx (cm_server, "CFG_DIRECTORY", argv[1], NULL);
+    else
+        zstr_sendx (cm_server, "CONFIG", argv[1], NULL);
+
+    struct sigaction action;
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = s_handle_sighup;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGHUP, &action, NULL);
 
     //  Accept and print any message back from server
     //  copy from src/malamute.c under MPL license
-    while (true) {
+    //  SIGHUP interrupts the poller (timeout covers the case it does not),
+    //  reload request is passed on to the server
+    zpoller_t *poller = zpoller_new (cm_server, NULL);
+    while (!zsys_interrupted) {
+        void *which = zpoller_wait (poller, 1000);
+        if (s_reload) {
+            s_reload = 0;
+            zsys_info ("SIGHUP received, reloading configuration");
+            zstr_sendx (cm_server, "RELOAD", NULL);
+        }
+        if (which != cm_server)
+            continue;
         char *message = zstr_recv (cm_server);
         if (message) {
             puts (message);
@@ -88,6 +147,7 @@ main (int argc, char** argv) {
         }
     }
 
+    zpoller_destroy (&poller);
     zactor_destroy (&cm_server);
     return 0;
 }
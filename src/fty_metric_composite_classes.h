@@ -59,6 +59,42 @@ typedef struct _proto_metric_unavailable_t proto_metric_unavailable_t;
 typedef struct _c_metric_conf_t c_metric_conf_t;
 #define C_METRIC_CONF_T_DEFINED
 #endif
+#ifndef COMPOSITE_T_DEFINED
+typedef struct _composite_t composite_t;
+#define COMPOSITE_T_DEFINED
+#endif
+#ifndef TOPIC_INDEX_T_DEFINED
+typedef struct _topic_index_t topic_index_t;
+#define TOPIC_INDEX_T_DEFINED
+#endif
+#ifndef TIMER_WHEEL_T_DEFINED
+typedef struct _timer_wheel_t timer_wheel_t;
+#define TIMER_WHEEL_T_DEFINED
+#endif
+#ifndef PROTO_METRIC_WIRE_T_DEFINED
+typedef struct _proto_metric_wire_t proto_metric_wire_t;
+#define PROTO_METRIC_WIRE_T_DEFINED
+#endif
+#ifndef VALUE_CODEC_T_DEFINED
+typedef struct _value_codec_t value_codec_t;
+#define VALUE_CODEC_T_DEFINED
+#endif
+#ifndef SLIDING_WINDOW_T_DEFINED
+typedef struct _sliding_window_t sliding_window_t;
+#define SLIDING_WINDOW_T_DEFINED
+#endif
+#ifndef WORKER_POOL_T_DEFINED
+typedef struct _worker_pool_t worker_pool_t;
+#define WORKER_POOL_T_DEFINED
+#endif
+#ifndef METRIC_QUEUE_T_DEFINED
+typedef struct _metric_queue_t metric_queue_t;
+#define METRIC_QUEUE_T_DEFINED
+#endif
+#ifndef MEMORY_POOL_T_DEFINED
+typedef struct _memory_pool_t memory_pool_t;
+#define MEMORY_POOL_T_DEFINED
+#endif
 
 //  Internal API
 #include "actor_commands.h"
@@ -67,6 +103,15 @@ typedef struct _c_metric_conf_t c_metric_conf_t;
 #include "data.h"
 #include "proto_metric_unavailable.h"
 #include "c_metric_conf.h"
+#include "composite.h"
+#include "topic_index.h"
+#include "timer_wheel.h"
+#include "proto_metric_wire.h"
+#include "value_codec.h"
+#include "sliding_window.h"
+#include "worker_pool.h"
+#include "metric_queue.h"
+#include "memory_pool.h"
 
 //  *** To avoid double-definitions, only define if building without draft ***
 #ifndef FTY_METRIC_COMPOSITE_BUILD_DRAFT_API
@@ -101,6 +146,51 @@ FTY_METRIC_COMPOSITE_PRIVATE void
 FTY_METRIC_COMPOSITE_PRIVATE void
     c_metric_conf_test (bool verbose);
 
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    composite_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    topic_index_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    timer_wheel_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    proto_metric_wire_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    value_codec_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    sliding_window_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    worker_pool_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    metric_queue_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_METRIC_COMPOSITE_PRIVATE void
+    memory_pool_test (bool verbose);
+
 //  Self test for private classes
 FTY_METRIC_COMPOSITE_PRIVATE void
     fty_metric_composite_private_selftest (bool verbose);
@@ -180,6 +180,14 @@ int main (int argc, char *argv [])
     }
     zstr_sendx (server,  "STATE_FILE", state_file, NULL);
     zstr_sendx (server,  "CFG_DIRECTORY", output_dir, NULL);
+    // hierarchy of partial averages, for one engine process on output_dir
+    char *hierarchical = getenv ("FTY_METRIC_COMPOSITE_HIERARCHICAL");
+    if (hierarchical)
+        zstr_sendx (server,  "HIERARCHICAL", hierarchical, NULL);
+    // one configuration (and process) per asset for both quantities
+    char *combined = getenv ("FTY_METRIC_COMPOSITE_COMBINED");
+    if (combined)
+        zstr_sendx (server,  "COMBINED", combined, NULL);
     zstr_sendx (server,  "LOAD", NULL);
     zstr_sendx (server,  "CONNECT", ENDPOINT, NULL);
     zstr_sendx (server,  "PRODUCER", "_METRICS_UNAVAILABLE", NULL);
@@ -23,11 +23,36 @@
 @header
     fty_metric_composite_configurator_server - Composite metrics server configurator
 @discuss
+    Generates one composite configuration per quantity and asset with
+    sensors, averaging all sensors assigned (or propagated) to it.
+
+    In hierarchical mode the configuration of asset above rack averages
+    outputs of its children instead - rack input and output averages, row,
+    room averages - merging their partial sums and counts, plus sensors
+    none of the children covers. Fan-in of each level stays small and the
+    result is still average of all sensors below. Outputs of composites
+    are visible only inside one process, so such configuration directory
+    is evaluated by fty-metric-composite in engine mode - the configurator
+    enables and starts (or reloads) fty-metric-composite-engine service
+    instead of one service per configuration, and stops it once flat
+    configuration is generated again. Engine takes over before services of
+    flat configurations are stopped and vice versa.
+
+    Services of configurations which are written again are reloaded, not
+    restarted, so they keep values cached for inputs which stay (one which
+    is not running is restarted); only new ones are started and ones without
+    configuration stopped.
+
+    In combined mode one configuration per asset has output for both
+    temperature and humidity (composite with more outputs), so there is one
+    process and one set of subscriptions per asset instead of two.
 @end
 */
 #include <string>
 #include <vector>
 #include <regex>
+#include <algorithm>
+#include <cmath>
 
 #include "fty_metric_composite_classes.h"
 
@@ -54,11 +79,13 @@ s_bits_systemctl (const char *operation, const char *service)
 }
 
 // For each config file in top level of 'path_to_dir' do
-//  * systemctl stop and disable of service that uses this file
+//  * remember service that uses this file in 'services'
 //  * remove config file
+// Services are left running, s_update_services deals with them once new
+// config files are written
 // 0 - success, 1 - failure
 static int
-s_remove_and_stop (const char *path_to_dir)
+s_remove_configs (const char *path_to_dir, std::set <std::string> &services)
 {
     assert (path_to_dir);
 
@@ -84,8 +111,7 @@ s_remove_and_stop (const char *path_to_dir)
             filename.erase (filename.size () - 4);
             std::string service = "fty-metric-composite@";
             service += filename;
-            s_bits_systemctl ("stop", service.c_str ());
-            s_bits_systemctl ("disable", service.c_str ());
+            services.insert (service);
             zfile_remove (item);
             log_debug ("file removed");
         }
@@ -133,10 +159,117 @@ s_write_file (const char *fullpath, const char *contents)
     return 0;
 }
 
+// Format calibration offset 'offset' of 'topic' as member of native 'offsets' object
+// Offset which is not a number is replaced by 0.0
+static std::string
+s_native_offset (const std::string &topic, const char *offset)
+{
+    char *end = NULL;
+    double value = strtod (offset, &end);
+    if (end == offset || *end != '\0') {
+        log_warning ("invalid calibration offset '%s' of '%s', using 0.0", offset, topic.c_str ());
+        value = 0.0;
+    }
+    char buff [64];
+    snprintf (buff, sizeof (buff), "%.17g", value);
+    return "\"" + topic + "\": " + buff;
+}
+
+// Quantity averaged by generated configurations
+typedef struct {
+    const char *name;
+    const char *unit;
+    const char *offset;             // ext attribute of sensor with calibration offset
+} quantity_t;
+
+static const quantity_t s_quantities [] = {
+    { "temperature", "C", "calibration_offset_t" },
+    { "humidity",    "%", "calibration_offset_h" }
+};
+
+// Service of fty-metric-composite in engine mode evaluating hierarchical
+// configuration
+static const char *ENGINE_SERVICE = "fty-metric-composite-engine";
+
+// Run engine when it is 'needed' - enable it and reload it, or start it when
+// it does not run; otherwise stop and disable it, if it is enabled
+static void
+s_update_engine (bool needed)
+{
+    bool enabled = s_bits_systemctl ("is-enabled", ENGINE_SERVICE) == 0;
+    if (needed) {
+        if (!enabled)
+            s_bits_systemctl ("enable", ENGINE_SERVICE);
+        s_bits_systemctl ("reload-or-restart", ENGINE_SERVICE);
+    }
+    else
+    if (enabled) {
+        s_bits_systemctl ("stop", ENGINE_SERVICE);
+        s_bits_systemctl ("disable", ENGINE_SERVICE);
+    }
+}
+
+// Bring services in line with regenerated configurations - services of
+// 'previous' configurations missing in 'current' ones are stopped and
+// disabled, services whose configuration was written again are reloaded,
+// so they keep values cached for inputs which stay, or restarted when
+// stopped or failed, new ones are enabled and started
+static void
+s_update_services (const std::set <std::string> &previous, const std::set <std::string> &current)
+{
+    for (const auto &service : previous) {
+        if (current.count (service) == 0) {
+            s_bits_systemctl ("stop", service.c_str ());
+            s_bits_systemctl ("disable", service.c_str ());
+        }
+    }
+    for (const auto &service : current) {
+        if (previous.count (service) != 0)
+            s_bits_systemctl ("reload-or-restart", service.c_str ());
+        else {
+            s_bits_systemctl ("enable", service.c_str ());
+            s_bits_systemctl ("start", service.c_str ());
+        }
+    }
+}
+
+// Write configuration 'filename'.cfg to 'path_to_dir', remember its service
+// in 'services' (NULL - configuration is not run as service) and its
+// 'result_topics' as generated
+static void
+s_write_config (const char *path_to_dir, const std::string &filename, const std::string &contents, std::set <std::string> *services, const std::vector <std::string> &result_topics, std::set <std::string> &newMetricsGenerated)
+{
+    std::string fullpath = path_to_dir;
+    fullpath += "/";
+    fullpath += filename;
+    fullpath += ".cfg";
+
+    std::string service = "fty-metric-composite";
+    service += "@";
+    service += filename;
+
+    if (s_write_file (fullpath.c_str (), contents.c_str ()) == 0) {
+        if (services)
+            services->insert (service);
+        newMetricsGenerated.insert (result_topics.begin (), result_topics.end ());
+    }
+    else {
+        log_error (
+                "Creating config file '%s' failed. Service '%s' not started.",
+                fullpath.c_str (), filename.c_str ());
+    }
+}
+
 // Generate todo
+// 'children' - NULL for standalone configurations, each run as its own
+// service, which is added to 'services'; otherwise configurations are for one engine (see s_update_engine),
+// and composite also averages partials of outputs of its children, given as
+// topic suffixes ('-input@Rack01', '@Row01')
+// 'combined' - one configuration with output for every quantity instead of
+// one configuration per quantity
 // 0 - success, 1 - failure
 static void
-s_generate_and_start (const char *path_to_dir, const char *sensor_function, const char *asset_name, zlistx_t **sensors_p, std::set <std::string> &newMetricsGenerated)
+s_generate_and_start (const char *path_to_dir, const char *sensor_function, const char *asset_name, zlistx_t **sensors_p, std::set <std::string> &newMetricsGenerated, std::set <std::string> &services, bool native, const std::set <std::string> *children, bool combined)
 {
     assert (path_to_dir);
     assert (asset_name);
@@ -149,51 +282,52 @@ s_generate_and_start (const char *path_to_dir, const char *sensor_function, cons
         return;
     }
 
-    if (zlistx_size (sensors) == 0) {
+    bool partials = children && !children->empty ();
+    if (zlistx_size (sensors) == 0 && !partials) {
         zlistx_destroy (sensors_p);
         *sensors_p = NULL;
         return;
     }
+    if (partials) {
+        // partial sums and counts are merged by built-in function only
+        native = true;
+    }
 
-    std::string temp_in = "[ ", hum_in = "[ ";
-
-    std::string temp_offsets = "    offsets = {};\n";
-    std::string hum_offsets = temp_offsets;
-    bool first = true;
+    const size_t quantities = sizeof (s_quantities) / sizeof (s_quantities [0]);
+    // per quantity: list of inputs, offsets and output topic
+    std::vector <std::string> ins (quantities), offsets (quantities), result_topics (quantities);
 
     fty_proto_t *item = (fty_proto_t *) zlistx_first (sensors);
     while (item) {
-        if (first) {
-            first = false;
-        }
-        else {
-            temp_in += ", ";
-            hum_in += ", ";
+        for (size_t q = 0; q < quantities; q++) {
+            std::string topic = std::string (s_quantities [q].name) + "." +
+                fty_proto_ext_string (item, "port", "(unknown)") +
+                "@" +
+                fty_proto_aux_string (item, "parent_name.1", "(unknown)");
+            const char *offset = fty_proto_ext_string (item, s_quantities [q].offset, "0.0");
+            ins [q] += (ins [q].empty () ? "" : ", ") + ("\"" + topic + "\"");
+            if (native)
+                offsets [q] += (offsets [q].empty () ? "" : ", ") + s_native_offset (topic, offset);
+            else
+                offsets [q] += "    offsets['" + topic + "'] = " + offset + ";\n";
         }
-        std::string temp_topic = std::string("temperature.") +
-            fty_proto_ext_string (item, "port", "(unknown)") +
-            "@" +
-            fty_proto_aux_string (item, "parent_name.1", "(unknown)");
-        
-        temp_in += "\"" + temp_topic + "\"";
-        
-        
-        std::string hum_topic = std::string("humidity.") +
-            fty_proto_ext_string (item, "port", "(unknown)") +
-            "@" +
-            fty_proto_aux_string (item, "parent_name.1", "(unknown)");
-        hum_in += "\"" + hum_topic + "\"";
-
-        temp_offsets += "    offsets['" + temp_topic + "'] = " + fty_proto_ext_string (item, "calibration_offset_t", "0.0") + ";\n";
-        hum_offsets += "    offsets['" + hum_topic + "'] = " + fty_proto_ext_string (item, "calibration_offset_h", "0.0") + ";\n";
-
         item = (fty_proto_t *) zlistx_next (sensors);
     }
     zlistx_destroy (sensors_p);
     *sensors_p = NULL;
 
-    temp_in += " ]";
-    hum_in += " ]";
+    std::string suffix;
+    if (sensor_function) {
+        suffix += "-";
+        suffix += sensor_function;
+    }
+    for (size_t q = 0; q < quantities; q++) {
+        if (partials) {
+            for (const auto &child : *children)
+                ins [q] += (ins [q].empty () ? "\"average." : ", \"average.") + std::string (s_quantities [q].name) + child + "\"";
+        }
+        result_topics [q] = std::string ("average.") + s_quantities [q].name + suffix + "@" + asset_name;
+    }
 
     static const char *json_tmpl =
                            "{\n"
@@ -210,93 +344,124 @@ s_generate_and_start (const char *path_to_dir, const char *sensor_function, cons
                            "    tmp = sum / num;\n"
                            "    return '##RESULT_TOPIC##', tmp, '##UNITS##', 0;\"\n"
                            "}\n";
-    std::string contents = json_tmpl;
-
-    contents.replace (contents.find ("##IN##"), strlen ("##IN##"), temp_in);
-    contents.replace (contents.find ("##OFFSETS##"), strlen ("##OFFSETS##"), temp_offsets);
-    std::string qnty = "temperature";
-    if (sensor_function) {
-        qnty += "-";
-        qnty += sensor_function;
-    }
-    std::string result_topic = "average.";
-    result_topic += qnty;
-    result_topic += "@";
-    result_topic += asset_name;
-    contents.replace (contents.find ("##RESULT_TOPIC##"), strlen ("##RESULT_TOPIC##"), result_topic);
-    contents.replace (contents.find ("##UNITS##"), strlen ("##UNITS##"), "C");
-
-    // name of the file (service) without extension
-    std::string filename = asset_name;
-    if (sensor_function) {
-        filename += "-";
-        filename += sensor_function;
+    // the same average evaluated by built-in function, without Lua
+    static const char *json_native_tmpl =
+                           "{\n"
+                           "\"in\" : ##IN##,\n"
+                           "\"function\": \"avg\",\n"
+                           "\"offsets\": ##OFFSETS##,\n"
+                           "\"output\": \"##RESULT_TOPIC##\",\n"
+                           "\"unit\": \"##UNITS##\"\n"
+                           "}\n";
+    static const char *partials_line = "\"partials\": true,\n";
+
+    if (!combined) {
+        for (size_t q = 0; q < quantities; q++) {
+            std::string contents = native ? json_native_tmpl : json_tmpl;
+            if (partials)
+                contents.insert (contents.find ("\"function\""), partials_line);
+            contents.replace (contents.find ("##IN##"), strlen ("##IN##"), "[ " + ins [q] + " ]");
+            contents.replace (contents.find ("##OFFSETS##"), strlen ("##OFFSETS##"),
+                    native ? "{ " + offsets [q] + " }" : "    offsets = {};\n" + offsets [q]);
+            contents.replace (contents.find ("##RESULT_TOPIC##"), strlen ("##RESULT_TOPIC##"), result_topics [q]);
+            contents.replace (contents.find ("##UNITS##"), strlen ("##UNITS##"), s_quantities [q].unit);
+
+            // name of the file (service) without extension
+            std::string filename = asset_name + suffix + "-" + s_quantities [q].name;
+            s_write_config (path_to_dir, filename, contents, children ? NULL : &services, {result_topics [q]}, newMetricsGenerated);
+        }
+        return;
     }
-    filename += "-temperature";
 
-    std::string fullpath = path_to_dir;
-    fullpath += "/";
-    fullpath += filename;
-    fullpath += ".cfg";
-
-    std::string service = "fty-metric-composite";
-    service += "@";
-    service += filename;
-
-    if (s_write_file (fullpath.c_str (), contents.c_str ()) == 0) {
-        s_bits_systemctl ("enable", service.c_str ());
-        s_bits_systemctl ("start", service.c_str ());
-        newMetricsGenerated.insert (result_topic);
+    // one composite with output for every quantity
+    std::string all_ins, all_offsets, outputs;
+    for (size_t q = 0; q < quantities; q++) {
+        all_ins += (all_ins.empty () ? "" : ", ") + ins [q];
+        if (native) {
+            if (!offsets [q].empty ())
+                all_offsets += (all_offsets.empty () ? "" : ", ") + offsets [q];
+            outputs += std::string (q ? ",\n" : "") +
+                "  { \"function\": \"avg\", \"in\": [ " + ins [q] + " ], " +
+                "\"output\": \"" + result_topics [q] + "\", \"unit\": \"" + s_quantities [q].unit + "\" }";
+        }
+        else {
+            all_offsets += offsets [q];
+            outputs += std::string (q ? ", " : "") +
+                "{ '" + s_quantities [q].name + ".', '" + result_topics [q] + "', '" + s_quantities [q].unit + "' }";
+        }
+    }
+    std::string contents = "{\n\"in\" : [ " + all_ins + " ],\n";
+    if (native) {
+        if (partials)
+            contents += partials_line;
+        contents +=
+            "\"offsets\": { " + all_offsets + " },\n"
+            "\"outputs\": [\n" + outputs + "\n]\n"
+            "}\n";
     }
     else {
-        log_error (
-                "Creating config file '%s' failed. Service '%s' not started.",
-                fullpath.c_str (), filename.c_str ());
+        // inputs of each output are told apart by quantity prefix of topic
+        contents +=
+            "\"evaluation\": \"\n"
+            "    offsets = {};\n" + all_offsets +
+            "    outputs = {};\n"
+            "    for _,q in ipairs({ " + outputs + " }) do\n"
+            "        sum = 0;\n"
+            "        num = 0;\n"
+            "        for key,value in pairs(mt) do\n"
+            "            if string.sub(key, 1, string.len(q[1])) == q[1] then\n"
+            "                sum = sum + value + offsets[key];\n"
+            "                num = num + 1;\n"
+            "            end;\n"
+            "        end;\n"
+            "        if num > 0 then table.insert(outputs, { q[2], sum / num, q[3] }); end;\n"
+            "    end;\n"
+            "    if #outputs == 0 then error('all sensors lost'); end;\n"
+            "    return outputs;\"\n"
+            "}\n";
     }
+    s_write_config (path_to_dir, asset_name + suffix, contents, children ? NULL : &services, result_topics, newMetricsGenerated);
+}
 
-    contents = json_tmpl;
-    contents.replace (contents.find ("##IN##"), strlen ("##IN##"), hum_in);
-    contents.replace (contents.find ("##OFFSETS##"), strlen ("##OFFSETS##"), hum_offsets);
-    qnty = "humidity";
-    if (sensor_function) {
-        qnty += "-";
-        qnty += sensor_function;
-    }
-    result_topic = "average.";
-    result_topic += qnty;
-    result_topic += "@";
-    result_topic += asset_name;
-    contents.replace (contents.find ("##RESULT_TOPIC##"), strlen ("##RESULT_TOPIC##"), result_topic);
-    contents.replace (contents.find ("##UNITS##"), strlen ("##UNITS##"), "%");
-
-    // name of the file (service) without extension
-    filename = asset_name;
-    if (sensor_function) {
-        filename += "-";
-        filename += sensor_function;
+// Number of parents of 'asset' in topology
+static int
+s_depth (fty_proto_t *asset)
+{
+    int depth = 0;
+    while (depth < 10) {
+        std::string key = "parent_name." + std::to_string (depth + 1);
+        if (!fty_proto_aux_string (asset, key.c_str (), NULL))
+            break;
+        depth++;
     }
-    filename += "-humidity";
-
-    fullpath = path_to_dir;
-    fullpath += "/";
-    fullpath += filename;
-    fullpath += ".cfg";
-
-    service = "fty-metric-composite";
-    service += "@";
-    service += filename;
+    return depth;
+}
 
-    if (s_write_file (fullpath.c_str (), contents.c_str ()) == 0) {
-        s_bits_systemctl ("enable", service.c_str ());
-        s_bits_systemctl ("start", service.c_str ());
-        newMetricsGenerated.insert (result_topic);
-    }
-    else {
-        log_error (
-                "Creating config file '%s' failed. Service '%s' not started.",
-                fullpath.c_str (), filename.c_str ());
+// Get suffix of output topic of the child of 'asset_name' which already
+// averages propagated 'sensor' (i.e. '-input@Rack01', '@Row01'), empty string
+// if no child does
+static std::string
+s_child_output (data_t *data, fty_proto_t *sensor, const char *asset_name)
+{
+    const char *rack = fty_proto_ext_string (sensor, "logical_asset", NULL);
+    fty_proto_t *rack_proto = rack ? data_asset (data, rack) : NULL;
+    if (!rack_proto)
+        return "";
+    // the child is the asset right below 'asset_name' on the way to the rack
+    std::string child = rack;
+    for (int i = 1; i <= s_depth (rack_proto); i++) {
+        std::string key = "parent_name." + std::to_string (i);
+        const char *parent = fty_proto_aux_string (rack_proto, key.c_str (), "");
+        if (streq (parent, asset_name))
+            break;
+        child = parent;
     }
-    return;
+    if (child != rack)
+        return "@" + child;
+    const char *sensor_function = fty_proto_ext_string (sensor, "sensor_function", "");
+    if (streq (sensor_function, "input") || streq (sensor_function, "output"))
+        return std::string ("-") + sensor_function + "@" + rack;
+    return "";
 }
 
 static void
@@ -306,8 +471,10 @@ s_regenerate (c_metric_conf_t *cfg, data_t *data, std::set <std::string> &metric
     assert (data);
     // potential unavailable metrics are those, what are now still available
     metrics_unavailable = data_get_produced_metrics (data);
-    // 1. Delete all files in output dir and stop/disable services
-    int rv = s_remove_and_stop (c_metric_conf_cfgdir (cfg));
+    // 1. Delete all files in output dir, services are updated once new ones
+    //    are written
+    std::set <std::string> previous_services, services;
+    int rv = s_remove_configs (c_metric_conf_cfgdir (cfg), previous_services);
     log_info ("Old configuration was removed");
     if (rv != 0) {
         log_error (
@@ -316,48 +483,96 @@ s_regenerate (c_metric_conf_t *cfg, data_t *data, std::set <std::string> &metric
         return;
     }
 
-    // 2. Generate new files and enable/start services
+    // 2. Generate new files
     zlistx_t *assets = data_asset_names (data);
     if (!assets) {
         log_error ("data_asset_names () failed");
+        s_update_services (previous_services, services);
         return;
     }
     log_debug ("propagation: %s",  c_metric_conf_propagation (cfg) ? "true": "false");
     data_reassign_sensors (data, c_metric_conf_propagation (cfg));
     log_info ("New configuration was deduced");
-    const char *asset = (const char *) zlistx_first (assets);
+
+    // Hierarchy needs propagated sensors and partials of built-in functions
+    bool hierarchical = c_metric_conf_hierarchical (cfg) && c_metric_conf_propagation (cfg);
+    if (hierarchical && !c_metric_conf_native (cfg)) {
+        log_warning ("Hierarchical configuration needs built-in functions, generating flat one");
+        hierarchical = false;
+    }
+    std::vector <std::string> ordered;
+    for (const char *asset = (const char *) zlistx_first (assets); asset; asset = (const char *) zlistx_next (assets))
+        ordered.push_back (asset);
+    if (hierarchical) {
+        // children are generated before their parents
+        std::stable_sort (ordered.begin (), ordered.end (),
+            [data] (const std::string &a, const std::string &b) {
+                return s_depth (data_asset (data, a.c_str ())) > s_depth (data_asset (data, b.c_str ()));
+            });
+        log_info ("Configuration is generated as hierarchy for one engine, '%s'", ENGINE_SERVICE);
+    }
+    std::set <std::string> no_children;
+    const std::set <std::string> *children = hierarchical ? &no_children : NULL;
+
     std::set <std::string> metricsAvailable;
-    while (asset) {
+    for (const auto &name : ordered) {
+        const char *asset = name.c_str ();
         fty_proto_t *proto = data_asset (data, asset);
         if (streq (fty_proto_aux_string (proto, "type", ""), "rack")) {
             zlistx_t *sensors = NULL;
             // Ti, Hi
             sensors = data_get_assigned_sensors (data, asset, "input");
             if (sensors) {
-                s_generate_and_start (c_metric_conf_cfgdir (cfg), "input", asset, &sensors, metricsAvailable);
+                s_generate_and_start (c_metric_conf_cfgdir (cfg), "input", asset, &sensors, metricsAvailable, services, c_metric_conf_native (cfg), children, c_metric_conf_combined (cfg));
             }
 
             // To, Ho
             sensors = data_get_assigned_sensors (data, asset, "output");
             if (sensors) {
-                s_generate_and_start (c_metric_conf_cfgdir (cfg), "output", asset, &sensors, metricsAvailable);
+                s_generate_and_start (c_metric_conf_cfgdir (cfg), "output", asset, &sensors, metricsAvailable, services, c_metric_conf_native (cfg), children, c_metric_conf_combined (cfg));
             }
         }
         else {
             zlistx_t *sensors = NULL;
             // T, H
             sensors = data_get_assigned_sensors (data, asset, NULL);
+            if (sensors && hierarchical) {
+                // sensors already averaged by a child are taken from its output
+                std::set <std::string> asset_children;
+                zlistx_t *direct = zlistx_new ();
+                zlistx_set_destructor (direct, (czmq_destructor *) fty_proto_destroy);
+                zlistx_set_duplicator (direct, (czmq_duplicator *) fty_proto_dup);
+                for (fty_proto_t *sensor = (fty_proto_t *) zlistx_first (sensors); sensor; sensor = (fty_proto_t *) zlistx_next (sensors)) {
+                    std::string child = s_child_output (data, sensor, asset);
+                    if (child.empty ())
+                        zlistx_add_end (direct, sensor);
+                    else
+                        asset_children.insert (child);
+                }
+                zlistx_destroy (&sensors);
+                s_generate_and_start (c_metric_conf_cfgdir (cfg), NULL, asset, &direct, metricsAvailable, services, true, &asset_children, c_metric_conf_combined (cfg));
+            }
+            else
             if (sensors) {
-                s_generate_and_start (c_metric_conf_cfgdir (cfg), NULL, asset, &sensors, metricsAvailable);
+                s_generate_and_start (c_metric_conf_cfgdir (cfg), NULL, asset, &sensors, metricsAvailable, services, c_metric_conf_native (cfg), NULL, c_metric_conf_combined (cfg));
             }
         }
-        asset = (const char *) zlistx_next (assets);
     }
     for (const auto &one_metric: metricsAvailable) {
         metrics_unavailable.erase (one_metric);
     }
     data_set_produced_metrics (data, metricsAvailable);
     zlistx_destroy (&assets);
+    // 3. Reload services which stay, start new ones, stop the rest; engine
+    //    runs hierarchical configuration
+    if (hierarchical) {
+        s_update_engine (!metricsAvailable.empty ());
+        s_update_services (previous_services, services);
+    }
+    else {
+        s_update_services (previous_services, services);
+        s_update_engine (false);
+    }
     log_info ("Sensors were reconfigured");
 }
 
@@ -421,12 +636,18 @@ fty_metric_composite_configurator_server (zsock_t *pipe, void* args)
                 continue;
             }
             bool old_is_propagation_needed = c_metric_conf_propagation (cfg);
+            bool old_is_native = c_metric_conf_native (cfg);
+            bool old_is_hierarchical = c_metric_conf_hierarchical (cfg);
+            bool old_is_combined = c_metric_conf_combined (cfg);
             if (actor_commands (cfg, &data, &message) == 1) {
                 break;
             }
             // This is UGLY hack, because there is a need to call s_regenerate from actor commands in some cases
             // but s_regenerate is satic function here!
-            if (old_is_propagation_needed != c_metric_conf_propagation (cfg)) {
+            if (old_is_propagation_needed != c_metric_conf_propagation (cfg)
+            ||  old_is_native != c_metric_conf_native (cfg)
+            ||  old_is_hierarchical != c_metric_conf_hierarchical (cfg)
+            ||  old_is_combined != c_metric_conf_combined (cfg)) {
                 // so, we need to regenerate configuration according new reality
                 std::set <std::string> metrics_unavailable;
                 s_regenerate (cfg, data, metrics_unavailable);
@@ -568,6 +789,61 @@ test_dir_contents (
 }
 
 
+//  Helper test function
+//  Create sensor with 'port' on 'parent' and calibration offsets, as
+//  returned by data_get_assigned_sensors
+
+static fty_proto_t *
+test_sensor_new (const char *port, const char *parent, const char *offset_t, const char *offset_h)
+{
+    fty_proto_t *sensor = test_asset_new (port, FTY_PROTO_ASSET_OP_CREATE);
+    fty_proto_aux_insert (sensor, "parent_name.1", "%s", parent);
+    fty_proto_ext_insert (sensor, "port", "%s", port);
+    fty_proto_ext_insert (sensor, "calibration_offset_t", "%s", offset_t);
+    fty_proto_ext_insert (sensor, "calibration_offset_h", "%s", offset_h);
+    return sensor;
+}
+
+//  Helper test function
+//  List of sensors TH1 and TH2 on ups1 with calibration offsets
+
+static zlistx_t *
+test_sensors_new ()
+{
+    zlistx_t *sensors = zlistx_new ();
+    zlistx_set_destructor (sensors, (czmq_destructor *) fty_proto_destroy);
+    zlistx_add_end (sensors, test_sensor_new ("TH1", "ups1", "1", "10"));
+    zlistx_add_end (sensors, test_sensor_new ("TH2", "ups1", "2", "20"));
+    return sensors;
+}
+
+//  Helper test function
+//  Load generated configuration 'filename', update its inputs by values of
+//  'readings' and check that evaluation gives exactly 'expected' outputs,
+//  topic -> value
+
+static void
+test_evaluate_config (
+        const std::string &filename,
+        const std::map <std::string, double> &readings,
+        const std::map <std::string, double> &expected)
+{
+    composite_t *composite = composite_new ("configurator-test");
+    assert (composite_load (composite, filename.c_str ()) == 0);
+    for (const auto &it : readings)
+        composite_update (composite, it.first.c_str (), it.second, 200);
+    std::vector <composite_output_t> outputs;
+    assert (composite_evaluate_all (composite, 100, outputs) == 0);
+    assert (outputs.size () == expected.size ());
+    for (const auto &output : outputs) {
+        log_debug ("%s: %s = %f", filename.c_str (), output.topic.c_str (), output.value);
+        auto it = expected.find (output.topic);
+        assert (it != expected.end ());
+        assert (fabs (output.value - it->second) < 1e-9);
+    }
+    composite_destroy (&composite);
+}
+
 // Improvement memo: make expected_configs a string->string map and check the file contents
 //                   as well (or parse json).
 
@@ -582,6 +858,84 @@ fty_metric_composite_configurator_server_test (bool verbose)
         printf ("\n");
 
     //  @selftest
+    // generated configurations - inputs of both forms give the same
+    // averages with calibration offsets
+    const char *test_cfgdir = "src/selftest-rw/configurator";
+    zsys_dir_create (test_cfgdir);
+    const std::map <std::string, double> readings = {
+        { "temperature.TH1@ups1", 20 },
+        { "temperature.TH2@ups1", 30 },
+        { "humidity.TH1@ups1", 40 },
+        { "humidity.TH2@ups1", 50 }
+    };
+    for (bool native : {true, false}) {
+        std::set <std::string> metrics, services;
+        zlistx_t *sensors = test_sensors_new ();
+        s_generate_and_start (test_cfgdir, "input", "Rack01", &sensors, metrics, services, native, NULL, false);
+        assert (!sensors);
+        assert (metrics == std::set <std::string> ({"average.temperature-input@Rack01", "average.humidity-input@Rack01"}));
+        assert (services == std::set <std::string> ({"fty-metric-composite@Rack01-input-temperature", "fty-metric-composite@Rack01-input-humidity"}));
+        test_evaluate_config (std::string (test_cfgdir) + "/Rack01-input-temperature.cfg", readings,
+            {{ "average.temperature-input@Rack01", (21 + 32) / 2.0 }});
+        test_evaluate_config (std::string (test_cfgdir) + "/Rack01-input-humidity.cfg", readings,
+            {{ "average.humidity-input@Rack01", (50 + 70) / 2.0 }});
+        std::set <std::string> removed;
+        assert (s_remove_configs (test_cfgdir, removed) == 0);
+        assert (removed == services);
+    }
+    // combined - one configuration per asset with both averages
+    for (bool native : {true, false}) {
+        std::set <std::string> metrics, services;
+        zlistx_t *sensors = test_sensors_new ();
+        s_generate_and_start (test_cfgdir, "input", "Rack01", &sensors, metrics, services, native, NULL, true);
+        assert (metrics == std::set <std::string> ({"average.temperature-input@Rack01", "average.humidity-input@Rack01"}));
+        assert (services == std::set <std::string> ({"fty-metric-composite@Rack01-input"}));
+        test_evaluate_config (std::string (test_cfgdir) + "/Rack01-input.cfg", readings, {
+            { "average.temperature-input@Rack01", (21 + 32) / 2.0 },
+            { "average.humidity-input@Rack01", (50 + 70) / 2.0 }});
+        // quantity without valid sensor is left out
+        test_evaluate_config (std::string (test_cfgdir) + "/Rack01-input.cfg", {{ "humidity.TH2@ups1", 50 }}, {
+            { "average.humidity-input@Rack01", 70 }});
+        std::set <std::string> removed;
+        assert (s_remove_configs (test_cfgdir, removed) == 0);
+        assert (removed == services);
+    }
+    // hierarchy - row merges partials of its rack with its own sensor, no
+    // service is started
+    {
+        std::set <std::string> metrics, services, no_children, children = {"-input@Rack01"};
+        zlistx_t *sensors = test_sensors_new ();
+        s_generate_and_start (test_cfgdir, "input", "Rack01", &sensors, metrics, services, true, &no_children, false);
+        sensors = zlistx_new ();
+        zlistx_set_destructor (sensors, (czmq_destructor *) fty_proto_destroy);
+        zlistx_add_end (sensors, test_sensor_new ("TH3", "ups2", "0", "0"));
+        s_generate_and_start (test_cfgdir, NULL, "Row01", &sensors, metrics, services, true, &children, false);
+        assert (services.empty ());
+        assert (metrics.count ("average.temperature@Row01") == 1);
+
+        composite_t *rack = composite_new ("Rack01-input-temperature");
+        assert (composite_load (rack, (std::string (test_cfgdir) + "/Rack01-input-temperature.cfg").c_str ()) == 0);
+        for (const auto &it : readings)
+            composite_update (rack, it.first.c_str (), it.second, 200);
+        composite_output_t partial;
+        assert (composite_evaluate (rack, 100, partial) == 0);
+        composite_t *row = composite_new ("Row01-temperature");
+        assert (composite_load (row, (std::string (test_cfgdir) + "/Row01-temperature.cfg").c_str ()) == 0);
+        int slot = composite_slot (row, "average.temperature-input@Rack01");
+        assert (slot != -1);
+        composite_update_slot_partial (row, slot, partial, 200);
+        composite_update (row, "temperature.TH3@ups2", 35, 200);
+        composite_output_t output;
+        assert (composite_evaluate (row, 100, output) == 0);
+        // average of all three sensors, not of rack average and the sensor
+        assert (output.topic == "average.temperature@Row01");
+        assert (fabs (output.value - (21 + 32 + 35) / 3.0) < 1e-9);
+        composite_destroy (&row);
+        composite_destroy (&rack);
+        std::set <std::string> removed;
+        assert (s_remove_configs (test_cfgdir, removed) == 0);
+        assert (removed.size () == 4);
+    }
 
     zactor_t *server = zactor_new (mlm_server, (void*) "Malamute");
     zstr_sendx (server, "BIND", endpoint, NULL);
@@ -44,6 +44,15 @@ fty_metric_composite_private_selftest (bool verbose)
     data_test (verbose);
     proto_metric_unavailable_test (verbose);
     c_metric_conf_test (verbose);
+    composite_test (verbose);
+    topic_index_test (verbose);
+    timer_wheel_test (verbose);
+    proto_metric_wire_test (verbose);
+    value_codec_test (verbose);
+    sliding_window_test (verbose);
+    worker_pool_test (verbose);
+    metric_queue_test (verbose);
+    memory_pool_test (verbose);
 }
 /*
 ################################################################################
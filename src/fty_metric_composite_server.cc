@@ -22,252 +22,1630 @@
 @header
     fty_metric_composite_server - Composite metrics server
 @discuss
+    Actor commands:
+        CONNECT/endpoint        - connect to malamute broker on 'endpoint'
+        CONFIG/filename         - load one composite from config file
+        CFG_DIRECTORY/path      - engine mode, load every *.cfg file in 'path'
+        REMOVE/name             - remove composite loaded from 'name'.cfg
+        RELOAD                  - load config files of composites which
+                                  changed again, in engine mode load new
+                                  files in the directory, remove composites
+                                  whose file is gone
+        COALESCE/delay          - coalesce bursts of metrics, evaluate at most
+                                  'delay' ms after the first one; -1 (default)
+                                  evaluates on every metric
+        PERIOD/seconds          - evaluate composites every 'seconds', only if
+                                  an input changed; 0 (default) evaluates on
+                                  every metric. 'period' in composite config
+                                  takes precedence.
+        PRECISION/digits        - number of decimal places of published values,
+                                  2 by default
+        PIPELINE/capacity       - before CONNECT, receive and decode metrics on
+                                  own thread, handing them over through queue
+                                  of 'capacity' records; 0 (default) receives
+                                  on the actor thread
+        WORKERS/count           - evaluate composites on 'count' worker threads
+                                  along with the actor one; 0 (default)
+                                  evaluates everything on the actor thread
+        STATS                   - reply with counters, pairs of name and value
+                                  frames: received, out_of_order, evaluated,
+                                  skipped (evaluations which reused previous
+                                  outputs), published, queue_depth,
+                                  queue_max_depth, queue_coalesced (records
+                                  of pipeline replaced while queue was full),
+                                  lua_in_use, lua_reserved and lua_mallocs
+                                  (memory of Lua states of all composites,
+                                  see composite_memory)
+        VERBOSE                 - verbose logging
+        $TERM                   - terminate
+
+    All composites loaded by one actor share its malamute client. Every input
+    topic is subscribed just once and incoming value is routed to every
+    composite depending on it through reverse index (see topic_index).
+    Topics are not subscribed one by one - new topics of all composites
+    loaded by one command are sorted and compiled into few patterns, each
+    an alternation of up to 64 topics under their common prefix, like
+    '^temperature\.(TH1@rack|TH2@rack)$'. That saves broker round trips on
+    start and regular expressions malamute tests every message against.
+    Subject of every message is matched exactly against the index before
+    the message is decoded, anything nobody depends on is dropped.
+
+    Input values expire even when no other message arrives - every composite
+    holding a valid input is scheduled on a timer wheel (see timer_wheel)
+    for the moment its first input stops being valid, zpoller timeout wakes
+    the actor then. Each composite has just one entry in the wheel, moved
+    only when an update brings that moment closer; otherwise the entry fires
+    at the old moment, expires what is due and is scheduled again for the
+    next expiry of the composite (see composite_next_expiry). Size of the
+    wheel thus follows number of composites, not rate of metrics. Composite which lost an input is evaluated and published again,
+    or, when it can't be evaluated anymore, announced on the
+    _METRICS_UNAVAILABLE stream - once, not again until the output is
+    evaluated again.
+
+    Processing follows event time - every cached value keeps timestamp of
+    its reading and a reading older than the cached one (delayed in the
+    broker or replayed) is dropped, and output is published with timestamp
+    of the newest reading it was evaluated from, not the moment of
+    evaluation. Sliding windows are fed by the same timestamps.
+
+    In coalescing mode every metric already waiting in the malamute client
+    is received without blocking, composites are only updated and marked
+    dirty. Each dirty composite is evaluated and published once, when the
+    coalescing delay since the first metric of the burst runs out.
+
+    Composite with evaluation period is evaluated on its own fixed cadence,
+    driven by second timer wheel, and only when some input was updated
+    since the previous tick, so output rate does not follow input rate.
+    Expired input still re-evaluates it right away.
+
+    Composite configured with deadband publishes only outputs which moved
+    enough since the last published one, but at least every max_silence,
+    by default half of the output TTL.
+
+    Composites of one actor form an evaluation graph - composite whose
+    input is output of another one gets it right after the producer is
+    evaluated, without a trip through the broker (only sensor metrics are
+    consumed from it). Every turn evaluates scheduled composites by their
+    level in the graph, so each one runs once, after all its producers.
+    With 'partials' in its config, consumer merges partial sums and counts
+    of its producers (see composite).
+
+    Reload (RELOAD command, SIGHUP of fty-metric-composite) replaces each
+    composite whose file changed since it was loaded (composites loaded by
+    CONFIG from outside of the directory included) by one loaded from the
+    file again, unchanged ones keep running as they are. New one takes over
+    still valid values of inputs it shares with the old one, so outputs do
+    not disappear until every sensor reports again. Subscriptions are
+    updated by diff - only new input topics are subscribed; malamute can't
+    drop a subscription, values of topics nobody depends on anymore are
+    dropped on arrival. Config which fails to load keeps the old composite
+    running. Outputs which a reloaded composite does not have anymore, or
+    whose composite is gone, are announced on the _METRICS_UNAVAILABLE
+    stream.
+
+    Composite may have more outputs (see composite), every one is fed,
+    published and announced as unavailable on its own.
+
+    With PIPELINE, slow evaluation does not back up the broker socket -
+    receiving stage on its own thread (and malamute client) subscribes
+    the patterns, matches topics exactly, decodes metrics and passes them
+    as records of topic id, value, time and ttl through lock-free queue
+    (see metric_queue) to the actor thread, which updates caches, evaluates
+    and publishes. Receiving stage never blocks on full queue, newer metric
+    of a topic waiting for room replaces the older one.
+
+    With WORKERS, scheduled composites of one level of the graph are
+    evaluated in parallel by work-stealing pool (see worker_pool) - they
+    don't depend on each other and every composite is evaluated by one
+    thread at a time. Actor thread keeps receiving, updating input caches,
+    feeding dependents and publishing, in the order of the level, after
+    the whole level is evaluated, so everything leaves through one client
+    and outputs of one composite keep their order.
+
+    Values are parsed and formatted by value_codec, independently of the
+    locale. Metric whose value is not a number is dropped, it never turns
+    into 0.
+
+    Incoming metrics are decoded selectively - only time, ttl and value are
+    read straight from the frame (see proto_metric_wire). Message which
+    does not match expected METRIC layout goes through fty_proto_decode.
+    Outputs are published from per composite template encoded once, only
+    value and time are filled in for every message.
+
+    Composite with 'windows' in its config keeps its outputs in sliding
+    windows (see sliding_window) and publishes mean, minimum and maximum
+    over each of them along with every published output, named like
+    fty-metric-compute ones - 'average.temperature_arithmetic_mean_15m@rack',
+    '..._min_15m@rack' and '..._max_15m@rack'.
 @end
 */
 
 #include "fty_metric_composite_classes.h"
 
-extern "C" {
-#include <lua.h>
-#include <lauxlib.h>
-#include <lualib.h>
-}
-
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
+#include <algorithm>
+#include <regex>
 #include <iostream>
 #include <fstream>
-#include <cxxtools/jsondeserializer.h>
+#include <iterator>
 #include <cxxtools/directory.h>
 #include <fty_proto.h>
 
-struct value {
-  double value;
-  time_t valid_till;
-};
+static std::string
+escape_regex (const std::string &notregex)
+{
+    static const char *to_be_escaped = ".^$|()[]{}*+?\\";
+    std::string result;
+
+    for (char c: notregex) {
+        if (strchr (to_be_escaped,c)) {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result;
+}
+
+//  Sliding window of composite output with templates of its aggregates
+
+typedef enum {
+    WINDOW_MEAN = 0,
+    WINDOW_MIN,
+    WINDOW_MAX,
+    WINDOW_AGGREGATES
+} window_aggregate_t;
+
+static const char *s_window_aggregates [WINDOW_AGGREGATES] = {
+    "arithmetic_mean", "min", "max"
+};
+
+typedef struct {
+    sliding_window_t *window;
+    std::string topics [WINDOW_AGGREGATES];
+    proto_metric_template_t templates [WINDOW_AGGREGATES];
+} server_window_t;
+
+//  Publishing state of one output of composite
+
+typedef struct {
+    std::string topic;                              // output topic the state belongs to
+    proto_metric_template_t tmpl;                   // pre-encoded output
+    std::vector <server_window_t> windows;          // sliding windows of output
+} server_output_t;
+
+//  Start of receiving stage, copied by it before it signals
+
+typedef struct {
+    std::string name;                               // malamute client address
+    std::string endpoint;
+    metric_queue_t *queue;                          // records for the server
+} server_receiver_args_t;
+
+//  Evaluation of one composite by worker pool
+
+typedef struct {
+    composite_t *composite;
+    time_t now;
+    int rv;                                         // result of composite_evaluate_all
+    std::vector <composite_output_t> outputs;       // its outputs, reused
+} server_job_t;
+
+//  Counters reported by STATS command
+
+typedef struct {
+    uint64_t received;          // metrics received from _METRICS_SENSOR
+    uint64_t out_of_order;      // updates dropped as older than the cached value
+    uint64_t evaluated;         // evaluations which ran function or script
+    uint64_t skipped;           // evaluations which reused previous outputs
+    uint64_t published;         // metrics published, window aggregates included
+} server_stats_t;
+
+//  Structure of our actor
+
+struct _fty_metric_composite_server_t {
+    char *name;                 // actor name, used as malamute client address
+    bool verbose;               // verbose logging enabled?
+    int phase;                  // 0 - created, 1 - connected, 2 - configured
+    mlm_client_t *client;       // malamute client shared by all composites
+    mlm_client_t *unavailable;  // producer of _METRICS_UNAVAILABLE stream
+    std::map <std::string, composite_t *> composites;  // composite name -> composite
+    std::map <std::string, std::string> files;         // composite name -> its config file
+    std::map <std::string, size_t> digests;            // composite name -> digest of config as loaded
+    std::string directory;                             // config directory in engine mode
+    topic_index_t *index;                              // input topic -> composites
+    std::set <std::string> subscriptions;              // input topics already subscribed
+    std::vector <std::string> unsubscribed;            // input topics to subscribe
+    timer_wheel_t *wheel;                              // composites waiting for expiry of an input
+    std::map <composite_t *, time_t> deadlines;        // composite -> when it fires in wheel
+    std::vector <void *> due;                          // composites with expired inputs, reused
+    int64_t coalesce;                                  // max coalescing delay [ms], -1 - disabled
+    int64_t flush_at;                                  // when dirty composites are evaluated [ms, zclock_mono], -1 - none
+    std::vector <composite_t *> dirty;                 // updated, not yet evaluated composites
+    int period;                                        // default evaluation period [s], 0 - on every metric
+    timer_wheel_t *cadence;                            // ticks of periodically evaluated composites
+    int precision;                                     // decimal places of published values
+    proto_metric_wire_t *wire;                         // selective coder of metrics
+    std::map <composite_t *, std::vector <server_output_t>> outputs;   // composite -> state of its outputs
+    std::vector <composite_output_t> results;          // outputs of last evaluation, reused
+    std::set <std::string> announced;                  // outputs announced unavailable, not evaluated since
+    std::map <composite_t *, int> levels;              // composite -> depth in evaluation graph
+    bool relevel;                                      // levels must be computed again?
+    std::set <std::pair <int, composite_t *>> pending; // composites to evaluate, by level
+    server_stats_t stats;                              // counters for STATS command
+    worker_pool_t *pool;                               // evaluates one level in parallel, NULL - actor thread does
+    std::vector <server_job_t> jobs;                   // evaluations of one level, reused
+    std::vector <void *> items;                        // pointers to jobs, reused
+    size_t pipeline;                                   // capacity of queue of receiving stage, 0 - no stage
+    metric_queue_t *queue;                             // records decoded by receiving stage
+    zactor_t *receiver;                                // receiving stage, NULL - actor thread receives
+};
+
+static const uint64_t TTL = 5*60;
+static const size_t PATTERN_TOPICS = 64;        // max topics in one consumer pattern
+static const size_t PATTERN_SIZE = 256;         // max length of consumer pattern, zrex has fixed buffers
+static const int RECEIVER_RETRY = 10;           // retry of full queue of receiving stage [ms]
+
+//  --------------------------------------------------------------------------
+//  Create a new fty_metric_composite_server
+
+static fty_metric_composite_server_t *
+s_server_new (const char *name)
+{
+    fty_metric_composite_server_t *self = new _fty_metric_composite_server_t ();
+    self->name = strdup (name);
+    self->verbose = false;
+    self->phase = 0;
+    self->client = mlm_client_new ();
+    self->unavailable = mlm_client_new ();
+    self->index = topic_index_new ();
+    self->wheel = timer_wheel_new (time (NULL));
+    self->coalesce = -1;
+    self->flush_at = -1;
+    self->period = 0;
+    self->cadence = timer_wheel_new (time (NULL));
+    self->precision = 2;
+    self->relevel = false;
+    self->wire = proto_metric_wire_new ();
+    self->stats = server_stats_t ();
+    self->pool = NULL;
+    self->pipeline = 0;
+    self->queue = NULL;
+    self->receiver = NULL;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the fty_metric_composite_server
+
+static void
+s_server_destroy (fty_metric_composite_server_t **self_p)
+{
+    if (*self_p) {
+        fty_metric_composite_server_t *self = *self_p;
+        zactor_destroy (&self->receiver);
+        metric_queue_destroy (&self->queue);
+        worker_pool_destroy (&self->pool);
+        proto_metric_wire_destroy (&self->wire);
+        timer_wheel_destroy (&self->cadence);
+        timer_wheel_destroy (&self->wheel);
+        topic_index_destroy (&self->index);
+        for (auto &it : self->outputs) {
+            for (auto &output : it.second) {
+                for (auto &window : output.windows)
+                    sliding_window_destroy (&window.window);
+            }
+        }
+        for (auto &it : self->composites)
+            composite_destroy (&it.second);
+        mlm_client_destroy (&self->unavailable);
+        mlm_client_destroy (&self->client);
+        free (self->name);
+        delete self;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get evaluation period of 'composite', 0 if it is evaluated on every metric
+
+static int
+s_server_period (fty_metric_composite_server_t *self, composite_t *composite)
+{
+    int period = composite_period (composite);
+    return period > 0 ? period : self->period;
+}
+
+//  --------------------------------------------------------------------------
+//  Compute level of every composite in evaluation graph - composite is one
+//  level above the highest producer of its inputs. Composites in a cycle
+//  are stopped at level equal to number of composites.
+
+static void
+s_server_relevel (fty_metric_composite_server_t *self)
+{
+    self->relevel = false;
+    self->levels.clear ();
+    for (const auto &it : self->composites)
+        self->levels [it.second] = 0;
+    bool changed = true;
+    for (size_t round = 0; changed && round < self->composites.size (); round++) {
+        changed = false;
+        for (auto &it : self->levels) {
+            for (const auto &topic : composite_inputs (it.first)) {
+                int id = topic_index_id (self->index, topic.c_str ());
+                composite_t *producer = id == -1 ? NULL : topic_index_producer (self->index, id);
+                if (!producer || producer == it.first)
+                    continue;
+                int level = self->levels [producer] + 1;
+                if (level > it.second) {
+                    it.second = level;
+                    changed = true;
+                }
+            }
+        }
+    }
+    if (changed)
+        zsys_error ("%s:\tComposites depend on each other in a cycle", self->name);
+}
+
+//  --------------------------------------------------------------------------
+//  Get level of 'composite' in evaluation graph
+
+static int
+s_server_level (fty_metric_composite_server_t *self, composite_t *composite)
+{
+    if (self->relevel)
+        s_server_relevel (self);
+    auto it = self->levels.find (composite);
+    return it == self->levels.end () ? 0 : it->second;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate 'composite' later in this turn, after its producers
+
+static void
+s_server_schedule (fty_metric_composite_server_t *self, composite_t *composite)
+{
+    self->pending.insert (std::make_pair (s_server_level (self, composite), composite));
+}
+
+//  --------------------------------------------------------------------------
+//  Make 'composite' fire in the wheel once input valid till 'valid_till'
+//  expires, unless it fires earlier already
+
+static void
+s_server_arm (fty_metric_composite_server_t *self, composite_t *composite, time_t valid_till)
+{
+    auto it = self->deadlines.find (composite);
+    if (it != self->deadlines.end ()) {
+        if (it->second <= valid_till + 1)
+            return;
+        // rare - input with shorter validity than all others so far
+        timer_wheel_remove (self->wheel, composite);
+    }
+    self->deadlines [composite] = valid_till + 1;
+    timer_wheel_add (self->wheel, valid_till + 1, composite);
+}
+
+//  --------------------------------------------------------------------------
+//  Register 'composite' as producer of 'topic' if nobody else produces it
+
+static void
+s_server_set_producer (fty_metric_composite_server_t *self, composite_t *composite, const char *topic)
+{
+    int id = topic_index_id (self->index, topic);
+    composite_t *producer = id == -1 ? NULL : topic_index_producer (self->index, id);
+    if (producer == composite)
+        return;
+    if (producer) {
+        zsys_warning ("%s:\t'%s' is produced by '%s' already, '%s' is not evaluated in the graph",
+                self->name, topic, composite_name (producer), composite_name (composite));
+        return;
+    }
+    topic_index_set_producer (self->index, topic, composite);
+    self->relevel = true;
+}
+
+//  --------------------------------------------------------------------------
+//  Drop publishing state of outputs of 'composite'
+
+static void
+s_server_drop_outputs (fty_metric_composite_server_t *self, composite_t *composite)
+{
+    auto it = self->outputs.find (composite);
+    if (it == self->outputs.end ())
+        return;
+    for (auto &output : it->second) {
+        for (auto &window : output.windows)
+            sliding_window_destroy (&window.window);
+    }
+    self->outputs.erase (it);
+}
+
+//  --------------------------------------------------------------------------
+//  Announce output 'topic' unavailable, unless it already was
+
+static void
+s_server_unavailable (fty_metric_composite_server_t *self, const std::string &topic)
+{
+    if (self->announced.insert (topic).second)
+        proto_metric_unavailable_send (self->unavailable, topic.c_str ());
+}
+
+//  --------------------------------------------------------------------------
+//  Forget 'composite' - it is about to be destroyed
+
+static void
+s_server_forget_composite (fty_metric_composite_server_t *self, composite_t *composite)
+{
+    topic_index_remove (self->index, composite);
+    timer_wheel_remove (self->wheel, composite);
+    self->deadlines.erase (composite);
+    timer_wheel_remove (self->cadence, composite);
+    self->dirty.erase (std::remove (self->dirty.begin (), self->dirty.end (), composite), self->dirty.end ());
+    s_server_drop_outputs (self, composite);
+    for (auto it = self->pending.begin (); it != self->pending.end (); ) {
+        if (it->second == composite)
+            it = self->pending.erase (it);
+        else
+            ++it;
+    }
+    for (const auto &topic : composite_output_topics (composite)) {
+        int id = topic_index_id (self->index, topic.c_str ());
+        if (id != -1 && topic_index_producer (self->index, id) == composite)
+            topic_index_set_producer (self->index, topic.c_str (), NULL);
+    }
+    self->levels.erase (composite);
+    self->relevel = true;
+}
+
+//  --------------------------------------------------------------------------
+//  Get name of composite loaded from 'filename' - its base name without .cfg
+
+static std::string
+s_composite_name (const char *filename)
+{
+    std::string composite_name = filename;
+    size_t slash = composite_name.rfind ('/');
+    if (slash != std::string::npos)
+        composite_name.erase (0, slash + 1);
+    if (composite_name.size () > 4 && composite_name.compare (composite_name.size () - 4, 4, ".cfg") == 0)
+        composite_name.erase (composite_name.size () - 4);
+    return composite_name;
+}
+
+//  --------------------------------------------------------------------------
+//  Get digest of content of config file 'filename', 0 if it can't be read
+
+static size_t
+s_config_digest (const char *filename)
+{
+    std::ifstream f (filename);
+    if (!f.good ())
+        return 0;
+    std::string content ((std::istreambuf_iterator <char> (f)), std::istreambuf_iterator <char> ());
+    return std::hash <std::string> () (content);
+}
+
+//  --------------------------------------------------------------------------
+//  Load composite from config file 'filename' and subscribe to its inputs.
+//  Composite is named after the file, already loaded composite with the same
+//  name is replaced.
+//  0 - success, -1 - error
+
+static int
+s_server_add_composite (fty_metric_composite_server_t *self, const char *filename)
+{
+    assert (self);
+    assert (filename);
+
+    std::string composite_name = s_composite_name (filename);
+    size_t digest = s_config_digest (filename);
+
+    if (self->verbose)
+        zsys_debug ("%s:\tOpening '%s'", self->name, filename);
+    // Evaluation context is built once here and reused for all incoming
+    // metrics until the composite is loaded again
+    composite_t *composite = composite_new (composite_name.c_str ());
+    if (composite_load (composite, filename) != 0) {
+        zsys_error ("%s:\tCannot load config file '%s'", self->name, filename);
+        composite_destroy (&composite);
+        return -1;
+    }
+    composite_t *&slot = self->composites [composite_name];
+    std::vector <time_t> valid_till;
+    if (slot) {
+        // reload - values of inputs which stay are kept, outputs which are
+        // gone won't come anymore (Lua outputs are not known yet)
+        composite_inherit (composite, slot, time (NULL), valid_till);
+        const std::vector <std::string> &topics = composite_output_topics (composite);
+        for (const auto &topic : composite_output_topics (slot)) {
+            if (self->phase >= 1 && !topics.empty ()
+            &&  std::find (topics.begin (), topics.end (), topic) == topics.end ())
+                s_server_unavailable (self, topic);
+        }
+        s_server_forget_composite (self, slot);
+    }
+    composite_destroy (&slot);
+    slot = composite;
+    self->files [composite_name] = filename;
+    self->digests [composite_name] = digest;
+    topic_index_add (self->index, composite);
+    self->relevel = true;
+    for (time_t when : valid_till)
+        s_server_arm (self, composite, when);
+    if (composite_changed (composite))
+        s_server_schedule (self, composite);
+    // output of built-in function is known right away, Lua one after the
+    // first evaluation
+    for (const auto &topic : composite_output_topics (composite))
+        s_server_set_producer (self, composite, topic.c_str ());
+    if (s_server_period (self, composite) > 0)
+        timer_wheel_add (self->cadence, time (NULL) + s_server_period (self, composite), composite);
+
+    // Each topic is subscribed just once for all composites, see
+    // s_server_subscribe
+    for (const auto &topic : composite_inputs (composite)) {
+        if (self->subscriptions.insert (topic).second)
+            self->unsubscribed.push_back (topic);
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Build consumer pattern matching exactly sorted 'topics' from 'first' up to
+//  'last' - one alternation of topics without their common prefix
+
+static std::string
+s_consumer_pattern (const std::vector <std::string> &topics, size_t first, size_t last)
+{
+    // common prefix of sorted chunk is the one of its first and last
+    // topic; every alternative keeps at least one character
+    size_t prefix = 0;
+    size_t shortest = topics [first].size ();
+    for (size_t i = first; i < last; i++)
+        shortest = std::min (shortest, topics [i].size ());
+    while (prefix + 1 < shortest && topics [first][prefix] == topics [last - 1][prefix])
+        prefix++;
+
+    std::string pattern = "^" + escape_regex (topics [first].substr (0, prefix));
+    if (last - first == 1)
+        pattern += escape_regex (topics [first].substr (prefix));
+    else {
+        pattern += "(";
+        for (size_t i = first; i < last; i++) {
+            if (i > first)
+                pattern += "|";
+            pattern += escape_regex (topics [i].substr (prefix));
+        }
+        pattern += ")";
+    }
+    pattern += "$";
+    return pattern;
+}
+
+//  --------------------------------------------------------------------------
+//  Can broker compile 'pattern'? It does so with zrex, pattern which does not
+//  compile there silently matches nothing.
+
+static bool
+s_consumer_pattern_valid (const std::string &pattern)
+{
+    zrex_t *rex = zrex_new (pattern.c_str ());
+    bool valid = rex && zrex_valid (rex);
+    zrex_destroy (&rex);
+    return valid;
+}
+
+//  --------------------------------------------------------------------------
+//  Compile 'topics' into few consumer patterns matching exactly them -
+//  sorted topics are split to chunks of at most PATTERN_TOPICS topics and
+//  about PATTERN_SIZE characters, chunk whose pattern zrex does not compile
+//  is cut down, to single topic at worst
+
+static void
+s_consumer_patterns (std::vector <std::string> topics, std::vector <std::string> &patterns)
+{
+    std::sort (topics.begin (), topics.end ());
+    topics.erase (std::unique (topics.begin (), topics.end ()), topics.end ());
+    size_t first = 0;
+    while (first < topics.size ()) {
+        size_t last = first + 1;
+        size_t size = topics [first].size ();
+        while (last < topics.size () && last - first < PATTERN_TOPICS && size + topics [last].size () < PATTERN_SIZE) {
+            size += topics [last].size ();
+            last++;
+        }
+        std::string pattern = s_consumer_pattern (topics, first, last);
+        while (last - first > 1 && !s_consumer_pattern_valid (pattern)) {
+            last--;
+            pattern = s_consumer_pattern (topics, first, last);
+        }
+        if (!s_consumer_pattern_valid (pattern))
+            zsys_error ("Cannot compile consumer pattern '%s' of topic '%s'", pattern.c_str (), topics [first].c_str ());
+        patterns.push_back (pattern);
+        first = last;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Subscribe input topics which are not subscribed yet
+
+static void
+s_server_subscribe (fty_metric_composite_server_t *self)
+{
+    if (self->unsubscribed.empty ())
+        return;
+    std::vector <std::string> patterns;
+    s_consumer_patterns (self->unsubscribed, patterns);
+    if (self->receiver) {
+        // receiving stage learns ids of topics before they may arrive
+        zmsg_t *topics = zmsg_new ();
+        zmsg_addstr (topics, "TOPICS");
+        for (const auto &topic : self->unsubscribed) {
+            zmsg_addstrf (topics, "%d", topic_index_id (self->index, topic.c_str ()));
+            zmsg_addstr (topics, topic.c_str ());
+        }
+        zmsg_send (&topics, self->receiver);
+        zmsg_t *subscribe = zmsg_new ();
+        zmsg_addstr (subscribe, "SUBSCRIBE");
+        for (const auto &pattern : patterns)
+            zmsg_addstr (subscribe, pattern.c_str ());
+        zmsg_send (&subscribe, self->receiver);
+    }
+    for (const auto &pattern : patterns) {
+        if (!self->receiver)
+            mlm_client_set_consumer (self->client, "_METRICS_SENSOR", pattern.c_str ());
+        if (self->verbose)
+            zsys_debug ("%s: Registered to receive '%s' from stream '%s'", self->name, pattern.c_str (), "_METRICS_SENSOR");
+    }
+    zsys_info ("%s:\t%d input topics subscribed with %d patterns",
+            self->name, (int) self->unsubscribed.size (), (int) patterns.size ());
+    self->unsubscribed.clear ();
+}
+
+//  --------------------------------------------------------------------------
+//  Remove composite 'composite_name'. Broker subscriptions are kept, values
+//  of topics nobody depends on are dropped when they arrive.
+//  0 - success, -1 - composite not known
+
+static int
+s_server_remove_composite (fty_metric_composite_server_t *self, const char *composite_name)
+{
+    assert (self);
+    assert (composite_name);
+
+    auto it = self->composites.find (composite_name);
+    if (it == self->composites.end ()) {
+        zsys_error ("%s:\tComposite '%s' is not loaded", self->name, composite_name);
+        return -1;
+    }
+    self->files.erase (composite_name);
+    self->digests.erase (composite_name);
+    s_server_forget_composite (self, it->second);
+    composite_destroy (&it->second);
+    self->composites.erase (it);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  List every *.cfg file in top level of 'path' directory to 'filenames'
+//  0 - success, -1 - directory cannot be read
+
+static int
+s_server_list_directory (fty_metric_composite_server_t *self, const char *path, std::vector <std::string> &filenames)
+{
+    zdir_t *dir = zdir_new (path, "-");
+    if (!dir) {
+        zsys_error ("%s:\tzdir_new (path = '%s', parent = '-') failed.", self->name, path);
+        return -1;
+    }
+    zlist_t *files = zdir_list (dir);
+    if (!files) {
+        zsys_error ("%s:\tzdir_list () failed.", self->name);
+        zdir_destroy (&dir);
+        return -1;
+    }
+
+    std::regex file_rex (".+\\.cfg");
+    zfile_t *item = (zfile_t *) zlist_first (files);
+    while (item) {
+        if (std::regex_match (zfile_filename (item, path), file_rex))
+            filenames.push_back (zfile_filename (item, NULL));
+        item = (zfile_t *) zlist_next (files);
+    }
+    zlist_destroy (&files);
+    zdir_destroy (&dir);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Load every *.cfg file in top level of 'path' directory.
+//  Files which cannot be loaded are skipped.
+//  Returns number of loaded composites or -1 if directory cannot be read
+
+static int
+s_server_add_directory (fty_metric_composite_server_t *self, const char *path)
+{
+    assert (self);
+    assert (path);
+
+    std::vector <std::string> filenames;
+    if (s_server_list_directory (self, path, filenames) != 0)
+        return -1;
+    int count = 0;
+    for (const auto &filename : filenames) {
+        if (s_server_add_composite (self, filename.c_str ()) == 0)
+            count++;
+    }
+    zsys_info ("%s:\t%d composites loaded from '%s'", self->name, count, path);
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Load config files of composites again, the ones which changed since they
+//  were loaded and in engine mode new ones in the directory, removing
+//  composites whose file is gone
+
+static void
+s_server_reload (fty_metric_composite_server_t *self)
+{
+    std::vector <std::string> gone;
+    for (const auto &it : self->files) {
+        if (!zsys_file_exists (it.second.c_str ()))
+            gone.push_back (it.first);
+    }
+    for (const auto &composite_name : gone) {
+        if (self->phase >= 1) {
+            for (const auto &topic : composite_output_topics (self->composites [composite_name]))
+                s_server_unavailable (self, topic);
+        }
+        s_server_remove_composite (self, composite_name.c_str ());
+    }
+    // composites loaded by CONFIG from elsewhere are reloaded too
+    std::set <std::string> filenames;
+    for (const auto &it : self->files)
+        filenames.insert (it.second);
+    if (!self->directory.empty ()) {
+        std::vector <std::string> listed;
+        s_server_list_directory (self, self->directory.c_str (), listed);
+        filenames.insert (listed.begin (), listed.end ());
+    }
+    int loaded = 0;
+    for (const auto &filename : filenames) {
+        // unchanged composite keeps its state, sliding windows included
+        auto digest = self->digests.find (s_composite_name (filename.c_str ()));
+        if (digest != self->digests.end () && digest->second == s_config_digest (filename.c_str ()))
+            continue;
+        if (s_server_add_composite (self, filename.c_str ()) == 0)
+            loaded++;
+    }
+    zsys_info ("%s:\tReloaded, %d composites removed, %d loaded, %d kept",
+            self->name, (int) gone.size (), loaded, (int) (self->composites.size () - loaded));
+}
+
+//  --------------------------------------------------------------------------
+//  Hand 'output' of 'composite' over to composites of this process which
+//  depend on it and schedule their evaluation
+
+static void
+s_server_feed (fty_metric_composite_server_t *self, composite_t *composite, const composite_output_t &output)
+{
+    int id = topic_index_id (self->index, output.topic.c_str ());
+    if (id == -1 || topic_index_dependents (self->index, id).empty ())
+        return;
+    s_server_set_producer (self, composite, output.topic.c_str ());
+    if (topic_index_producer (self->index, id) != composite)
+        return;
+    int level = s_server_level (self, composite);
+    time_t valid_till = output.time + TTL;
+    for (const topic_dependent_t &dependent : topic_index_dependents (self->index, id)) {
+        // edge closing a cycle
+        if (s_server_level (self, dependent.composite) <= level)
+            continue;
+        if (composite_update_slot_partial (dependent.composite, dependent.slot, output, valid_till) != 0)
+            continue;
+        s_server_arm (self, dependent.composite, valid_till);
+        if (s_server_period (self, dependent.composite) == 0)
+            s_server_schedule (self, dependent.composite);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Publish 'number' as metric 'topic' measured at 'time' on METRICS stream,
+//  through template 'tmpl' which is (re)built when topic or unit changes
+
+static void
+s_server_publish (fty_metric_composite_server_t *self, proto_metric_template_t &tmpl,
+        const std::string &topic, const std::string &unit, double number, time_t time)
+{
+    char value [VALUE_CODEC_BUFFER_SIZE];
+    value_codec_format (number, self->precision, value, sizeof (value));
+    zmsg_t *z_met = NULL;
+    if (proto_metric_wire_enabled (self->wire)) {
+        // template is built on first publish and when Lua changes the output
+        if (tmpl.topic != topic || tmpl.unit != unit) {
+            if (proto_metric_wire_template (self->wire, topic.c_str (), unit.c_str (), TTL, tmpl) != 0)
+                tmpl.topic.clear ();
+        }
+        if (!tmpl.topic.empty ())
+            z_met = proto_metric_wire_encode (self->wire, tmpl, time, value);
+    }
+    if (!z_met) {
+        fty_proto_t *n_met = fty_proto_new (FTY_PROTO_METRIC);
+        if (self->verbose)
+            zsys_debug ("Creating new bios proto message");
+        size_t at = topic.rfind ('@');
+        fty_proto_set_name (n_met, "%s", topic.c_str () + at + 1);
+        fty_proto_set_type (n_met, "%s", topic.substr (0, at).c_str ());
+        fty_proto_set_value (n_met, "%s", value);
+        fty_proto_set_unit (n_met, "%s", unit.c_str ());
+        fty_proto_set_ttl (n_met, TTL);
+        fty_proto_set_time (n_met, time);
+        z_met = fty_proto_encode (&n_met);
+    }
+    self->stats.published++;
+    int rv = mlm_client_send (self->client, topic.c_str (), &z_met);
+    if (rv != 0) {
+        zsys_error ("mlm_client_send () failed.");
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get topic of 'aggregate' over window of 'length' seconds of 'topic',
+//  i.e. 'average.temperature_arithmetic_mean_15m@rack'
+
+static std::string
+s_window_topic (const std::string &topic, const char *aggregate, int length)
+{
+    char suffix [64];
+    if (length % 3600 == 0)
+        snprintf (suffix, sizeof (suffix), "_%s_%dh", aggregate, length / 3600);
+    else
+    if (length % 60 == 0)
+        snprintf (suffix, sizeof (suffix), "_%s_%dm", aggregate, length / 60);
+    else
+        snprintf (suffix, sizeof (suffix), "_%s_%ds", aggregate, length);
+    size_t at = topic.rfind ('@');
+    return topic.substr (0, at) + suffix + topic.substr (at);
+}
+
+//  --------------------------------------------------------------------------
+//  Make 'state' belong to output 'topic' of 'composite', with empty sliding
+//  windows
+
+static void
+s_server_output_reset (server_output_t &state, composite_t *composite, const std::string &topic)
+{
+    for (auto &window : state.windows)
+        sliding_window_destroy (&window.window);
+    state.windows.clear ();
+    state.topic = topic;
+    for (int length : composite_windows (composite)) {
+        server_window_t window;
+        window.window = sliding_window_new (length, composite_window_samples (composite));
+        for (int i = 0; i < WINDOW_AGGREGATES; i++)
+            window.topics [i] = s_window_topic (topic, s_window_aggregates [i], length);
+        state.windows.push_back (window);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Feed 'outputs' of 'composite' evaluated at 'now' to composites depending
+//  on them and to their sliding windows and publish them on METRICS stream,
+//  all at time of their newest input
+
+static void
+s_server_emit (fty_metric_composite_server_t *self, composite_t *composite,
+        std::vector <composite_output_t> &outputs, time_t now)
+{
+    if (composite_reused (composite))
+        self->stats.skipped++;
+    else
+        self->stats.evaluated++;
+    std::vector <server_output_t> &states = self->outputs [composite];
+    if (states.size () < outputs.size ())
+        states.resize (outputs.size ());
+    for (size_t i = 0; i < outputs.size (); i++) {
+        composite_output_t &output = outputs [i];
+        server_output_t &state = states [i];
+        // available again, next loss is news
+        if (!self->announced.empty ())
+            self->announced.erase (output.topic);
+        // Lua may change its outputs, windows then start over
+        if (state.topic != output.topic)
+            s_server_output_reset (state, composite, output.topic);
+        // constant Lua output depends on no reading
+        if (output.time == 0)
+            output.time = now;
+        s_server_feed (self, composite, output);
+        for (auto &window : state.windows)
+            sliding_window_add (window.window, output.time, output.value);
+        // consumers must hear about the metric again before its TTL runs out
+        if (!composite_should_publish (composite, output, now, TTL / 2))
+            continue;
+
+        s_server_publish (self, state.tmpl, output.topic, output.unit, output.value, output.time);
+        for (auto &window : state.windows) {
+            sliding_window_result_t result;
+            if (sliding_window_aggregate (window.window, output.time, result) != 0)
+                continue;
+            const double values [WINDOW_AGGREGATES] = { result.mean, result.min, result.max };
+            for (int j = 0; j < WINDOW_AGGREGATES; j++)
+                s_server_publish (self, window.templates [j], window.topics [j], output.unit, values [j], output.time);
+        }
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate composite and emit its outputs. Outputs of the evaluation are
+//  left in self->results.
+//  0 - evaluated, -1 - composite cannot be evaluated
+
+static int
+s_server_evaluate (fty_metric_composite_server_t *self, composite_t *composite, time_t now)
+{
+    std::vector <composite_output_t> &outputs = self->results;
+    if (composite_evaluate_all (composite, now, outputs) != 0)
+        return -1;
+    s_server_emit (self, composite, outputs, now);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate composite of server_job_t 'item' on worker thread
+
+static void
+s_server_job (void *item, void *args)
+{
+    server_job_t *job = (server_job_t *) item;
+    job->rv = composite_evaluate_all (job->composite, job->now, job->outputs);
+}
+
+//  --------------------------------------------------------------------------
+//  Re-evaluate composites whose inputs expired till 'now'
+
+static void
+s_server_expire (fty_metric_composite_server_t *self, time_t now)
+{
+    self->due.clear ();
+    if (timer_wheel_expire (self->wheel, now, self->due) == 0)
+        return;
+    // their only entries in the wheel fired
+    for (void *item : self->due)
+        self->deadlines.erase ((composite_t *) item);
+    for (void *item : self->due) {
+        composite_t *composite = (composite_t *) item;
+        // next entry is for the input which expires first now
+        size_t expired = composite_expire (composite, now);
+        time_t next = composite_next_expiry (composite);
+        if (next != -1)
+            s_server_arm (self, composite, next);
+        // input was updated since
+        if (expired == 0)
+            continue;
+        if (self->verbose)
+            zsys_debug ("%s:\tInput of '%s' expired", self->name, composite_name (composite));
+        s_server_evaluate (self, composite, now);
+        if (self->phase < 1)
+            continue;
+        // outputs which could not be evaluated anymore
+        for (const auto &topic : composite_output_topics (composite)) {
+            bool evaluated = false;
+            for (const auto &output : self->results)
+                evaluated = evaluated || output.topic == topic;
+            if (!evaluated)
+                s_server_unavailable (self, topic);
+        }
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate periodic composites whose tick came till 'now' and changed since
+//  the previous one
+
+static void
+s_server_tick (fty_metric_composite_server_t *self, time_t now)
+{
+    self->due.clear ();
+    if (timer_wheel_expire (self->cadence, now, self->due) == 0)
+        return;
+    for (void *item : self->due) {
+        composite_t *composite = (composite_t *) item;
+        int period = s_server_period (self, composite);
+        if (period == 0)
+            continue;
+        timer_wheel_add (self->cadence, now + period, composite);
+        if (composite_changed (composite))
+            s_server_schedule (self, composite);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate dirty composites once coalescing delay runs out
+
+static void
+s_server_flush (fty_metric_composite_server_t *self)
+{
+    if (self->flush_at == -1 || zclock_mono () < self->flush_at)
+        return;
+    for (composite_t *composite : self->dirty) {
+        // might have been evaluated on expiry meanwhile
+        if (composite_changed (composite))
+            s_server_schedule (self, composite);
+    }
+    self->dirty.clear ();
+    self->flush_at = -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate scheduled composites, producers before consumers
+
+static void
+s_server_evaluate_pending (fty_metric_composite_server_t *self, time_t now)
+{
+    while (!self->pending.empty ()) {
+        if (!self->pool) {
+            composite_t *composite = self->pending.begin ()->second;
+            self->pending.erase (self->pending.begin ());
+            s_server_evaluate (self, composite, now);
+            continue;
+        }
+        // whole level at once, emitting feeds only higher levels
+        int level = self->pending.begin ()->first;
+        size_t count = 0;
+        for (auto it = self->pending.begin (); it != self->pending.end () && it->first == level; ++it)
+            count++;
+        if (self->jobs.size () < count)
+            self->jobs.resize (count);
+        self->items.clear ();
+        for (size_t i = 0; i < count; i++) {
+            self->jobs [i].composite = self->pending.begin ()->second;
+            self->jobs [i].now = now;
+            self->pending.erase (self->pending.begin ());
+            self->items.push_back (&self->jobs [i]);
+        }
+        worker_pool_run (self->pool, self->items, s_server_job, NULL);
+        for (size_t i = 0; i < count; i++) {
+            if (self->jobs [i].rv == 0)
+                s_server_emit (self, self->jobs [i].composite, self->jobs [i].outputs, now);
+        }
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get zpoller timeout till the next input expiry, periodic evaluation or end
+//  of coalescing,
+//  -1 if none is pending
+
+static int
+s_server_timeout (fty_metric_composite_server_t *self)
+{
+    int64_t timeout = -1;
+    time_t next = timer_wheel_next (self->wheel);
+    time_t tick = timer_wheel_next (self->cadence);
+    if (next == -1 || (tick != -1 && tick < next))
+        next = tick;
+    if (next != -1)
+        timeout = std::max ((int64_t) next * 1000 - zclock_time (), (int64_t) 0);
+    if (self->flush_at != -1) {
+        int64_t flush = std::max (self->flush_at - zclock_mono (), (int64_t) 0);
+        if (timeout == -1 || flush < timeout)
+            timeout = flush;
+    }
+    // records left behind by the last drain
+    if (self->queue && metric_queue_depth (self->queue) > 0)
+        timeout = 0;
+    // far expiry (large ttl) would overflow, poller is woken up earlier then
+    return (int) std::min (timeout, (int64_t) INT_MAX);
+}
+
+//  Receiving stage, started by CONNECT
+static void
+    s_receiver (zsock_t *pipe, void *args);
+
+//  --------------------------------------------------------------------------
+//  Handle actor command, replies go to 'pipe'
+//  Returns -1 when actor should terminate, 0 otherwise
+
+static int
+s_server_handle_pipe (fty_metric_composite_server_t *self, zsock_t *pipe, zmsg_t **msg_p)
+{
+    zmsg_t *msg = *msg_p;
+    char *cmd = zmsg_popstr (msg);
+    int rv = 0;
+    if (self->verbose) {
+        zsys_debug ("actor command=%s", cmd);
+    }
+
+    if (streq (cmd, "$TERM")) {
+        zsys_info ("Got $TERM");
+        rv = -1;
+    }
+    else
+    if (streq (cmd, "VERBOSE")) {
+        self->verbose = true;
+        zsys_error ("VERBOSE VERBOSE VERBOSE");
+    }
+    else
+    if (streq (cmd, "CONNECT")) {
+        char* endpoint = zmsg_popstr (msg);
+        mlm_client_connect (self->client, endpoint, 1000, self->name);
+        int r = mlm_client_set_producer (self->client, "METRICS");
+        if (r == -1) {
+            zsys_error ("mlm_client_set_producer () failed.");
+        }
+        std::string unavailable_name = std::string (self->name) + "-unavailable";
+        mlm_client_connect (self->unavailable, endpoint, 1000, unavailable_name.c_str ());
+        r = mlm_client_set_producer (self->unavailable, "_METRICS_UNAVAILABLE");
+        if (r == -1) {
+            zsys_error ("mlm_client_set_producer () failed.");
+        }
+        if (self->pipeline > 0 && !self->receiver) {
+            server_receiver_args_t receiver_args;
+            receiver_args.name = std::string (self->name) + "-receiver";
+            receiver_args.endpoint = endpoint;
+            receiver_args.queue = self->queue = metric_queue_new (self->pipeline);
+            self->receiver = zactor_new (s_receiver, &receiver_args);
+        }
+        zstr_free (&endpoint);
+        self->phase = 1;
+    }
+    else
+    if (streq (cmd, "CONFIG")) {
+        if (self->phase < 1) {
+            zsys_error ("CONFIG before CONNECT");
+        }
+        else {
+            char* filename = zmsg_popstr (msg);
+            if (s_server_add_composite (self, filename) != 0)
+                rv = -1; // if we cannot load config file -> just exit!
+            else
+                self->phase = 2;
+            zstr_free (&filename);
+        }
+    }
+    else
+    if (streq (cmd, "CFG_DIRECTORY")) {
+        if (self->phase < 1) {
+            zsys_error ("CFG_DIRECTORY before CONNECT");
+        }
+        else {
+            char* path = zmsg_popstr (msg);
+            if (s_server_add_directory (self, path) == -1)
+                rv = -1; // if we cannot read config directory -> just exit!
+            else {
+                self->directory = path;
+                self->phase = 2;
+            }
+            zstr_free (&path);
+        }
+    }
+    else
+    if (streq (cmd, "REMOVE")) {
+        char *composite_name = zmsg_popstr (msg);
+        if (composite_name)
+            s_server_remove_composite (self, composite_name);
+        zstr_free (&composite_name);
+    }
+    else
+    if (streq (cmd, "RELOAD")) {
+        if (self->phase < 2)
+            zsys_error ("%s:\tRELOAD before CONFIG or CFG_DIRECTORY", self->name);
+        else
+            s_server_reload (self);
+    }
+    else
+    if (streq (cmd, "PERIOD")) {
+        char *period = zmsg_popstr (msg);
+        if (period && atoi (period) >= 0) {
+            self->period = atoi (period);
+            // reschedule everything according to the new default
+            time_t now = time (NULL);
+            for (const auto &it : self->composites) {
+                timer_wheel_remove (self->cadence, it.second);
+                if (s_server_period (self, it.second) > 0)
+                    timer_wheel_add (self->cadence, now + s_server_period (self, it.second), it.second);
+            }
+        }
+        else
+            zsys_error ("%s:\tPERIOD without valid period", self->name);
+        zstr_free (&period);
+    }
+    else
+    if (streq (cmd, "PRECISION")) {
+        char *precision = zmsg_popstr (msg);
+        if (precision && atoi (precision) >= 0 && atoi (precision) <= VALUE_CODEC_MAX_PRECISION)
+            self->precision = atoi (precision);
+        else
+            zsys_error ("%s:\tPRECISION without valid number of decimal places", self->name);
+        zstr_free (&precision);
+    }
+    else
+    if (streq (cmd, "COALESCE")) {
+        char *delay = zmsg_popstr (msg);
+        if (delay) {
+            self->coalesce = atoll (delay);
+            if (self->coalesce < 0) {
+                self->coalesce = -1;
+                // don't keep already collected burst waiting
+                if (self->flush_at != -1)
+                    self->flush_at = zclock_mono ();
+            }
+        }
+        else
+            zsys_error ("%s:\tCOALESCE without delay", self->name);
+        zstr_free (&delay);
+    }
+    else
+    if (streq (cmd, "PIPELINE")) {
+        char *capacity = zmsg_popstr (msg);
+        if (self->phase > 0)
+            zsys_error ("%s:\tPIPELINE after CONNECT", self->name);
+        else
+        if (capacity && atoi (capacity) >= 0)
+            self->pipeline = atoi (capacity);
+        else
+            zsys_error ("%s:\tPIPELINE without capacity", self->name);
+        zstr_free (&capacity);
+    }
+    else
+    if (streq (cmd, "WORKERS")) {
+        char *workers = zmsg_popstr (msg);
+        if (workers && atoi (workers) >= 0) {
+            worker_pool_destroy (&self->pool);
+            if (atoi (workers) > 0)
+                self->pool = worker_pool_new (atoi (workers));
+        }
+        else
+            zsys_error ("%s:\tWORKERS without count", self->name);
+        zstr_free (&workers);
+    }
+    else
+    if (streq (cmd, "STATS")) {
+        size_t lua_in_use = 0, lua_reserved = 0;
+        uint64_t lua_mallocs = 0;
+        for (const auto &it : self->composites) {
+            size_t in_use, reserved;
+            uint64_t mallocs;
+            composite_memory (it.second, in_use, reserved, mallocs);
+            lua_in_use += in_use;
+            lua_reserved += reserved;
+            lua_mallocs += mallocs;
+        }
+        zmsg_t *reply = zmsg_new ();
+        const struct {
+            const char *name;
+            uint64_t value;
+        } counters [] = {
+            { "received",       self->stats.received },
+            { "out_of_order",   self->stats.out_of_order },
+            { "evaluated",      self->stats.evaluated },
+            { "skipped",        self->stats.skipped },
+            { "published",      self->stats.published },
+            { "queue_depth",    self->queue ? metric_queue_depth (self->queue) : 0 },
+            { "queue_max_depth", self->queue ? metric_queue_max_depth (self->queue) : 0 },
+            { "queue_coalesced", self->queue ? metric_queue_coalesced (self->queue) : 0 },
+            { "lua_in_use",     lua_in_use },
+            { "lua_reserved",   lua_reserved },
+            { "lua_mallocs",    lua_mallocs }
+        };
+        for (const auto &counter : counters) {
+            zmsg_addstr (reply, counter.name);
+            zmsg_addstrf (reply, "%llu", (unsigned long long) counter.value);
+        }
+        zmsg_send (&reply, pipe);
+    }
+    else {
+        zsys_error ("%s:\tUnknown actor command '%s'", self->name, cmd);
+    }
+    // inputs of everything loaded by the command at once
+    s_server_subscribe (self);
+    zstr_free (&cmd);
+    zmsg_destroy (msg_p);
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Decode metric 'msg' with 'topic' by 'wire', or by full decoder when it
+//  is anything unusual. Message is destroyed.
+//  0 - success, -1 - not a metric or value is not a number (already logged)
+
+static int
+s_decode_metric (proto_metric_wire_t *wire, const char *name, const char *topic, zmsg_t **msg_p,
+        double &value, uint32_t &ttl, uint64_t &timestamp)
+{
+    proto_metric_fields_t fields;
+    if (proto_metric_wire_decode (wire, *msg_p, fields) == 0) {
+        zmsg_destroy (msg_p);
+        if (value_codec_parse (fields.value, value) != 0) {
+            zsys_warning ("%s: value '%s' of '%s' is not a number, ignored", name, fields.value, topic);
+            return -1;
+        }
+        ttl = fields.ttl;
+        timestamp = fields.time;
+        return 0;
+    }
+    fty_proto_t *yn = fty_proto_decode (msg_p);
+    if (yn == NULL)
+        return -1;
+    if (value_codec_parse (fty_proto_value (yn), value) != 0) {
+        zsys_warning ("%s: value '%s' of '%s' is not a number, ignored", name, fty_proto_value (yn), topic);
+        fty_proto_destroy (&yn);
+        return -1;
+    }
+    ttl = fty_proto_ttl (yn);
+    timestamp = fty_proto_time (yn);
+    fty_proto_destroy (&yn);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Update composites depending on a metric with 'value'. They are scheduled
+//  for evaluation, or only marked dirty when coalescing. Readings delayed
+//  behind newer ones are dropped.
+
+static void
+s_server_route (fty_metric_composite_server_t *self, const std::vector <topic_dependent_t> &dependents,
+        double value, uint64_t timestamp, uint32_t ttl)
+{
+    for (const topic_dependent_t &dependent : dependents) {
+        // periodic composites wait for their tick
+        bool periodic = s_server_period (self, dependent.composite) > 0;
+        bool changed = composite_changed (dependent.composite);
+        if (composite_update_slot (dependent.composite, dependent.slot, value, timestamp, timestamp + ttl) != 0) {
+            self->stats.out_of_order++;
+            continue;
+        }
+        if (!periodic && self->coalesce >= 0 && !changed)
+            self->dirty.push_back (dependent.composite);
+        s_server_arm (self, dependent.composite, timestamp + ttl);
+        if (!periodic && self->coalesce < 0)
+            s_server_schedule (self, dependent.composite);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Receive one message from _METRICS_SENSOR stream and route it to
+//  composites depending on it
 
-static std::string
-escape_regex (const std::string &notregex)
+static void
+s_server_receive (fty_metric_composite_server_t *self)
 {
-    static const char *to_be_escaped = ".^$|()[]{}*+?\\";
-    std::string result;
+    zmsg_t *msg = mlm_client_recv (self->client);
+    if (self->verbose)
+        zsys_debug ("Got something not from the pipe");
+    if (msg == NULL)
+        return;
+    if (self->phase < 2) {
+        zsys_error ("DATA before CONFIG");
+        zmsg_destroy (&msg);
+        return;
+    }
+    if (self->verbose)
+        zsys_debug ("It is not null");
+    self->stats.received++;
 
-    for (char c: notregex) {
-        if (strchr (to_be_escaped,c)) {
-            result += '\\';
-        }
-        result += c;
+    // Exact match first, message nobody depends on is not even decoded
+    const char *topic = mlm_client_subject (self->client);
+    const std::vector <topic_dependent_t> *dependents = topic_index_lookup (self->index, topic);
+    if (!dependents || dependents->empty ()) {
+        zmsg_destroy (&msg);
+        return;
     }
-    return result;
+
+    double value;
+    uint32_t ttl;
+    uint64_t timestamp;
+    if (s_decode_metric (self->wire, self->name, topic, &msg, value, ttl, timestamp) != 0)
+        return;
+    if (self->verbose)
+        zsys_debug ("%s: Got message '%s' with value %lf", self->name, topic, value);
+    s_server_route (self, *dependents, value, timestamp, ttl);
 }
 
-void
-fty_metric_composite_server (zsock_t *pipe, void* args) {
-    static const uint64_t TTL = 5*60;
-    std::map<std::string, value> cache;
-    std::string lua_code;
-    bool verbose = false;
-    int phase = 0;
+//  --------------------------------------------------------------------------
+//  Handle message(s) from _METRICS_SENSOR stream
+
+static void
+s_server_handle_stream (fty_metric_composite_server_t *self)
+{
+    if (self->coalesce < 0) {
+        s_server_receive (self);
+        return;
+    }
+    if (self->flush_at == -1)
+        self->flush_at = zclock_mono () + self->coalesce;
+    // drain everything already queued, without blocking
+    zsock_t *msgpipe = mlm_client_msgpipe (self->client);
+    do {
+        s_server_receive (self);
+    } while ((zsock_events (msgpipe) & ZMQ_POLLIN) && zclock_mono () <= self->flush_at);
+}
 
-    char *name = strdup ((char*) args);
+//  --------------------------------------------------------------------------
+//  Receiving stage of pipelined server - has its own malamute client, keeps
+//  only topics the server sent it, decodes them and hands them over through
+//  'queue'. Sends DATA on its pipe when the server should drain the queue.
+//  Commands:
+//      TOPICS/id/topic/...     - topics to keep, with their interned ids
+//      SUBSCRIBE/pattern/...   - consumer patterns of _METRICS_SENSOR stream
 
+static void
+s_receiver (zsock_t *pipe, void *args)
+{
+    server_receiver_args_t *receiver_args = (server_receiver_args_t *) args;
+    std::string name = receiver_args->name;
+    metric_queue_t *queue = receiver_args->queue;
     mlm_client_t *client = mlm_client_new ();
-
+    mlm_client_connect (client, receiver_args->endpoint.c_str (), 1000, name.c_str ());
+    proto_metric_wire_t *wire = proto_metric_wire_new ();
+    // subject is looked up without allocation, own id leads to server one
+    topic_index_t *topics = topic_index_new ();
+    std::vector <uint32_t> ids;
     zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (client), NULL);
-
     zsock_signal (pipe, 0);
 
     while (!zsys_interrupted) {
-
-        void *which = zpoller_wait (poller, -1);
+        // records waiting in overflow are retried shortly
+        void *which = zpoller_wait (poller, metric_queue_backlog (queue) > 0 ? RECEIVER_RETRY : -1);
         if (which == pipe) {
             zmsg_t *msg = zmsg_recv (pipe);
             char *cmd = zmsg_popstr (msg);
-            if ( verbose ) {
-                zsys_debug ("actor command=%s", cmd);
-            }
-
-            if (streq (cmd, "$TERM")) {
-                zsys_info ("Got $TERM");
-                zstr_free (&cmd);
-                zmsg_destroy (&msg);
-                goto exit;
-            }
-            else
-            if (streq (cmd, "VERBOSE")) {
-                verbose = true;
-                zsys_error ("VERBOSE VERBOSE VERBOSE");
-                zmsg_destroy (&msg);
-            }
-            else
-            if (streq (cmd, "CONNECT")) {
-                char* endpoint = zmsg_popstr (msg);
-                mlm_client_connect(client, endpoint, 1000, name);
-                int rv = mlm_client_set_producer(client, "METRICS");
-                if (rv == -1) {
-                    zsys_error ("mlm_client_set_producer () failed.");
+            bool term = !cmd || streq (cmd, "$TERM");
+            if (cmd && streq (cmd, "TOPICS")) {
+                while (zmsg_size (msg) >= 2) {
+                    char *id = zmsg_popstr (msg);
+                    char *topic = zmsg_popstr (msg);
+                    size_t own = topic_index_intern (topics, topic);
+                    if (own >= ids.size ())
+                        ids.resize (own + 1);
+                    ids [own] = (uint32_t) atoi (id);
+                    zstr_free (&id);
+                    zstr_free (&topic);
                 }
-                zstr_free(&endpoint);
-                phase = 1;
             }
             else
-            if (streq (cmd, "CONFIG")) {
-                if(phase < 1) {
-                    zsys_error("CONFIG before CONNECT");
-                    continue;
-                }
-                char* filename = zmsg_popstr (msg);
-                if (verbose)
-                    zsys_debug ("%s:\tOpening '%s'", name, filename);
-                std::ifstream f(filename);
-                if ( !f.good() ) {
-                    zsys_error ("%s:\tCannot open config file '%s' correctly", name, filename);
-                    zstr_free (&filename);
-                    zstr_free (&cmd);
-                    zmsg_destroy (&msg);
-                    break; // if we cannot open config file -> just exit!
-                }
-                try {
-                    cxxtools::JsonDeserializer json(f);
-                    json.deserialize();
-                    const cxxtools::SerializationInfo *si = json.si();
-                    si->getMember("evaluation") >>= lua_code;
-
-                    // Subscribe to all streams, create expired values in cache
-                    value expired;
-                    expired.valid_till = 0;
-                    for(auto it : si->getMember("in")) {
-                        std::string buff;
-                        it >>= buff;
-                        cache[buff] = expired;
-                        buff = "^" + escape_regex (buff) + "$";
-                        mlm_client_set_consumer(client, "_METRICS_SENSOR", buff.c_str());
-                        if (verbose)
-                            zsys_debug("%s: Registered to receive '%s' from stream '%s'", name, buff.c_str(), "_METRICS_SENSOR");
-                    }
-                    zstr_free (&filename);
-                    phase = 2;
-                }
-                catch ( const std::exception &e ) {
-                    zsys_error ("Cannot deserialize cfg file! with '%s'", e.what());
-                    zstr_free (&filename);
-                    zstr_free (&cmd);
-                    zmsg_destroy (&msg);
-                    break; // if we cannot load config file -> just exit!
+            if (cmd && streq (cmd, "SUBSCRIBE")) {
+                char *pattern;
+                while ((pattern = zmsg_popstr (msg)) != NULL) {
+                    mlm_client_set_consumer (client, "_METRICS_SENSOR", pattern);
+                    zstr_free (&pattern);
                 }
             }
             zstr_free (&cmd);
             zmsg_destroy (&msg);
-            continue;
+            if (term)
+                break;
         }
-
-        if(phase < 2) {
-            zsys_error("DATA before CONFIG");
-            continue;
+        else
+        if (which == mlm_client_msgpipe (client)) {
+            zmsg_t *msg = mlm_client_recv (client);
+            if (!msg)
+                continue;
+            const char *topic = mlm_client_subject (client);
+            int own = topic_index_id (topics, topic);
+            if (own == -1) {
+                zmsg_destroy (&msg);
+                continue;
+            }
+            metric_record_t record;
+            record.id = ids [own];
+            if (s_decode_metric (wire, name.c_str (), topic, &msg, record.value, record.ttl, record.time) != 0)
+                continue;
+            if (metric_queue_push (queue, record))
+                zstr_send (pipe, "DATA");
         }
+        else
+        if (zpoller_terminated (poller))
+            break;
+        if (metric_queue_backlog (queue) > 0 && metric_queue_flush (queue))
+            zstr_send (pipe, "DATA");
+    }
 
-        // Get message
-        zmsg_t *msg = mlm_client_recv(client);
-        if(verbose)
-            zsys_debug("Got something not from the pipe");
-        if(msg == NULL)
-            continue;
-        if(verbose)
-            zsys_debug("It is not null");
-        fty_proto_t *yn = fty_proto_decode(&msg);
-        if(yn == NULL)
+    zpoller_destroy (&poller);
+    topic_index_destroy (&topics);
+    proto_metric_wire_destroy (&wire);
+    mlm_client_destroy (&client);
+}
+
+//  --------------------------------------------------------------------------
+//  Route records received by the receiving stage, at most one queue full
+//  at a time, so coalescing and timers are not starved
+
+static void
+s_server_drain (fty_metric_composite_server_t *self)
+{
+    if (self->coalesce >= 0 && self->flush_at == -1)
+        self->flush_at = zclock_mono () + self->coalesce;
+    metric_record_t record;
+    for (size_t i = 0; i < metric_queue_capacity (self->queue) && metric_queue_pop (self->queue, record); i++) {
+        self->stats.received++;
+        const std::vector <topic_dependent_t> &dependents = topic_index_dependents (self->index, record.id);
+        if (self->phase < 2 || dependents.empty ())
             continue;
-        if(verbose)
-            zsys_debug("And it is fty_proto_message");
-
-        // Update cache with updated values
-        std::string topic = mlm_client_subject(client);
-        value val;
-        val.value = atof(fty_proto_value(yn));
-        uint32_t ttl = fty_proto_ttl(yn);
-        uint64_t timestamp = fty_proto_time (yn);
-        val.valid_till = timestamp + ttl;
-        if (verbose)
-            zsys_debug ("%s: Got message '%s' with value %lf", name, topic.c_str(), val.value);
-        auto f = cache.find(topic);
-        if(f != cache.end()) {
-            f->second = val;
-        } else {
-            cache.insert(std::make_pair(topic, val));
-        }
-        fty_proto_destroy(&yn);
-
-        // Prepare data for computation
-#if LUA_VERSION_NUM > 501
-        lua_State *L = luaL_newstate();
-#else
-        lua_State *L = lua_open();
-#endif
-        luaL_openlibs(L);
-        lua_newtable(L);
-        time_t tme = time(NULL);
-        int error;
-        for(auto i : cache) {
-            if(tme > i.second.valid_till) {
-                // can't count average, missing measurements from sensor
-                continue;
-            }
-            if (verbose)
-                zsys_debug ("%s - %s, %f", name, i.first.c_str(), i.second.value);
-            lua_pushstring(L, i.first.c_str());
-            lua_pushnumber(L, i.second.value);
-            lua_settable(L, -3);
-        }
-        lua_setglobal(L, "mt");
-
-        // Do the real processing
-        error = luaL_loadbuffer(L, lua_code.c_str(), lua_code.length(), "line") ||
-            lua_pcall(L, 0, 3, 0);
-        if(error) {
-            zsys_error("%s", lua_tostring(L, -1));
-            goto next_iter;
-        }
-        if (verbose)
-            zsys_debug ("%s: Total: %d", name, lua_gettop(L));
-        if(lua_gettop(L) == 3) {
-            if(strrchr(lua_tostring(L, -3), '@') == NULL) {
-                zsys_error ("Invalid output topic");
-                goto next_iter;
-            }
-            fty_proto_t *n_met = fty_proto_new(FTY_PROTO_METRIC);
-            zsys_debug ("Creating new bios proto message");
-            char *buff = strdup(lua_tostring(L, -3));
-            fty_proto_set_name (n_met, "%s", strrchr(buff, '@') + 1);
-            (*strrchr(buff, '@')) = 0;
-            fty_proto_set_type(n_met, "%s", buff);
-            fty_proto_set_value(n_met, "%.2f", lua_tonumber(L, -2));
-            fty_proto_set_unit(n_met,  "%s", lua_tostring(L, -1));
-            fty_proto_set_ttl(n_met,  TTL);
-            zmsg_t* z_met = fty_proto_encode(&n_met);
-            int rv = mlm_client_send(client, lua_tostring(L, -3), &z_met);
-            if (rv != 0) {
-                zsys_error ("mlm_client_send () failed.");
+        s_server_route (self, dependents, record.value, record.time, record.ttl);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Composite metrics actor
+
+void
+fty_metric_composite_server (zsock_t *pipe, void* args)
+{
+    fty_metric_composite_server_t *self = s_server_new ((const char *) args);
+    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (self->client), NULL);
+
+    zsock_signal (pipe, 0);
+
+    bool polling_receiver = false;
+    while (!zsys_interrupted) {
+        void *which = zpoller_wait (poller, s_server_timeout (self));
+        if (which == pipe) {
+            zmsg_t *msg = zmsg_recv (pipe);
+            if (s_server_handle_pipe (self, pipe, &msg) == -1)
+                break;
+            if (self->receiver && !polling_receiver) {
+                zpoller_add (poller, self->receiver);
+                polling_receiver = true;
             }
-            free (buff);
-        } else {
-            zsys_error ("Not enough valid data...\n");
         }
-next_iter:
-        lua_close(L);
+        else
+        if (which == mlm_client_msgpipe (self->client)) {
+            s_server_handle_stream (self);
+        }
+        else
+        if (self->receiver && which == self->receiver) {
+            zmsg_t *msg = zmsg_recv (self->receiver);
+            zmsg_destroy (&msg);
+            s_server_drain (self);
+        }
+        else
+        if (zpoller_terminated (poller)) {
+            break;
+        }
+        else
+        if (self->queue && metric_queue_depth (self->queue) > 0) {
+            s_server_drain (self);
+        }
+        s_server_flush (self);
+        s_server_expire (self, time (NULL));
+        s_server_tick (self, time (NULL));
+        s_server_evaluate_pending (self, time (NULL));
     }
 
-exit:
-    free (name);
     zpoller_destroy (&poller);
-    mlm_client_destroy (&client);
+    s_server_destroy (&self);
 }
 
 //  ---------------------------------------------------------------------------
 //  Selftest
 
+//  Helper test function
+//  Write config file averaging 'inputs' into 'result_topic'
+
+static void
+test_write_average_config (const char *filename, const std::vector <std::string> &inputs, const char *result_topic)
+{
+    std::ofstream f (filename);
+    f << "{\n  \"in\": [";
+    for (size_t i = 0; i < inputs.size (); i++)
+        f << (i ? ", " : " ") << "\"" << inputs [i] << "\"";
+    f << " ],\n  \"evaluation\": \""
+      << "sum = 0; num = 0;"
+      << "for key,value in pairs(mt) do sum = sum + value; num = num + 1; end;"
+      << "if num == 0 then error('all sensors lost'); end;"
+      << "return '" << result_topic << "', sum / num, 'C', 0;\"\n}\n";
+    f.close ();
+}
+
 void
 fty_metric_composite_server_test (bool verbose)
 {
@@ -280,6 +1658,84 @@ fty_metric_composite_server_test (bool verbose)
         printf ("\n");
 
     //  @selftest
+    // consumer patterns - common prefix, one alternation per chunk
+    {
+        std::vector <std::string> patterns;
+        s_consumer_patterns ({"temperature.TH2@rack", "temperature.TH1@rack", "temperature.TH2@rack"}, patterns);
+        assert (patterns.size () == 1);
+        assert (patterns [0] == "^temperature\\.TH(1@rack|2@rack)$");
+        zrex_t *rex = zrex_new (patterns [0].c_str ());
+        assert (zrex_valid (rex));
+        assert (zrex_matches (rex, "temperature.TH1@rack"));
+        assert (!zrex_matches (rex, "temperature.TH1@rack2"));
+        assert (!zrex_matches (rex, "temperatureXTH1@rack"));
+        zrex_destroy (&rex);
+
+        patterns.clear ();
+        s_consumer_patterns ({"temperature@world"}, patterns);
+        assert (patterns.size () == 1);
+        assert (patterns [0] == "^temperature@world$");
+
+        // every pattern compiles with zrex, as broker does it, every topic
+        // is matched by exactly one of them - short topics and 64 long ones
+        const struct {
+            const char *format;
+            int count;
+        } chunks [] = {
+            { "humidity.TH%d@rack", 100 },
+            { "realpower.output.L1.consumption-%d@datacenter-room-1", 64 }
+        };
+        for (const auto &chunk : chunks) {
+            std::vector <std::string> topics;
+            for (int i = 0; i < chunk.count; i++) {
+                char topic [128];
+                snprintf (topic, sizeof (topic), chunk.format, i);
+                topics.push_back (topic);
+            }
+            patterns.clear ();
+            s_consumer_patterns (topics, patterns);
+            assert (patterns.size () > 1 && patterns.size () < topics.size ());
+            std::vector <zrex_t *> rexes;
+            for (const auto &pattern : patterns) {
+                rexes.push_back (zrex_new (pattern.c_str ()));
+                assert (zrex_valid (rexes.back ()));
+            }
+            for (const auto &topic : topics) {
+                int matched = 0;
+                for (zrex_t *rex : rexes)
+                    matched += zrex_matches (rex, topic.c_str ());
+                assert (matched == 1);
+                for (zrex_t *rex : rexes)
+                    assert (!zrex_matches (rex, (topic + "0").c_str ()));
+            }
+            for (zrex_t *rex : rexes)
+                zrex_destroy (&rex);
+        }
+    }
+
+    // expiry - steady stream of readings keeps one wheel entry per composite
+    {
+        fty_metric_composite_server_t *self = s_server_new ("composite-metrics-wheel");
+        assert (s_server_add_composite (self, "src/fty-metric-composite.cfg.example") == 0);
+        const char *topics [] = { "temperature@TH1", "temperature@TH2" };
+        time_t start = time (NULL);
+        for (int i = 0; i < 1000; i++) {
+            int id = topic_index_id (self->index, topics [i % 2]);
+            s_server_route (self, topic_index_dependents (self->index, id), 20, start + i, 300);
+            s_server_expire (self, start + i);
+            assert (timer_wheel_size (self->wheel) == 1);
+        }
+        // reading with short TTL moves the entry closer
+        int id = topic_index_id (self->index, "temperature@TH2");
+        s_server_route (self, topic_index_dependents (self->index, id), 20, start + 1000, 5);
+        assert (timer_wheel_size (self->wheel) == 1);
+        assert (timer_wheel_next (self->wheel) <= start + 1006);
+        // nothing is scheduled once all inputs expired
+        s_server_expire (self, start + 1300);
+        assert (timer_wheel_size (self->wheel) == 0);
+        s_server_destroy (&self);
+    }
+
     zactor_t *server = zactor_new (mlm_server, (void*) "Malamute");
     zstr_sendx (server, "BIND", endpoint, NULL);
 
@@ -347,7 +1803,574 @@ fty_metric_composite_server_test (bool verbose)
     assert (streq (fty_proto_value (m), "85.00"));     // <<< (100 + 70) / 2
     fty_proto_destroy (&m);
 
+    // delayed reading older than the cached one is dropped, output carries
+    // timestamp of the newest reading
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL) - 30, 60, "temperature", "TH2", "10", "C");
+    mlm_client_send (producer, "temperature@TH2", &msg_in);
+    time_t event = ::time (NULL) + 5;
+    msg_in = fty_proto_encode_metric(
+            NULL, event, 60, "temperature", "TH1", "80", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+
+    msg_out = mlm_client_recv (consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "90.00"));     // <<< (100 + 80) / 2
+    assert (fty_proto_time (m) == (uint64_t) event);
+    fty_proto_destroy (&m);
+
+    // repeated value is not evaluated nor published again
+    msg_in = fty_proto_encode_metric(
+            NULL, event + 1, 60, "temperature", "TH1", "80", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_in = fty_proto_encode_metric(
+            NULL, event + 2, 60, "temperature", "TH2", "60", "C");
+    mlm_client_send (producer, "temperature@TH2", &msg_in);
+
+    msg_out = mlm_client_recv (consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "70.00"));     // <<< (60 + 80) / 2
+    fty_proto_destroy (&m);
+
+    zstr_send (cm_server, "STATS");
+    zmsg_t *stats = zmsg_recv (cm_server);
+    assert (stats && zmsg_size (stats) == 22);
+    std::map <std::string, uint64_t> counters;
+    while (zmsg_size (stats) > 0) {
+        char *counter = zmsg_popstr (stats);
+        char *number = zmsg_popstr (stats);
+        counters [counter] = strtoull (number, NULL, 10);
+        zstr_free (&counter);
+        zstr_free (&number);
+    }
+    zmsg_destroy (&stats);
+    assert (counters ["received"] == 7);
+    assert (counters ["out_of_order"] == 1);
+    assert (counters ["skipped"] == 1);
+    assert (counters ["evaluated"] == 5);
+    assert (counters ["published"] == 5);
+    assert (counters ["lua_reserved"] >= counters ["lua_in_use"]);
+
+    zactor_destroy (&cm_server);
+
+    // pipeline - receiving stage hands metrics over through queue
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-pipeline");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "PIPELINE", "4", NULL);
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/fty-metric-composite.cfg.example", NULL);
+    zclock_sleep (500);
+    const char *pipeline_steps [][3] = {
+        { "TH1", "40", "40.00" },
+        { "TH2", "20", "30.00" }
+    };
+    for (const auto &step : pipeline_steps) {
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", step [0], step [1], "C");
+        std::string subject = std::string ("temperature@") + step [0];
+        mlm_client_send (producer, subject.c_str (), &msg_in);
+        msg_out = mlm_client_recv (consumer);
+        assert (streq (mlm_client_sender (consumer), "composite-metrics-pipeline"));
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        assert (streq (fty_proto_value (m), step [2]));
+        fty_proto_destroy (&m);
+    }
+    zstr_send (cm_server, "STATS");
+    stats = zmsg_recv (cm_server);
+    counters.clear ();
+    while (zmsg_size (stats) > 0) {
+        char *counter = zmsg_popstr (stats);
+        char *number = zmsg_popstr (stats);
+        counters [counter] = strtoull (number, NULL, 10);
+        zstr_free (&counter);
+        zstr_free (&number);
+    }
+    zmsg_destroy (&stats);
+    assert (counters ["received"] == 2);
+    assert (counters ["queue_depth"] == 0);
+    assert (counters ["queue_max_depth"] >= 1);
+    assert (counters ["queue_coalesced"] == 0);
+    zactor_destroy (&cm_server);
+
+    // coalescing - burst of metrics gives one output
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-coalesce");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/fty-metric-composite.cfg.example", NULL);
+    zstr_sendx (cm_server, "COALESCE", "500", NULL);
+    zclock_sleep (500);
+
+    const char *burst [][2] = {
+        { "TH1", "10" },
+        { "TH2", "20" },
+        { "TH1", "30" }
+    };
+    for (const auto &item : burst) {
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", item [0], item [1], "C");
+        std::string subject = std::string ("temperature@") + item [0];
+        mlm_client_send (producer, subject.c_str (), &msg_in);
+    }
+    msg_out = mlm_client_recv (consumer);
+    assert (streq (mlm_client_sender (consumer), "composite-metrics-coalesce"));
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "25.00"));    // <<< (30 + 20) / 2, nothing in between
+    fty_proto_destroy (&m);
+
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH2", "40", "C");
+    mlm_client_send (producer, "temperature@TH2", &msg_in);
+    msg_out = mlm_client_recv (consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "35.00"));    // <<< (30 + 40) / 2
+    fty_proto_destroy (&m);
+
+    zactor_destroy (&cm_server);
+
+    // fixed cadence - one output per period, none without change
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-period");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "PERIOD", "1", NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/fty-metric-composite.cfg.example", NULL);
+    zclock_sleep (500);
+
+    for (const auto &item : burst) {
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", item [0], item [1], "C");
+        std::string subject = std::string ("temperature@") + item [0];
+        mlm_client_send (producer, subject.c_str (), &msg_in);
+    }
+    // burst may rarely straddle a tick, then partial result comes first
+    for (int i = 0; ; i++) {
+        assert (i < 3);
+        msg_out = mlm_client_recv (consumer);
+        assert (streq (mlm_client_sender (consumer), "composite-metrics-period"));
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        bool complete = streq (fty_proto_value (m), "25.00");    // <<< (30 + 20) / 2
+        fty_proto_destroy (&m);
+        if (complete)
+            break;
+    }
+
+    // nothing changed - nothing published on next ticks
+    zpoller_t *poller = zpoller_new (mlm_client_msgpipe (consumer), NULL);
+    assert (zpoller_wait (poller, 2500) == NULL);
+    assert (zpoller_expired (poller));
+    zpoller_destroy (&poller);
+
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH2", "40", "C");
+    mlm_client_send (producer, "temperature@TH2", &msg_in);
+    msg_out = mlm_client_recv (consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "35.00"));    // <<< (30 + 40) / 2
+    fty_proto_destroy (&m);
+
+    zactor_destroy (&cm_server);
+
+    // engine mode - several composites in one actor sharing inputs
+    zsys_dir_create ("src/selftest-rw/engine");
+    test_write_average_config ("src/selftest-rw/engine/rack.cfg",
+            {"temperature@TH1", "temperature@TH2"}, "average.temperature@rack");
+    test_write_average_config ("src/selftest-rw/engine/row.cfg",
+            {"temperature@TH1", "temperature@TH3"}, "average.temperature@row");
+    test_write_average_config ("src/selftest-rw/engine/ignored.cfg.bak",
+            {"temperature@TH1"}, "average.temperature@ignored");
+
+    mlm_client_t *engine_consumer = mlm_client_new ();
+    mlm_client_connect (engine_consumer, endpoint, 1000, "engine-consumer");
+    mlm_client_set_consumer (engine_consumer, FTY_PROTO_STREAM_METRICS, ".*");
+
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-engine");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CFG_DIRECTORY", "src/selftest-rw/engine", NULL);
+    zclock_sleep (500);
+
+    // TH1 feeds both composites
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH1", "40", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    for (const char *expected_topic : {"average.temperature@rack", "average.temperature@row"}) {
+        msg_out = mlm_client_recv (engine_consumer);
+        assert (streq (mlm_client_sender (engine_consumer), "composite-metrics-engine"));
+        assert (streq (mlm_client_subject (engine_consumer), expected_topic));
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        assert (streq (fty_proto_value (m), "40.00"));
+        fty_proto_destroy (&m);
+    }
+
+    // TH3 feeds only the row
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH3", "20", "C");
+    mlm_client_send (producer, "temperature@TH3", &msg_in);
+    msg_out = mlm_client_recv (engine_consumer);
+    assert (streq (mlm_client_subject (engine_consumer), "average.temperature@row"));
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "30.00"));    // <<< (40 + 20) / 2
+    fty_proto_destroy (&m);
+
+    // removed row no longer reacts on TH1
+    zstr_sendx (cm_server, "REMOVE", "row", NULL);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH1", "60", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH3", "10", "C");
+    mlm_client_send (producer, "temperature@TH3", &msg_in);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH2", "80", "C");
+    mlm_client_send (producer, "temperature@TH2", &msg_in);
+    for (const char *expected_value : {"60.00", "70.00"}) {
+        msg_out = mlm_client_recv (engine_consumer);
+        assert (streq (mlm_client_subject (engine_consumer), "average.temperature@rack"));
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        assert (streq (fty_proto_value (m), expected_value));
+        fty_proto_destroy (&m);
+    }
+
+    // expired input re-publishes the rack without waiting for other data
+    mlm_client_t *unavailable_consumer = mlm_client_new ();
+    mlm_client_connect (unavailable_consumer, endpoint, 1000, "unavailable-consumer");
+    mlm_client_set_consumer (unavailable_consumer, "_METRICS_UNAVAILABLE", ".*");
+    zclock_sleep (100);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 1, "temperature", "TH2", "20", "C");
+    mlm_client_send (producer, "temperature@TH2", &msg_in);
+    for (const char *expected_value : {"40.00", "60.00"}) {        // <<< (60 + 20) / 2, then 60 / 1
+        msg_out = mlm_client_recv (engine_consumer);
+        assert (streq (mlm_client_subject (engine_consumer), "average.temperature@rack"));
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        assert (streq (fty_proto_value (m), expected_value));
+        fty_proto_destroy (&m);
+    }
+
+    // rack without any valid input is announced unavailable
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 1, "temperature", "TH1", "50", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_out = mlm_client_recv (engine_consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "50.00"));
+    fty_proto_destroy (&m);
+    msg_out = mlm_client_recv (unavailable_consumer);
+    assert (msg_out);
+    char *piece = zmsg_popstr (msg_out);
+    assert (streq (piece, "METRICUNAVAILABLE"));
+    zstr_free (&piece);
+    piece = zmsg_popstr (msg_out);
+    assert (streq (piece, "average.temperature@rack"));
+    zstr_free (&piece);
+    zmsg_destroy (&msg_out);
+    mlm_client_destroy (&unavailable_consumer);
+
+    // value which is not a number is dropped, configured precision is used
+    zstr_sendx (cm_server, "PRECISION", "1", NULL);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH1", "hot", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH1", "21.26", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_out = mlm_client_recv (engine_consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "21.3"));     // <<< no "0.0" before
+    fty_proto_destroy (&m);
+
+    zactor_destroy (&cm_server);
+    mlm_client_destroy (&engine_consumer);
+    zsys_file_delete ("src/selftest-rw/engine/rack.cfg");
+    zsys_file_delete ("src/selftest-rw/engine/row.cfg");
+    zsys_file_delete ("src/selftest-rw/engine/ignored.cfg.bak");
+    zsys_dir_delete ("src/selftest-rw/engine");
+
+    // evaluation graph - dc merges partials of rack with its own sensor
+    {
+        std::ofstream f ("src/selftest-rw/dag-rack.cfg");
+        f << "{ \"in\": [ \"temperature@TH1\", \"temperature@TH2\" ], \"function\": \"avg\", "
+          << "\"output\": \"average.temperature@dag-rack\", \"unit\": \"C\" }\n";
+    }
+    {
+        std::ofstream f ("src/selftest-rw/dag-dc.cfg");
+        f << "{ \"in\": [ \"average.temperature@dag-rack\", \"temperature@TH3\" ], \"function\": \"avg\", "
+          << "\"partials\": true, \"output\": \"average.temperature@dag-dc\", \"unit\": \"C\" }\n";
+    }
+    mlm_client_t *dag_consumer = mlm_client_new ();
+    mlm_client_connect (dag_consumer, endpoint, 1000, "dag-consumer");
+    mlm_client_set_consumer (dag_consumer, FTY_PROTO_STREAM_METRICS, "^average.temperature@dag-dc$");
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-dag");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    // consumer is loaded before its producer
+    zstr_sendx (cm_server, "CONFIG", "src/selftest-rw/dag-dc.cfg", NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/selftest-rw/dag-rack.cfg", NULL);
+    zclock_sleep (500);
+    const char *dag_steps [][3] = {
+        {"TH1", "10", "10.00"},
+        {"TH2", "20", "15.00"},
+        {"TH3", "40", "23.33"}         // <<< (10 + 20 + 40) / 3, not (15 + 40) / 2
+    };
+    for (const auto &step : dag_steps) {
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", step [0], step [1], "C");
+        std::string subject = std::string ("temperature@") + step [0];
+        mlm_client_send (producer, subject.c_str (), &msg_in);
+        msg_out = mlm_client_recv (dag_consumer);
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        assert (streq (fty_proto_value (m), step [2]));
+        fty_proto_destroy (&m);
+    }
+    zactor_destroy (&cm_server);
+    mlm_client_destroy (&dag_consumer);
+    zsys_file_delete ("src/selftest-rw/dag-rack.cfg");
+    zsys_file_delete ("src/selftest-rw/dag-dc.cfg");
+
+    // worker threads - one level of racks evaluated in parallel, dc after it
+    zsys_dir_create ("src/selftest-rw/parallel");
+    for (int i = 0; i < 16; i++) {
+        std::ofstream f ("src/selftest-rw/parallel/rack" + std::to_string (i) + ".cfg");
+        f << "{ \"in\": [ \"temperature@PAR\", \"temperature@PAR" << i << "\" ], \"function\": \"avg\", "
+          << "\"output\": \"average.temperature@par" << i << "\", \"unit\": \"C\" }\n";
+    }
+    {
+        std::ofstream f ("src/selftest-rw/parallel/dc.cfg");
+        f << "{ \"in\": [ ";
+        for (int i = 0; i < 16; i++)
+            f << (i ? ", " : "") << "\"average.temperature@par" << i << "\"";
+        f << " ], \"function\": \"avg\", \"partials\": true, "
+          << "\"output\": \"average.temperature@par-dc\", \"unit\": \"C\" }\n";
+    }
+    mlm_client_t *par_consumer = mlm_client_new ();
+    mlm_client_connect (par_consumer, endpoint, 1000, "par-consumer");
+    mlm_client_set_consumer (par_consumer, FTY_PROTO_STREAM_METRICS, "^average.temperature@par-dc$");
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-parallel");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "WORKERS", "4", NULL);
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CFG_DIRECTORY", "src/selftest-rw/parallel", NULL);
+    zclock_sleep (500);
+    for (int i = 0; i < 16; i++) {
+        std::string type = "PAR" + std::to_string (i);
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", type.c_str (), std::to_string (i).c_str (), "C");
+        mlm_client_send (producer, ("temperature@" + type).c_str (), &msg_in);
+    }
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "PAR", "100", "C");
+    mlm_client_send (producer, "temperature@PAR", &msg_in);
+    for (int i = 0; i <= 16; i++) {
+        msg_out = mlm_client_recv (par_consumer);
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        if (i == 15)
+            assert (streq (fty_proto_value (m), "7.50"));     // <<< (0 + ... + 15) / 16
+        if (i == 16)
+            assert (streq (fty_proto_value (m), "53.75"));    // <<< (16 * 100 + 0 + ... + 15) / 32
+        fty_proto_destroy (&m);
+    }
+    zactor_destroy (&cm_server);
+    mlm_client_destroy (&par_consumer);
+    for (int i = 0; i < 16; i++)
+        zsys_file_delete (("src/selftest-rw/parallel/rack" + std::to_string (i) + ".cfg").c_str ());
+    zsys_file_delete ("src/selftest-rw/parallel/dc.cfg");
+    zsys_dir_delete ("src/selftest-rw/parallel");
+
+    // sliding window aggregates are published along with output
+    {
+        std::ofstream f ("src/selftest-rw/win.cfg");
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@win\", \"unit\": \"C\", \"windows\": [ 300 ] }\n";
+    }
+    mlm_client_t *win_consumer = mlm_client_new ();
+    mlm_client_connect (win_consumer, endpoint, 1000, "win-consumer");
+    mlm_client_set_consumer (win_consumer, FTY_PROTO_STREAM_METRICS, "^max.temperature_.*_5m@win$");
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-win");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/selftest-rw/win.cfg", NULL);
+    zclock_sleep (500);
+    const char *win_topics [] = {
+        "max.temperature_arithmetic_mean_5m@win",
+        "max.temperature_min_5m@win",
+        "max.temperature_max_5m@win"
+    };
+    const char *win_steps [][4] = {
+        // value, mean, min, max
+        {"10", "10.00", "10.00", "10.00"},
+        {"30", "20.00", "10.00", "30.00"},
+        {"20", "20.00", "10.00", "30.00"}
+    };
+    for (const auto &step : win_steps) {
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", "TH1", step [0], "C");
+        mlm_client_send (producer, "temperature@TH1", &msg_in);
+        for (int i = 0; i < 3; i++) {
+            msg_out = mlm_client_recv (win_consumer);
+            assert (streq (mlm_client_subject (win_consumer), win_topics [i]));
+            m = fty_proto_decode (&msg_out);
+            assert (m);
+            assert (streq (fty_proto_value (m), step [i + 1]));
+            fty_proto_destroy (&m);
+        }
+    }
+    zactor_destroy (&cm_server);
+    mlm_client_destroy (&win_consumer);
+    zsys_file_delete ("src/selftest-rw/win.cfg");
+
+    // one composite publishes averages of both quantities
+    {
+        std::ofstream f ("src/selftest-rw/multi.cfg");
+        f << "{ \"in\": [ \"temperature@TH1\", \"humidity@TH1\" ], \"outputs\": [ "
+          << "{ \"function\": \"avg\", \"in\": [ \"temperature@TH1\" ], "
+          << "\"output\": \"average.temperature@multi\", \"unit\": \"C\" }, "
+          << "{ \"function\": \"avg\", \"in\": [ \"humidity@TH1\" ], "
+          << "\"output\": \"average.humidity@multi\", \"unit\": \"%\" } ] }\n";
+    }
+    mlm_client_t *multi_consumer = mlm_client_new ();
+    mlm_client_connect (multi_consumer, endpoint, 1000, "multi-consumer");
+    mlm_client_set_consumer (multi_consumer, FTY_PROTO_STREAM_METRICS, "^average.*@multi$");
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-multi");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/selftest-rw/multi.cfg", NULL);
+    zclock_sleep (500);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH1", "21", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_out = mlm_client_recv (multi_consumer);
+    assert (streq (mlm_client_subject (multi_consumer), "average.temperature@multi"));
+    zmsg_destroy (&msg_out);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "humidity", "TH1", "45", "%");
+    mlm_client_send (producer, "humidity@TH1", &msg_in);
+    for (const char *topic : {"average.temperature@multi", "average.humidity@multi"}) {
+        msg_out = mlm_client_recv (multi_consumer);
+        assert (streq (mlm_client_subject (multi_consumer), topic));
+        zmsg_destroy (&msg_out);
+    }
+    // each output is announced unavailable once, when it is lost
+    mlm_client_t *multi_unavailable = mlm_client_new ();
+    mlm_client_connect (multi_unavailable, endpoint, 1000, "multi-unavailable");
+    mlm_client_set_consumer (multi_unavailable, "_METRICS_UNAVAILABLE", ".*@multi$");
+    zclock_sleep (100);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 1, "temperature", "TH1", "22", "C");
+    mlm_client_send (producer, "temperature@TH1", &msg_in);
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 3, "humidity", "TH1", "46", "%");
+    mlm_client_send (producer, "humidity@TH1", &msg_in);
+    for (const char *topic : {"average.temperature@multi", "average.humidity@multi"}) {
+        msg_out = mlm_client_recv (multi_unavailable);
+        assert (msg_out);
+        char *piece = zmsg_popstr (msg_out);
+        zstr_free (&piece);
+        piece = zmsg_popstr (msg_out);
+        assert (streq (piece, topic));
+        zstr_free (&piece);
+        zmsg_destroy (&msg_out);
+    }
+    zpoller_t *multi_poller = zpoller_new (mlm_client_msgpipe (multi_unavailable), NULL);
+    assert (zpoller_wait (multi_poller, 1500) == NULL);
+    zpoller_destroy (&multi_poller);
+    mlm_client_destroy (&multi_unavailable);
+    zactor_destroy (&cm_server);
+    mlm_client_destroy (&multi_consumer);
+    zsys_file_delete ("src/selftest-rw/multi.cfg");
+
+    // reload keeps values of inputs which stay and publishes right away
+    {
+        std::ofstream f ("src/selftest-rw/reload.cfg");
+        f << "{ \"in\": [ \"temperature@TH1\", \"temperature@TH2\" ], \"function\": \"avg\", "
+          << "\"output\": \"average.temperature@reload\", \"unit\": \"C\" }\n";
+    }
+    {
+        std::ofstream f ("src/selftest-rw/steady.cfg");
+        f << "{ \"in\": [ \"temperature@TH1\" ], \"function\": \"max\", "
+          << "\"output\": \"max.temperature@steady\", \"unit\": \"C\" }\n";
+    }
+    mlm_client_t *reload_consumer = mlm_client_new ();
+    mlm_client_connect (reload_consumer, endpoint, 1000, "reload-consumer");
+    mlm_client_set_consumer (reload_consumer, FTY_PROTO_STREAM_METRICS, "^average.temperature@reload$");
+    mlm_client_t *steady_consumer = mlm_client_new ();
+    mlm_client_connect (steady_consumer, endpoint, 1000, "steady-consumer");
+    mlm_client_set_consumer (steady_consumer, FTY_PROTO_STREAM_METRICS, "^max.temperature@steady$");
+    cm_server = zactor_new (fty_metric_composite_server, (void*) "composite-metrics-reload");
+    if (verbose)
+        zstr_send (cm_server, "VERBOSE");
+    zstr_sendx (cm_server, "CONNECT", endpoint, NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/selftest-rw/reload.cfg", NULL);
+    zstr_sendx (cm_server, "CONFIG", "src/selftest-rw/steady.cfg", NULL);
+    zclock_sleep (500);
+    const char *reload_steps [][3] = {
+        {"TH1", "10", "10.00"},
+        {"TH2", "20", "15.00"}
+    };
+    for (const auto &step : reload_steps) {
+        msg_in = fty_proto_encode_metric(
+                NULL, ::time (NULL), 60, "temperature", step [0], step [1], "C");
+        std::string subject = std::string ("temperature@") + step [0];
+        mlm_client_send (producer, subject.c_str (), &msg_in);
+        msg_out = mlm_client_recv (reload_consumer);
+        m = fty_proto_decode (&msg_out);
+        assert (m);
+        assert (streq (fty_proto_value (m), step [2]));
+        fty_proto_destroy (&m);
+    }
+    msg_out = mlm_client_recv (steady_consumer);
+    zmsg_destroy (&msg_out);
+    {
+        std::ofstream f ("src/selftest-rw/reload.cfg");
+        f << "{ \"in\": [ \"temperature@TH2\", \"temperature@TH3\" ], \"function\": \"avg\", "
+          << "\"output\": \"average.temperature@reload\", \"unit\": \"C\" }\n";
+    }
+    zstr_sendx (cm_server, "RELOAD", NULL);
+    msg_out = mlm_client_recv (reload_consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "20.00"));      // <<< TH2 survived, TH1 is gone
+    fty_proto_destroy (&m);
+    // unchanged composite is not rebuilt, so it does not publish right away
+    zpoller_t *steady_poller = zpoller_new (mlm_client_msgpipe (steady_consumer), NULL);
+    assert (zpoller_wait (steady_poller, 500) == NULL);
+    zpoller_destroy (&steady_poller);
+    // new input is subscribed
+    msg_in = fty_proto_encode_metric(
+            NULL, ::time (NULL), 60, "temperature", "TH3", "30", "C");
+    mlm_client_send (producer, "temperature@TH3", &msg_in);
+    msg_out = mlm_client_recv (reload_consumer);
+    m = fty_proto_decode (&msg_out);
+    assert (m);
+    assert (streq (fty_proto_value (m), "25.00"));
+    fty_proto_destroy (&m);
     zactor_destroy (&cm_server);
+    mlm_client_destroy (&reload_consumer);
+    mlm_client_destroy (&steady_consumer);
+    zsys_file_delete ("src/selftest-rw/reload.cfg");
+    zsys_file_delete ("src/selftest-rw/steady.cfg");
+
     mlm_client_destroy (&consumer);
     mlm_client_destroy (&producer);
     zactor_destroy (&server);
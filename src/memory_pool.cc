@@ -0,0 +1,360 @@
+/*  =========================================================================
+    memory_pool - Size-class pool of memory blocks backing one Lua state
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    memory_pool - Size-class pool of memory blocks backing one Lua state
+@discuss
+    Serves allocations of one Lua state, so its short lived tables and
+    strings neither go through the shared heap of the process on every
+    evaluation nor fragment it. Blocks of up to 256 bytes are rounded up
+    to multiple of 16, larger ones up to 32 KiB to power of two; every size
+    class keeps its own list of free blocks. New blocks are carved from
+    chunks of 64 KiB taken from the system, the rest of a chunk too small
+    for the requested class is split to free blocks of smaller classes.
+    Larger blocks come from the system directly.
+
+    Freed block only goes back to the list of its class, chunks are given
+    back to the system when the pool is destroyed along with the state.
+    Once evaluations of a composite went through their working set, further
+    ones therefore take no memory from the system at all.
+
+    Pool is not thread safe, it is meant to be used by one state only.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <algorithm>
+
+static const size_t STEP = 16;                  // granularity and alignment of small blocks
+static const size_t SMALL = 256;                // largest block rounded up to STEP
+static const size_t LARGEST = 32768;            // largest block served from chunks
+static const size_t CHUNK = 65536;              // memory taken from the system at once
+static const size_t CLASSES = SMALL / STEP + 7; // 16, 32, ... 256, 512, ... 32768
+
+//  Free block, linked in list of its size class
+typedef struct _free_block_t {
+    struct _free_block_t *next;
+} free_block_t;
+
+struct _memory_pool_t {
+    std::vector <free_block_t *> free;          // size class -> first free block
+    std::vector <void *> chunks;                // memory taken from the system
+    char *cursor;                               // unused rest of the newest chunk
+    size_t left;                                // its size
+    size_t in_use;
+    size_t peak;
+    size_t reserved;
+    uint64_t mallocs;
+};
+
+//  --------------------------------------------------------------------------
+//  Get size class of block of 'size' bytes, CLASSES for large blocks
+
+static size_t
+s_class (size_t size)
+{
+    if (size <= SMALL)
+        return size == 0 ? 0 : (size - 1) / STEP;
+    if (size > LARGEST)
+        return CLASSES;
+    size_t index = SMALL / STEP;
+    for (size_t block = 2 * SMALL; block < size; block *= 2)
+        index++;
+    return index;
+}
+
+//  --------------------------------------------------------------------------
+//  Get size of blocks of size class 'index'
+
+static size_t
+s_class_size (size_t index)
+{
+    if (index < SMALL / STEP)
+        return (index + 1) * STEP;
+    return (2 * SMALL) << (index - SMALL / STEP);
+}
+
+//  --------------------------------------------------------------------------
+//  Take block of size class 'index' from its list or from a chunk
+//  Returns NULL if the system has no more memory
+
+static void *
+s_take (memory_pool_t *self, size_t index)
+{
+    free_block_t *block = self->free [index];
+    if (block) {
+        self->free [index] = block->next;
+        return block;
+    }
+    size_t size = s_class_size (index);
+    if (self->left < size) {
+        // split the rest of chunk to free blocks, the largest ones first
+        while (self->left >= STEP) {
+            size_t rest = s_class (self->left);
+            if (s_class_size (rest) > self->left)
+                rest--;
+            block = (free_block_t *) self->cursor;
+            block->next = self->free [rest];
+            self->free [rest] = block;
+            self->cursor += s_class_size (rest);
+            self->left -= s_class_size (rest);
+        }
+        char *chunk = (char *) malloc (CHUNK);
+        if (!chunk)
+            return NULL;
+        self->chunks.push_back (chunk);
+        self->mallocs++;
+        self->reserved += CHUNK;
+        self->cursor = chunk;
+        self->left = CHUNK;
+    }
+    void *fresh = self->cursor;
+    self->cursor += size;
+    self->left -= size;
+    return fresh;
+}
+
+//  --------------------------------------------------------------------------
+//  Allocate block of 'size' bytes, NULL if the system has no more memory
+
+static void *
+s_alloc (memory_pool_t *self, size_t size)
+{
+    size_t index = s_class (size);
+    if (index < CLASSES)
+        return s_take (self, index);
+    void *block = malloc (size);
+    if (block) {
+        self->mallocs++;
+        self->reserved += size;
+    }
+    return block;
+}
+
+//  --------------------------------------------------------------------------
+//  Free 'block' of 'size' bytes
+
+static void
+s_free (memory_pool_t *self, void *block, size_t size)
+{
+    size_t index = s_class (size);
+    if (index < CLASSES) {
+        free_block_t *freed = (free_block_t *) block;
+        freed->next = self->free [index];
+        self->free [index] = freed;
+        return;
+    }
+    free (block);
+    self->reserved -= size;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new empty pool
+
+memory_pool_t *
+memory_pool_new (void)
+{
+    memory_pool_t *self = new memory_pool_t ();
+    assert (self);
+    self->free.resize (CLASSES, NULL);
+    self->cursor = NULL;
+    self->left = 0;
+    self->in_use = 0;
+    self->peak = 0;
+    self->reserved = 0;
+    self->mallocs = 0;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Allocate, resize or free block the way lua_Alloc does
+
+void *
+memory_pool_realloc (memory_pool_t *self, void *block, size_t size, size_t new_size)
+{
+    assert (self);
+    if (!block)
+        size = 0;
+    if (new_size == 0) {
+        if (block) {
+            s_free (self, block, size);
+            self->in_use -= size;
+        }
+        return NULL;
+    }
+    void *fresh = block;
+    if (!block || s_class (size) != s_class (new_size) || s_class (size) == CLASSES) {
+        fresh = s_alloc (self, new_size);
+        if (!fresh)
+            return NULL;
+        if (block) {
+            memcpy (fresh, block, std::min (size, new_size));
+            s_free (self, block, size);
+        }
+    }
+    self->in_use = self->in_use - size + new_size;
+    self->peak = std::max (self->peak, self->in_use);
+    return fresh;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of bytes of blocks in use
+
+size_t
+memory_pool_in_use (memory_pool_t *self)
+{
+    assert (self);
+    return self->in_use;
+}
+
+//  --------------------------------------------------------------------------
+//  Get the highest number of bytes of blocks in use
+
+size_t
+memory_pool_peak (memory_pool_t *self)
+{
+    assert (self);
+    return self->peak;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of bytes taken from the system
+
+size_t
+memory_pool_reserved (memory_pool_t *self)
+{
+    assert (self);
+    return self->reserved;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of allocations made from the system
+
+uint64_t
+memory_pool_mallocs (memory_pool_t *self)
+{
+    assert (self);
+    return self->mallocs;
+}
+
+//  --------------------------------------------------------------------------
+//  Return all memory to the system and destroy the pool
+
+void
+memory_pool_destroy (memory_pool_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        memory_pool_t *self = *self_p;
+        for (void *chunk : self->chunks)
+            free (chunk);
+        delete self;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+memory_pool_test (bool verbose)
+{
+    printf (" * memory_pool: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    memory_pool_t *self = memory_pool_new ();
+    assert (self);
+    assert (memory_pool_realloc (self, NULL, 0, 0) == NULL);
+    assert (memory_pool_mallocs (self) == 0 && memory_pool_reserved (self) == 0);
+
+    // freed block is reused by the next one of its size class
+    char *block = (char *) memory_pool_realloc (self, NULL, 0, 24);
+    assert (block);
+    assert (((uintptr_t) block) % STEP == 0);
+    assert (memory_pool_in_use (self) == 24);
+    assert (memory_pool_realloc (self, block, 24, 0) == NULL);
+    assert (memory_pool_in_use (self) == 0);
+    assert (memory_pool_realloc (self, NULL, 7, 20) == block);
+    // growth within size class keeps the block, beyond it moves contents
+    assert (memory_pool_realloc (self, block, 20, 32) == block);
+    memcpy (block, "0123456789abcdefghijklmnopqrstu", 32);
+    char *moved = (char *) memory_pool_realloc (self, block, 32, 1000);
+    assert (moved && moved != block);
+    assert (memcmp (moved, "0123456789abcdefghijklmnopqrstu", 32) == 0);
+    assert (memory_pool_in_use (self) == 1000 && memory_pool_peak (self) == 1000);
+    moved = (char *) memory_pool_realloc (self, moved, 1000, 10);
+    assert (memcmp (moved, "0123456789", 10) == 0);
+    assert (memory_pool_in_use (self) == 10 && memory_pool_peak (self) == 1000);
+    assert (memory_pool_mallocs (self) == 1 && memory_pool_reserved (self) == CHUNK);
+
+    // large blocks come from the system
+    char *large = (char *) memory_pool_realloc (self, NULL, 0, 100000);
+    assert (large);
+    large [99999] = 1;
+    assert (memory_pool_mallocs (self) == 2 && memory_pool_reserved (self) == CHUNK + 100000);
+    large = (char *) memory_pool_realloc (self, large, 100000, 200000);
+    assert (large [99999] == 1);
+    assert (memory_pool_reserved (self) == CHUNK + 200000);
+    memory_pool_realloc (self, large, 200000, 0);
+    assert (memory_pool_reserved (self) == CHUNK);
+    memory_pool_realloc (self, moved, 10, 0);
+    assert (memory_pool_in_use (self) == 0);
+
+    // the same working set again and again takes memory only once
+    std::vector <std::pair <void *, size_t>> blocks;
+    uint64_t mallocs = 0;
+    for (int round = 0; round < 100; round++) {
+        for (size_t i = 0; i < 500; i++) {
+            size_t size = (i * 7919) % (LARGEST / 2) + 1;
+            void *fresh = memory_pool_realloc (self, NULL, 0, size);
+            assert (fresh);
+            memset (fresh, (int) i, size);
+            blocks.push_back (std::make_pair (fresh, size));
+        }
+        // every other one grows, then all are freed
+        for (size_t i = 0; i < blocks.size (); i += 2) {
+            size_t size = blocks [i].second * 2;
+            void *fresh = memory_pool_realloc (self, blocks [i].first, blocks [i].second, size);
+            assert (fresh);
+            blocks [i] = std::make_pair (fresh, size);
+        }
+        for (const auto &it : blocks)
+            memory_pool_realloc (self, it.first, it.second, 0);
+        blocks.clear ();
+        assert (memory_pool_in_use (self) == 0);
+        if (round == 0)
+            mallocs = memory_pool_mallocs (self);
+        else
+            assert (memory_pool_mallocs (self) == mallocs);
+    }
+    if (verbose)
+        printf ("mallocs %llu, reserved %zu, peak %zu\n",
+                (unsigned long long) memory_pool_mallocs (self), memory_pool_reserved (self), memory_pool_peak (self));
+    memory_pool_destroy (&self);
+    assert (self == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
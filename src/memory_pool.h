@@ -0,0 +1,73 @@
+/*  =========================================================================
+    memory_pool - Size-class pool of memory blocks backing one Lua state
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef MEMORY_POOL_H_INCLUDED
+#define MEMORY_POOL_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _memory_pool_t memory_pool_t;
+
+//  @interface
+//  Create a new empty pool
+FTY_METRIC_COMPOSITE_EXPORT memory_pool_t *
+    memory_pool_new (void);
+
+//  Allocate, resize or free 'block' of 'size' bytes the way lua_Alloc does:
+//  'new_size' 0 frees the block and returns NULL, NULL 'block' allocates
+//  a new one ('size' is ignored then). Returns the block of 'new_size'
+//  bytes, NULL if there is not enough memory and the old block is intact.
+FTY_METRIC_COMPOSITE_EXPORT void *
+    memory_pool_realloc (memory_pool_t *self, void *block, size_t size, size_t new_size);
+
+//  Get number of bytes of blocks in use, as requested
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    memory_pool_in_use (memory_pool_t *self);
+
+//  Get the highest number of bytes of blocks in use
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    memory_pool_peak (memory_pool_t *self);
+
+//  Get number of bytes the pool took from the system
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    memory_pool_reserved (memory_pool_t *self);
+
+//  Get number of allocations the pool made from the system
+FTY_METRIC_COMPOSITE_EXPORT uint64_t
+    memory_pool_mallocs (memory_pool_t *self);
+
+//  Return all memory to the system and destroy the pool
+FTY_METRIC_COMPOSITE_EXPORT void
+    memory_pool_destroy (memory_pool_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    memory_pool_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+/*  =========================================================================
+    metric_queue - Bounded lock-free single producer, single consumer queue of decoded metrics
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    metric_queue - Bounded lock-free single producer, single consumer queue of decoded metrics
+@discuss
+    Hands decoded metrics over from the receiving thread to the evaluating
+    one. Records live in a preallocated ring of power of two size, producer
+    only moves the tail and consumer only the head, so neither ever waits
+    for the other and nothing is allocated per record.
+
+    Producer never blocks on full ring either - record which does not fit
+    waits in overflow, at most one per topic, newer record of the topic
+    replaces the waiting one. Overflow is private to the producer and is
+    moved to the ring (metric_queue_flush) once consumer makes room; while
+    anything waits there, new records go behind it, so records of one topic
+    never overtake each other.
+
+    Consumer which finds the ring empty goes to sleep, producer learns from
+    metric_queue_push that it should wake it up. Tail store and head load
+    of producer and head store and tail load of consumer are sequentially
+    consistent, so at least one of them sees the other and wake up is never
+    lost.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <atomic>
+#include <deque>
+#include <thread>
+
+struct _metric_queue_t {
+    std::vector <metric_record_t> records;      // ring indexed by sequence number
+    uint64_t mask;                              // ring size - 1
+    std::atomic <uint64_t> head;                // sequence of the oldest record, moved by consumer
+    std::atomic <uint64_t> tail;                // sequence of the next record, moved by producer
+    std::atomic <size_t> max_depth;
+    std::atomic <uint64_t> coalesced;
+    std::vector <metric_record_t> waiting;      // topic id -> record in overflow
+    std::vector <bool> pending;                 // topic id -> is in overflow?
+    std::deque <uint32_t> overflow;             // topic ids in overflow, oldest first
+};
+
+//  --------------------------------------------------------------------------
+//  Create a new empty queue
+
+metric_queue_t *
+metric_queue_new (size_t capacity)
+{
+    assert (capacity > 0);
+    metric_queue_t *self = new metric_queue_t ();
+    assert (self);
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    self->records.resize (size);
+    self->mask = size - 1;
+    self->head = 0;
+    self->tail = 0;
+    self->max_depth = 0;
+    self->coalesced = 0;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of records the queue holds
+
+size_t
+metric_queue_capacity (metric_queue_t *self)
+{
+    assert (self);
+    return self->records.size ();
+}
+
+//  --------------------------------------------------------------------------
+//  Append 'record' to the ring if there is room
+//  0 - appended, 1 - appended, consumer should be woken, -1 - ring is full
+
+static int
+s_append (metric_queue_t *self, const metric_record_t &record)
+{
+    uint64_t tail = self->tail.load (std::memory_order_relaxed);
+    if (tail - self->head.load (std::memory_order_acquire) == self->records.size ())
+        return -1;
+    self->records [tail & self->mask] = record;
+    self->tail.store (tail + 1, std::memory_order_seq_cst);
+    uint64_t head = self->head.load (std::memory_order_seq_cst);
+    if (tail + 1 - head > self->max_depth.load (std::memory_order_relaxed))
+        self->max_depth.store (tail + 1 - head, std::memory_order_relaxed);
+    return head == tail ? 1 : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Append 'record', or keep it in overflow
+
+bool
+metric_queue_push (metric_queue_t *self, const metric_record_t &record)
+{
+    assert (self);
+    bool wake = metric_queue_flush (self);
+    if (self->overflow.empty ()) {
+        int rv = s_append (self, record);
+        if (rv != -1)
+            return wake || rv == 1;
+    }
+    if (record.id >= self->pending.size ()) {
+        self->pending.resize (record.id + 1, false);
+        self->waiting.resize (record.id + 1);
+    }
+    if (self->pending [record.id])
+        self->coalesced++;
+    else {
+        self->pending [record.id] = true;
+        self->overflow.push_back (record.id);
+    }
+    self->waiting [record.id] = record;
+    return wake;
+}
+
+//  --------------------------------------------------------------------------
+//  Move records from overflow to the ring
+
+bool
+metric_queue_flush (metric_queue_t *self)
+{
+    assert (self);
+    bool wake = false;
+    while (!self->overflow.empty ()) {
+        uint32_t id = self->overflow.front ();
+        int rv = s_append (self, self->waiting [id]);
+        if (rv == -1)
+            break;
+        wake = wake || rv == 1;
+        self->pending [id] = false;
+        self->overflow.pop_front ();
+    }
+    return wake;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of records waiting in overflow
+
+size_t
+metric_queue_backlog (metric_queue_t *self)
+{
+    assert (self);
+    return self->overflow.size ();
+}
+
+//  --------------------------------------------------------------------------
+//  Take the oldest record
+
+bool
+metric_queue_pop (metric_queue_t *self, metric_record_t &record)
+{
+    assert (self);
+    uint64_t head = self->head.load (std::memory_order_relaxed);
+    if (head == self->tail.load (std::memory_order_seq_cst))
+        return false;
+    record = self->records [head & self->mask];
+    self->head.store (head + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of records in the queue
+
+size_t
+metric_queue_depth (metric_queue_t *self)
+{
+    assert (self);
+    uint64_t head = self->head.load ();
+    return self->tail.load () - head;
+}
+
+//  --------------------------------------------------------------------------
+//  Get the highest number of records the queue ever held
+
+size_t
+metric_queue_max_depth (metric_queue_t *self)
+{
+    assert (self);
+    return self->max_depth;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of records replaced in overflow
+
+uint64_t
+metric_queue_coalesced (metric_queue_t *self)
+{
+    assert (self);
+    return self->coalesced;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the queue
+
+void
+metric_queue_destroy (metric_queue_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        metric_queue_t *self = *self_p;
+        delete self;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+metric_queue_test (bool verbose)
+{
+    printf (" * metric_queue: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    metric_queue_t *self = metric_queue_new (3);
+    assert (self);
+    assert (metric_queue_capacity (self) == 4);
+    metric_record_t record;
+    assert (!metric_queue_pop (self, record));
+
+    // the first record wakes consumer up, the rest of burst does not
+    assert (metric_queue_push (self, {1, 10, 100, 60}));
+    assert (!metric_queue_push (self, {2, 20, 100, 60}));
+    assert (metric_queue_depth (self) == 2);
+    assert (metric_queue_pop (self, record));
+    assert (record.id == 1 && record.value == 10 && record.time == 100 && record.ttl == 60);
+    assert (metric_queue_pop (self, record));
+    assert (record.id == 2);
+    assert (!metric_queue_pop (self, record));
+    assert (metric_queue_push (self, {3, 30, 100, 60}));
+    assert (metric_queue_pop (self, record));
+
+    // full ring - records coalesce per topic in overflow
+    for (uint32_t i = 0; i < 4; i++)
+        metric_queue_push (self, {i, (double) i, 100, 60});
+    assert (metric_queue_depth (self) == 4 && metric_queue_max_depth (self) == 4);
+    assert (!metric_queue_push (self, {7, 1, 101, 60}));
+    assert (!metric_queue_push (self, {8, 1, 101, 60}));
+    assert (!metric_queue_push (self, {7, 2, 102, 60}));
+    assert (metric_queue_backlog (self) == 2);
+    assert (metric_queue_coalesced (self) == 1);
+    assert (metric_queue_pop (self, record) && record.id == 0);
+    // record with room in ring still waits behind overflow
+    assert (!metric_queue_push (self, {9, 1, 103, 60}));
+    assert (metric_queue_backlog (self) == 2);
+    assert (metric_queue_depth (self) == 4);
+    std::vector <uint32_t> ids;
+    while (metric_queue_pop (self, record)) {
+        ids.push_back (record.id);
+        if (record.id == 7)
+            assert (record.value == 2 && record.time == 102);
+        metric_queue_flush (self);
+    }
+    assert (ids == std::vector <uint32_t> ({1, 2, 3, 7, 8, 9}));
+    assert (metric_queue_backlog (self) == 0);
+    metric_queue_destroy (&self);
+    assert (self == NULL);
+
+    // records pass from one thread to another in order, no wake up is lost
+    self = metric_queue_new (64);
+    zsock_t *doorbell_in = zsock_new_pair ("@inproc://metric-queue-test");
+    zsock_t *doorbell_out = zsock_new_pair (">inproc://metric-queue-test");
+    static const uint64_t RECORDS = 100000;
+    std::thread producer ([self, doorbell_out] {
+        for (uint64_t i = 0; i < RECORDS; i++) {
+            // distinct topic of every record, nothing coalesces
+            while (metric_queue_backlog (self) > 0) {
+                if (metric_queue_flush (self))
+                    zstr_send (doorbell_out, "DATA");
+                std::this_thread::yield ();
+            }
+            if (metric_queue_push (self, {(uint32_t) i, (double) i, i, 60}))
+                zstr_send (doorbell_out, "DATA");
+        }
+        while (metric_queue_backlog (self) > 0) {
+            if (metric_queue_flush (self))
+                zstr_send (doorbell_out, "DATA");
+            std::this_thread::yield ();
+        }
+    });
+    uint64_t expected = 0;
+    while (expected < RECORDS) {
+        char *doorbell = zstr_recv (doorbell_in);
+        assert (doorbell);
+        zstr_free (&doorbell);
+        while (metric_queue_pop (self, record)) {
+            assert (record.time == expected);
+            expected++;
+        }
+    }
+    producer.join ();
+    assert (metric_queue_coalesced (self) == 0);
+    zsock_destroy (&doorbell_out);
+    zsock_destroy (&doorbell_in);
+    metric_queue_destroy (&self);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,96 @@
+/*  =========================================================================
+    metric_queue - Bounded lock-free single producer, single consumer queue of decoded metrics
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef METRIC_QUEUE_H_INCLUDED
+#define METRIC_QUEUE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _metric_queue_t metric_queue_t;
+
+//  One decoded metric
+typedef struct {
+    uint32_t id;            // interned topic id (see topic_index)
+    double value;
+    uint64_t time;          // timestamp of the reading
+    uint32_t ttl;
+} metric_record_t;
+
+//  @interface
+//  Create a new empty queue of at least 'capacity' records
+FTY_METRIC_COMPOSITE_EXPORT metric_queue_t *
+    metric_queue_new (size_t capacity);
+
+//  Get number of records the queue holds
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    metric_queue_capacity (metric_queue_t *self);
+
+//  Producer: append 'record'. When the queue is full, record waits in
+//  overflow where it replaces older record of the same topic, if any.
+//  Returns true when consumer took every record before this one and may
+//  be waiting for a wake up.
+FTY_METRIC_COMPOSITE_EXPORT bool
+    metric_queue_push (metric_queue_t *self, const metric_record_t &record);
+
+//  Producer: move records from overflow to the queue, as long as there is
+//  room. Returns true the same way as metric_queue_push.
+FTY_METRIC_COMPOSITE_EXPORT bool
+    metric_queue_flush (metric_queue_t *self);
+
+//  Producer: get number of records waiting in overflow
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    metric_queue_backlog (metric_queue_t *self);
+
+//  Consumer: take the oldest record
+//  true - 'record' is filled, false - queue is empty
+FTY_METRIC_COMPOSITE_EXPORT bool
+    metric_queue_pop (metric_queue_t *self, metric_record_t &record);
+
+//  Get number of records in the queue, from any thread
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    metric_queue_depth (metric_queue_t *self);
+
+//  Get the highest number of records the queue ever held, from any thread
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    metric_queue_max_depth (metric_queue_t *self);
+
+//  Get number of records replaced in overflow by newer ones of the same
+//  topic, from any thread
+FTY_METRIC_COMPOSITE_EXPORT uint64_t
+    metric_queue_coalesced (metric_queue_t *self);
+
+//  Destroy the queue
+FTY_METRIC_COMPOSITE_EXPORT void
+    metric_queue_destroy (metric_queue_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    metric_queue_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,535 @@
+/*  =========================================================================
+    proto_metric_wire - selective decoder of fty_proto METRIC messages
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    proto_metric_wire - selective decoder of fty_proto METRIC messages
+@discuss
+    Composite server needs only time, ttl and value of every sensor metric,
+    fty_proto_decode builds the whole object including aux hash and all
+    strings. This class reads the three fields straight from the frame.
+
+    METRIC frame is zproto encoded - 2 bytes signature, 1 byte message id
+    and fields aux (hash), time (8 bytes), ttl (4 bytes), type, name, value
+    and unit (strings). Numbers are in network order, string is 1 byte
+    length and data, hash is 4 bytes count and pairs of string key and
+    4 bytes length prefixed value.
+
+    Nothing is trusted blindly - signature and message id are taken from
+    a probe encoded by linked fty_proto, positions of time, ttl and value
+    are found in it by their known values and the layout is verified by
+    decoding a second probe with aux. If anything does not match (other
+    fty_proto version), selective decoding stays disabled. Every frame is
+    bounds checked and must be consumed exactly; anything unexpected makes
+    caller fall back to fty_proto_decode.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <fty_proto.h>
+
+typedef enum {
+    FIELD_NUMBER4,
+    FIELD_NUMBER8,
+    FIELD_STRING,
+    FIELD_HASH
+} field_kind_t;
+
+//  Expected layout of METRIC - aux, time, ttl, type, name, value, unit
+static const field_kind_t s_metric_layout [] = {
+    FIELD_HASH, FIELD_NUMBER8, FIELD_NUMBER4, FIELD_STRING, FIELD_STRING, FIELD_STRING, FIELD_STRING
+};
+#define METRIC_FIELDS   (sizeof (s_metric_layout) / sizeof (s_metric_layout [0]))
+#define HEADER_SIZE     3
+
+static const uint64_t PROBE_TIME = 0x0102030405060708ULL;
+static const uint32_t PROBE_TTL = 0x0a0b0c0d;
+static const char *PROBE_VALUE = "probe-value-1234.5";
+
+struct _proto_metric_wire_t {
+    bool enabled;                       // layout recognized?
+    byte header [HEADER_SIZE];          // signature and id of METRIC message
+    int time_field;                     // index of time in s_metric_layout
+    int ttl_field;                      // index of ttl in s_metric_layout
+    int value_field;                    // index of value in s_metric_layout
+};
+
+//  --------------------------------------------------------------------------
+//  Read network order number of 'size' bytes
+
+static uint64_t
+s_number (const byte *p, size_t size)
+{
+    uint64_t number = 0;
+    for (size_t i = 0; i < size; i++)
+        number = (number << 8) | p [i];
+    return number;
+}
+
+//  --------------------------------------------------------------------------
+//  Write network order number of 'size' bytes
+
+static void
+s_number_put (byte *p, size_t size, uint64_t number)
+{
+    for (size_t i = size; i > 0; i--) {
+        p [i - 1] = number & 0xff;
+        number >>= 8;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Find start of every field of METRIC frame 'data' of 'size' bytes
+//  0 - success, -1 - frame is truncated or longer than its fields
+
+static int
+s_walk (const byte *data, size_t size, const byte *fields [METRIC_FIELDS])
+{
+    if (size < HEADER_SIZE)
+        return -1;
+    const byte *p = data + HEADER_SIZE;
+    const byte *end = data + size;
+    for (size_t i = 0; i < METRIC_FIELDS; i++) {
+        fields [i] = p;
+        switch (s_metric_layout [i]) {
+            case FIELD_NUMBER4:
+                if (end - p < 4)
+                    return -1;
+                p += 4;
+                break;
+            case FIELD_NUMBER8:
+                if (end - p < 8)
+                    return -1;
+                p += 8;
+                break;
+            case FIELD_STRING:
+                if (end - p < 1 || end - p - 1 < *p)
+                    return -1;
+                p += 1 + *p;
+                break;
+            case FIELD_HASH: {
+                if (end - p < 4)
+                    return -1;
+                uint64_t count = s_number (p, 4);
+                p += 4;
+                for (uint64_t item = 0; item < count; item++) {
+                    // key
+                    if (end - p < 1 || end - p - 1 < *p)
+                        return -1;
+                    p += 1 + *p;
+                    // value
+                    if (end - p < 4)
+                        return -1;
+                    uint64_t length = s_number (p, 4);
+                    if ((uint64_t) (end - p - 4) < length)
+                        return -1;
+                    p += 4 + length;
+                }
+                break;
+            }
+        }
+    }
+    return p == end ? 0 : -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Read fields of METRIC frame with learnt layout
+
+static int
+s_decode (proto_metric_wire_t *self, const byte *data, size_t size, proto_metric_fields_t &fields)
+{
+    if (size < HEADER_SIZE || memcmp (data, self->header, HEADER_SIZE) != 0)
+        return -1;
+    const byte *field [METRIC_FIELDS];
+    if (s_walk (data, size, field) != 0)
+        return -1;
+    fields.time = s_number (field [self->time_field], 8);
+    fields.ttl = (uint32_t) s_number (field [self->ttl_field], 4);
+    size_t length = *field [self->value_field];
+    memcpy (fields.value, field [self->value_field] + 1, length);
+    fields.value [length] = '\0';
+    // time -1 is resolved by receiving side, leave it to fty_proto
+    if (fields.time == (uint64_t) -1)
+        return -1;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Encode METRIC probe with known field values, 'with_aux' adds aux hash
+
+static zmsg_t *
+s_probe_encode (bool with_aux)
+{
+    fty_proto_t *probe = fty_proto_new (FTY_PROTO_METRIC);
+    fty_proto_set_time (probe, PROBE_TIME);
+    fty_proto_set_ttl (probe, PROBE_TTL);
+    fty_proto_set_type (probe, "%s", "probe-type");
+    fty_proto_set_name (probe, "%s", "probe-name");
+    fty_proto_set_value (probe, "%s", PROBE_VALUE);
+    fty_proto_set_unit (probe, "%s", "probe-unit");
+    if (with_aux) {
+        fty_proto_aux_insert (probe, "port", "%s", "TH1");
+        fty_proto_aux_insert (probe, "parent_name.1", "%s", "probe-parent");
+    }
+    return fty_proto_encode (&probe);
+}
+
+//  --------------------------------------------------------------------------
+//  Learn and verify layout of METRIC messages
+//  0 - layout recognized, -1 - not
+
+static int
+s_learn (proto_metric_wire_t *self)
+{
+    zmsg_t *probe = s_probe_encode (false);
+    zframe_t *frame = probe ? zmsg_first (probe) : NULL;
+    const byte *field [METRIC_FIELDS];
+    if (!frame || zmsg_size (probe) != 1
+    ||  s_walk (zframe_data (frame), zframe_size (frame), field) != 0) {
+        zmsg_destroy (&probe);
+        return -1;
+    }
+    memcpy (self->header, zframe_data (frame), HEADER_SIZE);
+    for (size_t i = 0; i < METRIC_FIELDS; i++) {
+        switch (s_metric_layout [i]) {
+            case FIELD_NUMBER8:
+                if (s_number (field [i], 8) == PROBE_TIME)
+                    self->time_field = i;
+                break;
+            case FIELD_NUMBER4:
+                if (s_number (field [i], 4) == PROBE_TTL)
+                    self->ttl_field = i;
+                break;
+            case FIELD_STRING:
+                if (*field [i] == strlen (PROBE_VALUE) && memcmp (field [i] + 1, PROBE_VALUE, *field [i]) == 0)
+                    self->value_field = i;
+                break;
+            default:
+                break;
+        }
+    }
+    zmsg_destroy (&probe);
+    if (self->time_field == -1 || self->ttl_field == -1 || self->value_field == -1)
+        return -1;
+
+    // the same must work with non empty aux
+    probe = s_probe_encode (true);
+    frame = probe ? zmsg_first (probe) : NULL;
+    proto_metric_fields_t fields;
+    int rv = -1;
+    if (frame && s_decode (self, zframe_data (frame), zframe_size (frame), fields) == 0
+    &&  fields.time == PROBE_TIME
+    &&  fields.ttl == PROBE_TTL
+    &&  streq (fields.value, PROBE_VALUE))
+        rv = 0;
+    zmsg_destroy (&probe);
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new decoder
+
+proto_metric_wire_t *
+proto_metric_wire_new (void)
+{
+    proto_metric_wire_t *self = (proto_metric_wire_t *) zmalloc (sizeof (proto_metric_wire_t));
+    assert (self);
+    self->time_field = -1;
+    self->ttl_field = -1;
+    self->value_field = -1;
+    self->enabled = s_learn (self) == 0;
+    if (!self->enabled)
+        log_warning ("fty_proto METRIC layout not recognized, selective decoding disabled");
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Is selective decoding enabled?
+
+bool
+proto_metric_wire_enabled (proto_metric_wire_t *self)
+{
+    assert (self);
+    return self->enabled;
+}
+
+//  --------------------------------------------------------------------------
+//  Read time, ttl and value of METRIC message 'msg'
+
+int
+proto_metric_wire_decode (proto_metric_wire_t *self, zmsg_t *msg, proto_metric_fields_t &fields)
+{
+    assert (self);
+    assert (msg);
+    if (!self->enabled || zmsg_size (msg) != 1)
+        return -1;
+    zframe_t *frame = zmsg_first (msg);
+    return s_decode (self, zframe_data (frame), zframe_size (frame), fields);
+}
+
+//  --------------------------------------------------------------------------
+//  Build template of METRIC message for output 'topic'
+
+int
+proto_metric_wire_template (proto_metric_wire_t *self, const char *topic, const char *unit, uint32_t ttl, proto_metric_template_t &tmpl)
+{
+    assert (self);
+    assert (topic);
+    assert (unit);
+    const char *at = strrchr (topic, '@');
+    if (!self->enabled || !at)
+        return -1;
+
+    fty_proto_t *proto = fty_proto_new (FTY_PROTO_METRIC);
+    fty_proto_set_type (proto, "%.*s", (int) (at - topic), topic);
+    fty_proto_set_name (proto, "%s", at + 1);
+    fty_proto_set_unit (proto, "%s", unit);
+    fty_proto_set_ttl (proto, ttl);
+    fty_proto_set_value (proto, "%s", "");
+    zmsg_t *msg = fty_proto_encode (&proto);
+    zframe_t *frame = msg ? zmsg_first (msg) : NULL;
+    const byte *field [METRIC_FIELDS];
+    if (!frame || s_walk (zframe_data (frame), zframe_size (frame), field) != 0) {
+        zmsg_destroy (&msg);
+        return -1;
+    }
+    const byte *data = zframe_data (frame);
+    const byte *value = field [self->value_field];
+    tmpl.topic = topic;
+    tmpl.unit = unit;
+    tmpl.head.assign ((const char *) data, value - data);
+    tmpl.time_at = field [self->time_field] - data;
+    tmpl.tail.assign ((const char *) value + 1, data + zframe_size (frame) - value - 1);
+    zmsg_destroy (&msg);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Encode METRIC message from template
+
+zmsg_t *
+proto_metric_wire_encode (proto_metric_wire_t *self, const proto_metric_template_t &tmpl, uint64_t time, const char *value)
+{
+    assert (self);
+    assert (value);
+    size_t length = strlen (value);
+    if (length > 255)
+        return NULL;
+    zframe_t *frame = zframe_new (NULL, tmpl.head.size () + 1 + length + tmpl.tail.size ());
+    byte *p = zframe_data (frame);
+    memcpy (p, tmpl.head.data (), tmpl.head.size ());
+    s_number_put (p + tmpl.time_at, 8, time);
+    p += tmpl.head.size ();
+    *p++ = (byte) length;
+    memcpy (p, value, length);
+    p += length;
+    memcpy (p, tmpl.tail.data (), tmpl.tail.size ());
+    zmsg_t *msg = zmsg_new ();
+    zmsg_append (msg, &frame);
+    return msg;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the decoder
+
+void
+proto_metric_wire_destroy (proto_metric_wire_t **self_p)
+{
+    if (!self_p)
+        return;
+    if (*self_p) {
+        free (*self_p);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+proto_metric_wire_test (bool verbose)
+{
+    printf (" * proto_metric_wire: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    proto_metric_wire_t *self = proto_metric_wire_new ();
+    assert (self);
+    assert (proto_metric_wire_enabled (self));
+
+    // the same fields as full decoder gives
+    proto_metric_fields_t fields;
+    zmsg_t *msg = fty_proto_encode_metric (NULL, 1500000000, 60, "temperature", "TH1", "21.5", "C");
+    assert (proto_metric_wire_decode (self, msg, fields) == 0);
+    assert (fields.time == 1500000000);
+    assert (fields.ttl == 60);
+    assert (streq (fields.value, "21.5"));
+    fty_proto_t *proto = fty_proto_decode (&msg);
+    assert (proto);
+    assert (fty_proto_time (proto) == fields.time);
+    assert (fty_proto_ttl (proto) == fields.ttl);
+    assert (streq (fty_proto_value (proto), fields.value));
+
+    // with aux and longest possible value
+    fty_proto_aux_insert (proto, "port", "%s", "TH1");
+    fty_proto_aux_insert (proto, "parent_name.1", "%s", "Rack01");
+    std::string longest (255, '9');
+    fty_proto_set_value (proto, "%s", longest.c_str ());
+    msg = fty_proto_encode (&proto);
+    assert (proto_metric_wire_decode (self, msg, fields) == 0);
+    assert (fields.value == longest);
+    zframe_t *frame = zmsg_first (msg);
+
+    // truncated or overlong frame, other signature are refused
+    zmsg_t *broken = zmsg_new ();
+    zmsg_addmem (broken, zframe_data (frame), zframe_size (frame) - 1);
+    assert (proto_metric_wire_decode (self, broken, fields) == -1);
+    zmsg_destroy (&broken);
+    broken = zmsg_new ();
+    zframe_t *longer = zframe_new (NULL, zframe_size (frame) + 1);
+    memcpy (zframe_data (longer), zframe_data (frame), zframe_size (frame));
+    zmsg_append (broken, &longer);
+    assert (proto_metric_wire_decode (self, broken, fields) == -1);
+    zmsg_destroy (&broken);
+    broken = zmsg_new ();
+    zframe_t *other = zframe_dup (frame);
+    zframe_data (other) [0] ^= 0xff;
+    zmsg_append (broken, &other);
+    assert (proto_metric_wire_decode (self, broken, fields) == -1);
+    zmsg_destroy (&broken);
+    broken = zmsg_new ();
+    assert (proto_metric_wire_decode (self, broken, fields) == -1);
+    zmsg_destroy (&broken);
+    // every cut of the frame
+    for (size_t size = 0; size < zframe_size (frame); size++) {
+        broken = zmsg_new ();
+        zmsg_addmem (broken, zframe_data (frame), size);
+        assert (proto_metric_wire_decode (self, broken, fields) == -1);
+        zmsg_destroy (&broken);
+    }
+    zmsg_destroy (&msg);
+
+    // other message types are refused
+    proto = fty_proto_new (FTY_PROTO_ASSET);
+    fty_proto_set_name (proto, "%s", "Rack01");
+    fty_proto_set_operation (proto, "%s", FTY_PROTO_ASSET_OP_CREATE);
+    msg = fty_proto_encode (&proto);
+    assert (proto_metric_wire_decode (self, msg, fields) == -1);
+    zmsg_destroy (&msg);
+
+    // time to be resolved by fty_proto is left to it
+    msg = fty_proto_encode_metric (NULL, (uint64_t) -1, 60, "temperature", "TH1", "21.5", "C");
+    assert (proto_metric_wire_decode (self, msg, fields) == -1);
+    zmsg_destroy (&msg);
+
+    // message from template is the same as the one encoded by fty_proto
+    proto_metric_template_t tmpl;
+    assert (proto_metric_wire_template (self, "no-at-sign", "C", 600, tmpl) == -1);
+    assert (proto_metric_wire_template (self, "average.temperature@rack@dc", "C", 600, tmpl) == 0);
+    assert (tmpl.topic == "average.temperature@rack@dc");
+    assert (tmpl.unit == "C");
+    for (const char *value : {"", "21.50", "-1234567.891"}) {
+        msg = proto_metric_wire_encode (self, tmpl, 1500000000, value);
+        assert (msg);
+        zmsg_t *expected = fty_proto_encode_metric (NULL, 1500000000, 600, "average.temperature@rack", "dc", value, "C");
+        assert (zframe_eq (zmsg_first (msg), zmsg_first (expected)));
+        zmsg_destroy (&expected);
+        proto = fty_proto_decode (&msg);
+        assert (proto);
+        assert (streq (fty_proto_type (proto), "average.temperature@rack"));
+        assert (streq (fty_proto_name (proto), "dc"));
+        assert (streq (fty_proto_value (proto), value));
+        assert (fty_proto_time (proto) == 1500000000);
+        fty_proto_destroy (&proto);
+    }
+    msg = proto_metric_wire_encode (self, tmpl, 1500000000, longest.c_str ());
+    assert (msg);
+    zmsg_destroy (&msg);
+    std::string too_long (256, '9');
+    assert (proto_metric_wire_encode (self, tmpl, 1500000000, too_long.c_str ()) == NULL);
+
+    if (verbose) {
+        // Benchmark of decoding
+        proto = fty_proto_new (FTY_PROTO_METRIC);
+        fty_proto_aux_insert (proto, "port", "%s", "TH1");
+        fty_proto_aux_insert (proto, "parent_name.1", "%s", "Rack01");
+        fty_proto_aux_insert (proto, "sname", "%s", "sensor-123");
+        fty_proto_set_time (proto, 1500000000);
+        fty_proto_set_ttl (proto, 300);
+        fty_proto_set_type (proto, "%s", "temperature");
+        fty_proto_set_name (proto, "%s", "TH1");
+        fty_proto_set_value (proto, "%s", "23.45");
+        fty_proto_set_unit (proto, "%s", "C");
+        zmsg_t *sample = fty_proto_encode (&proto);
+        const int count = 100000;
+        double sum_full = 0, sum_wire = 0;
+        int64_t start = zclock_usecs ();
+        for (int i = 0; i < count; i++) {
+            msg = zmsg_dup (sample);
+            proto = fty_proto_decode (&msg);
+            sum_full += atof (fty_proto_value (proto)) + fty_proto_ttl (proto);
+            fty_proto_destroy (&proto);
+        }
+        int64_t full = zclock_usecs () - start;
+        start = zclock_usecs ();
+        for (int i = 0; i < count; i++) {
+            msg = zmsg_dup (sample);
+            if (proto_metric_wire_decode (self, msg, fields) == 0)
+                sum_wire += atof (fields.value) + fields.ttl;
+            zmsg_destroy (&msg);
+        }
+        int64_t wire = zclock_usecs () - start;
+        assert (sum_full == sum_wire);
+        printf ("%d metrics: fty_proto_decode %ld us, selective %ld us\n", count, (long) full, (long) wire);
+        zmsg_destroy (&sample);
+
+        // Benchmark of publishing
+        start = zclock_usecs ();
+        for (int i = 0; i < count; i++) {
+            proto = fty_proto_new (FTY_PROTO_METRIC);
+            fty_proto_set_type (proto, "%s", "average.temperature");
+            fty_proto_set_name (proto, "%s", "rack");
+            fty_proto_set_value (proto, "%.2f", i / 7.0);
+            fty_proto_set_unit (proto, "%s", "C");
+            fty_proto_set_ttl (proto, 600);
+            msg = fty_proto_encode (&proto);
+            zmsg_destroy (&msg);
+        }
+        full = zclock_usecs () - start;
+        assert (proto_metric_wire_template (self, "average.temperature@rack", "C", 600, tmpl) == 0);
+        start = zclock_usecs ();
+        for (int i = 0; i < count; i++) {
+            char value [VALUE_CODEC_BUFFER_SIZE];
+            value_codec_format (i / 7.0, 2, value, sizeof (value));
+            msg = proto_metric_wire_encode (self, tmpl, 1500000000, value);
+            zmsg_destroy (&msg);
+        }
+        wire = zclock_usecs () - start;
+        printf ("%d outputs: fty_proto_encode %ld us, template %ld us\n", count, (long) full, (long) wire);
+    }
+
+    proto_metric_wire_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
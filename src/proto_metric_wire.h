@@ -0,0 +1,93 @@
+/*  =========================================================================
+    proto_metric_wire - selective decoder of fty_proto METRIC messages
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef PROTO_METRIC_WIRE_H_INCLUDED
+#define PROTO_METRIC_WIRE_H_INCLUDED
+
+#include <string>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _proto_metric_wire_t proto_metric_wire_t;
+
+//  Fields of METRIC message composite server needs
+typedef struct {
+    uint64_t time;
+    uint32_t ttl;
+    char value [256];       // zero terminated, wire string is at most 255 bytes
+} proto_metric_fields_t;
+
+//  Pre-encoded METRIC message of one output, only time and value differ
+//  between messages
+typedef struct {
+    std::string topic;      // output topic the template was built for
+    std::string unit;       // unit the template was built for
+    std::string head;       // frame up to value, including time
+    size_t time_at;         // position of time in head
+    std::string tail;       // frame after value
+} proto_metric_template_t;
+
+//  @interface
+//  Create a new decoder. Wire layout is learnt and verified on a probe
+//  message encoded by fty_proto, selective decoding stays disabled if
+//  the layout is not recognized.
+FTY_METRIC_COMPOSITE_EXPORT proto_metric_wire_t *
+    proto_metric_wire_new (void);
+
+//  Is selective decoding enabled?
+FTY_METRIC_COMPOSITE_EXPORT bool
+    proto_metric_wire_enabled (proto_metric_wire_t *self);
+
+//  Read time, ttl and value of METRIC message 'msg' without decoding the
+//  whole message. Message is not destroyed.
+//  0 - success, -1 - not a well formed METRIC message or decoding disabled,
+//  use fty_proto_decode
+FTY_METRIC_COMPOSITE_EXPORT int
+    proto_metric_wire_decode (proto_metric_wire_t *self, zmsg_t *msg, proto_metric_fields_t &fields);
+
+//  Build 'tmpl' of METRIC message for output 'topic' (type@name), 'unit'
+//  and 'ttl'.
+//  0 - success, -1 - topic is not valid or selective coding disabled
+FTY_METRIC_COMPOSITE_EXPORT int
+    proto_metric_wire_template (proto_metric_wire_t *self, const char *topic, const char *unit, uint32_t ttl, proto_metric_template_t &tmpl);
+
+//  Encode METRIC message from 'tmpl' with 'time' and 'value'
+//  Returns NULL if 'value' is longer than 255 bytes.
+FTY_METRIC_COMPOSITE_EXPORT zmsg_t *
+    proto_metric_wire_encode (proto_metric_wire_t *self, const proto_metric_template_t &tmpl, uint64_t time, const char *value);
+
+//  Destroy the decoder
+FTY_METRIC_COMPOSITE_EXPORT void
+    proto_metric_wire_destroy (proto_metric_wire_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    proto_metric_wire_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,309 @@
+/*  =========================================================================
+    sliding_window - time window aggregates over a ring buffer of samples
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    sliding_window - time window aggregates over a ring buffer of samples
+@discuss
+    Window keeps samples of the last 'length' seconds in a preallocated ring
+    buffer, so adding a sample never allocates. Running sum gives the mean,
+    minimum and maximum come from two monotonic queues of sample sequence
+    numbers (also rings of the same capacity) - every sample enters and
+    leaves each queue once, so both adding and aggregating cost amortized
+    O(1) regardless of the window length.
+
+    Running sum is recomputed from samples once per 'capacity' removed ones,
+    so rounding errors of subtractions do not accumulate.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <cmath>
+
+typedef struct {
+    time_t when;
+    double value;
+} sample_t;
+
+struct _sliding_window_t {
+    int length;                                 // window length [s]
+    size_t capacity;                            // max number of samples
+    std::vector <sample_t> samples;             // ring indexed by sequence number
+    uint64_t first;                             // sequence of the oldest sample
+    uint64_t next;                              // sequence of the next sample
+    std::vector <uint64_t> min_queue;           // samples with increasing values
+    uint64_t min_head, min_tail;
+    std::vector <uint64_t> max_queue;           // samples with decreasing values
+    uint64_t max_head, max_tail;
+    double sum;                                 // sum of samples in window
+    size_t removed;                             // samples removed since sum was recomputed
+};
+
+//  --------------------------------------------------------------------------
+//  Create a new empty window
+
+sliding_window_t *
+sliding_window_new (int length, size_t capacity)
+{
+    assert (length > 0);
+    assert (capacity > 0);
+    sliding_window_t *self = new sliding_window_t ();
+    assert (self);
+    self->length = length;
+    self->capacity = capacity;
+    self->samples.resize (capacity);
+    self->min_queue.resize (capacity);
+    self->max_queue.resize (capacity);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Get length of the window [s]
+
+int
+sliding_window_length (sliding_window_t *self)
+{
+    assert (self);
+    return self->length;
+}
+
+static inline sample_t &
+s_sample (sliding_window_t *self, uint64_t seq)
+{
+    return self->samples [seq % self->capacity];
+}
+
+//  --------------------------------------------------------------------------
+//  Remove the oldest sample
+
+static void
+s_pop (sliding_window_t *self)
+{
+    sample_t &sample = s_sample (self, self->first);
+    if (self->min_head < self->min_tail
+    &&  self->min_queue [self->min_head % self->capacity] == self->first)
+        self->min_head++;
+    if (self->max_head < self->max_tail
+    &&  self->max_queue [self->max_head % self->capacity] == self->first)
+        self->max_head++;
+    self->first++;
+    self->removed++;
+
+    if (self->first == self->next) {
+        self->sum = 0;
+        self->removed = 0;
+    }
+    else
+    if (self->removed >= self->capacity) {
+        self->sum = 0;
+        for (uint64_t seq = self->first; seq < self->next; seq++)
+            self->sum += s_sample (self, seq).value;
+        self->removed = 0;
+    }
+    else
+        self->sum -= sample.value;
+}
+
+//  --------------------------------------------------------------------------
+//  Remove samples which are not in the window ending at 'now'
+
+static void
+s_expire (sliding_window_t *self, time_t now)
+{
+    while (self->first < self->next
+    &&     s_sample (self, self->first).when <= now - self->length)
+        s_pop (self);
+}
+
+//  --------------------------------------------------------------------------
+//  Add sample 'value' taken at 'when'
+
+void
+sliding_window_add (sliding_window_t *self, time_t when, double value)
+{
+    assert (self);
+    if (self->first < self->next && when < s_sample (self, self->next - 1).when)
+        when = s_sample (self, self->next - 1).when;
+    s_expire (self, when);
+    if (self->next - self->first == self->capacity)
+        s_pop (self);
+
+    uint64_t seq = self->next++;
+    s_sample (self, seq) = {when, value};
+    self->sum += value;
+
+    while (self->min_tail > self->min_head
+    &&     s_sample (self, self->min_queue [(self->min_tail - 1) % self->capacity]).value >= value)
+        self->min_tail--;
+    self->min_queue [self->min_tail++ % self->capacity] = seq;
+
+    while (self->max_tail > self->max_head
+    &&     s_sample (self, self->max_queue [(self->max_tail - 1) % self->capacity]).value <= value)
+        self->max_tail--;
+    self->max_queue [self->max_tail++ % self->capacity] = seq;
+}
+
+//  --------------------------------------------------------------------------
+//  Get aggregates of samples in the window ending at 'now'
+
+int
+sliding_window_aggregate (sliding_window_t *self, time_t now, sliding_window_result_t &result)
+{
+    assert (self);
+    s_expire (self, now);
+    if (self->first == self->next)
+        return -1;
+    result.count = self->next - self->first;
+    result.mean = self->sum / result.count;
+    result.min = s_sample (self, self->min_queue [self->min_head % self->capacity]).value;
+    result.max = s_sample (self, self->max_queue [self->max_head % self->capacity]).value;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of samples in the window
+
+size_t
+sliding_window_size (sliding_window_t *self)
+{
+    assert (self);
+    return self->next - self->first;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the window
+
+void
+sliding_window_destroy (sliding_window_t **self_p)
+{
+    if (!self_p)
+        return;
+    if (*self_p) {
+        delete *self_p;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+sliding_window_test (bool verbose)
+{
+    printf (" * sliding_window: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    time_t start = 1500000000;
+    sliding_window_t *self = sliding_window_new (60, 4);
+    assert (self);
+    assert (sliding_window_length (self) == 60);
+    sliding_window_result_t result;
+    assert (sliding_window_aggregate (self, start, result) == -1);
+
+    sliding_window_add (self, start, 10);
+    sliding_window_add (self, start + 10, 30);
+    sliding_window_add (self, start + 20, 20);
+    assert (sliding_window_aggregate (self, start + 30, result) == 0);
+    assert (result.count == 3);
+    assert (result.mean == 20 && result.min == 10 && result.max == 30);
+
+    // first sample leaves the window
+    assert (sliding_window_aggregate (self, start + 60, result) == 0);
+    assert (result.count == 2);
+    assert (result.mean == 25 && result.min == 20 && result.max == 30);
+
+    // full window drops the oldest sample
+    sliding_window_add (self, start + 61, 5);
+    sliding_window_add (self, start + 62, 6);
+    sliding_window_add (self, start + 63, 7);
+    assert (sliding_window_size (self) == 4);
+    assert (sliding_window_aggregate (self, start + 63, result) == 0);
+    assert (result.min == 5 && result.max == 20);
+
+    // everything expired
+    assert (sliding_window_aggregate (self, start + 1000, result) == -1);
+    assert (sliding_window_size (self) == 0);
+    sliding_window_destroy (&self);
+    assert (self == NULL);
+
+    // random samples against brute force over the same ring
+    const size_t capacity = 50;
+    self = sliding_window_new (30, capacity);
+    std::vector <sample_t> reference;
+    unsigned int seed = 11;
+    time_t now = start;
+    for (int i = 0; i < 100000; i++) {
+        seed = seed * 1103515245 + 12345;
+        now += (seed >> 16) % 3 == 0 ? (seed >> 18) % 4 : 0;
+        double value = (double) ((seed >> 8) % 2000) / 8 - 100;
+        sliding_window_add (self, now, value);
+        reference.push_back ({now, value});
+        if (reference.size () > capacity)
+            reference.erase (reference.begin ());
+
+        time_t at = now + ((seed >> 20) % 7 == 0 ? (seed >> 23) % 40 : 0);
+        std::vector <sample_t> in;
+        for (const auto &sample : reference) {
+            if (sample.when > at - 30)
+                in.push_back (sample);
+        }
+        reference = in;
+        int rv = sliding_window_aggregate (self, at, result);
+        if (in.empty ()) {
+            assert (rv == -1);
+            continue;
+        }
+        assert (rv == 0);
+        assert (result.count == in.size ());
+        double sum = 0, min = in [0].value, max = in [0].value;
+        for (const auto &sample : in) {
+            sum += sample.value;
+            min = std::min (min, sample.value);
+            max = std::max (max, sample.value);
+        }
+        assert (fabs (result.mean - sum / in.size ()) < 1e-9);
+        assert (result.min == min && result.max == max);
+        now = at;
+    }
+    sliding_window_destroy (&self);
+
+    if (verbose) {
+        // per sample cost does not depend on window length
+        for (size_t samples : {64, 4096, 262144}) {
+            self = sliding_window_new (3600, samples);
+            int64_t begin = zclock_usecs ();
+            double total = 0;
+            for (size_t i = 0; i < 1000000; i++) {
+                sliding_window_add (self, start + (time_t) (i * 3600 / samples), (double) (i % 977));
+                sliding_window_aggregate (self, start + (time_t) (i * 3600 / samples), result);
+                total += result.mean;
+            }
+            printf ("   %ld samples: 1M add + aggregate in %ld us (%g)\n",
+                (long) samples, (long) (zclock_usecs () - begin), total);
+            sliding_window_destroy (&self);
+        }
+    }
+    //  @end
+    printf ("OK\n");
+}
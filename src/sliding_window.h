@@ -0,0 +1,78 @@
+/*  =========================================================================
+    sliding_window - time window aggregates over a ring buffer of samples
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+
+#ifndef SLIDING_WINDOW_H_INCLUDED
+#define SLIDING_WINDOW_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _sliding_window_t sliding_window_t;
+
+//  Aggregates of samples in the window
+typedef struct {
+    double mean;
+    double min;
+    double max;
+    size_t count;
+} sliding_window_result_t;
+
+//  @interface
+//  Create a new empty window of 'length' seconds keeping at most 'capacity'
+//  samples, the oldest sample is dropped when it is full
+FTY_METRIC_COMPOSITE_EXPORT sliding_window_t *
+    sliding_window_new (int length, size_t capacity);
+
+//  Get length of the window [s]
+FTY_METRIC_COMPOSITE_EXPORT int
+    sliding_window_length (sliding_window_t *self);
+
+//  Add sample 'value' taken at 'when' (unix time, not older than previous
+//  sample), samples which left the window are dropped
+FTY_METRIC_COMPOSITE_EXPORT void
+    sliding_window_add (sliding_window_t *self, time_t when, double value);
+
+//  Get aggregates of samples taken during 'length' seconds till 'now'
+//  0 - success, -1 - window is empty
+FTY_METRIC_COMPOSITE_EXPORT int
+    sliding_window_aggregate (sliding_window_t *self, time_t now, sliding_window_result_t &result);
+
+//  Get number of samples in the window
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    sliding_window_size (sliding_window_t *self);
+
+//  Destroy the window
+FTY_METRIC_COMPOSITE_EXPORT void
+    sliding_window_destroy (sliding_window_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    sliding_window_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
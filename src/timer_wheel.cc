@@ -0,0 +1,337 @@
+/*  =========================================================================
+    timer_wheel - hierarchical timer wheel driving expiry of input values
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    timer_wheel - hierarchical timer wheel driving expiry of input values
+@discuss
+    Every input value is valid only until its 'valid_till'. Wheel lets the
+    server react right when that moment passes, without one zloop timer per
+    input and without sorting all pending expiries.
+
+    Resolution is one second (the resolution of metric timestamps). There
+    are four levels of 64 slots, level N slot spans 64^N seconds, so wheel
+    covers 2^24 seconds (194 days) ahead; later deadlines are parked in the
+    top level and re-inserted once they come into range. Scheduling and
+    firing cost O(1), lower level slots are refilled from the upper level
+    once every 64^N seconds.
+
+    Wheel does not own the clock - server asks timer_wheel_next for zpoller
+    timeout and calls timer_wheel_expire with the current time after every
+    wakeup.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <algorithm>
+
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+
+typedef struct {
+    time_t when;
+    void *item;
+} timer_entry_t;
+
+struct _timer_wheel_t {
+    time_t tick;                                                    // next second to process
+    size_t size;                                                    // number of scheduled firings
+    std::vector <timer_entry_t> slots [WHEEL_LEVELS][WHEEL_SIZE];
+    std::vector <timer_entry_t> ready;                              // already due, not yet returned
+};
+
+//  --------------------------------------------------------------------------
+//  Put 'entry' into the slot matching its distance from current tick
+
+static void
+s_place (timer_wheel_t *self, const timer_entry_t &entry)
+{
+    time_t delta = entry.when - self->tick;
+    if (delta < 0) {
+        self->ready.push_back (entry);
+        return;
+    }
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (delta < ((time_t) 1 << (WHEEL_BITS * (level + 1)))) {
+            self->slots [level][(entry.when >> (WHEEL_BITS * level)) & WHEEL_MASK].push_back (entry);
+            return;
+        }
+    }
+    // out of range, park in the top level slot processed last before 'when'
+    time_t last = self->tick + ((time_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    self->slots [WHEEL_LEVELS - 1][(last >> (WHEEL_BITS * (WHEEL_LEVELS - 1))) & WHEEL_MASK].push_back (entry);
+}
+
+//  --------------------------------------------------------------------------
+//  Process one second - refill lower levels if needed and fire level 0 slot
+
+static void
+s_tick (timer_wheel_t *self, std::vector <void *> &due)
+{
+    if ((self->tick & WHEEL_MASK) == 0) {
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            int index = (self->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            std::vector <timer_entry_t> cascade;
+            cascade.swap (self->slots [level][index]);
+            for (const auto &entry : cascade)
+                s_place (self, entry);
+            if (index != 0)
+                break;
+        }
+    }
+    std::vector <timer_entry_t> &slot = self->slots [0][self->tick & WHEEL_MASK];
+    for (const auto &entry : slot)
+        due.push_back (entry.item);
+    self->size -= slot.size ();
+    slot.clear ();
+    self->tick++;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new empty wheel, 'now' is the current unix time
+
+timer_wheel_t *
+timer_wheel_new (time_t now)
+{
+    timer_wheel_t *self = new _timer_wheel_t ();
+    self->tick = now + 1;
+    self->size = 0;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Schedule 'item' to fire once the clock reaches 'when'
+
+void
+timer_wheel_add (timer_wheel_t *self, time_t when, void *item)
+{
+    assert (self);
+    timer_entry_t entry;
+    entry.when = when;
+    entry.item = item;
+    s_place (self, entry);
+    self->size++;
+}
+
+//  --------------------------------------------------------------------------
+//  Cancel all scheduled firings of 'item'
+
+void
+timer_wheel_remove (timer_wheel_t *self, void *item)
+{
+    assert (self);
+    auto matches = [item] (const timer_entry_t &entry) { return entry.item == item; };
+    auto remove = [&] (std::vector <timer_entry_t> &slot) {
+        size_t before = slot.size ();
+        slot.erase (std::remove_if (slot.begin (), slot.end (), matches), slot.end ());
+        self->size -= before - slot.size ();
+    };
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int index = 0; index < WHEEL_SIZE; index++)
+            remove (self->slots [level][index]);
+    remove (self->ready);
+}
+
+//  --------------------------------------------------------------------------
+//  Get the earliest time anything can fire, -1 if nothing is scheduled
+
+time_t
+timer_wheel_next (timer_wheel_t *self)
+{
+    assert (self);
+    if (self->size == 0)
+        return -1;
+    if (!self->ready.empty ())
+        return self->tick - 1;
+    // upper levels are cascaded at the boundary, before level 0 slot fires
+    if ((self->tick & WHEEL_MASK) == 0)
+        return self->tick;
+    for (time_t t = self->tick; ; t++) {
+        if (!self->slots [0][t & WHEEL_MASK].empty ())
+            return t;
+        if (((t + 1) & WHEEL_MASK) == 0)
+            return t + 1;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Move the clock to 'now' and append items due till then to 'due'
+
+size_t
+timer_wheel_expire (timer_wheel_t *self, time_t now, std::vector <void *> &due)
+{
+    assert (self);
+    size_t before = due.size ();
+    for (const auto &entry : self->ready)
+        due.push_back (entry.item);
+    self->size -= self->ready.size ();
+    self->ready.clear ();
+
+    if (self->size == 0) {
+        self->tick = std::max (self->tick, now + 1);
+    }
+    else
+    if (now - self->tick > ((time_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))) {
+        // clock jumped beyond the range of the wheel, rebuild it
+        std::vector <timer_entry_t> entries;
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            for (int index = 0; index < WHEEL_SIZE; index++) {
+                entries.insert (entries.end (), self->slots [level][index].begin (), self->slots [level][index].end ());
+                self->slots [level][index].clear ();
+            }
+        }
+        self->tick = now + 1;
+        for (const auto &entry : entries) {
+            if (entry.when <= now) {
+                due.push_back (entry.item);
+                self->size--;
+            }
+            else
+                s_place (self, entry);
+        }
+    }
+    while (self->tick <= now)
+        s_tick (self, due);
+    return due.size () - before;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of scheduled firings
+
+size_t
+timer_wheel_size (timer_wheel_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the wheel
+
+void
+timer_wheel_destroy (timer_wheel_t **self_p)
+{
+    if (!self_p)
+        return;
+    if (*self_p) {
+        delete *self_p;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+timer_wheel_test (bool verbose)
+{
+    printf (" * timer_wheel: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    time_t start = 1500000000;
+    timer_wheel_t *self = timer_wheel_new (start);
+    assert (self);
+    assert (timer_wheel_size (self) == 0);
+    assert (timer_wheel_next (self) == -1);
+
+    std::vector <void *> due;
+    assert (timer_wheel_expire (self, start + 100, due) == 0);
+
+    // simple firing, item scheduled twice fires twice
+    int a, b, c;
+    timer_wheel_add (self, start + 105, &a);
+    timer_wheel_add (self, start + 105, &a);
+    timer_wheel_add (self, start + 110, &b);
+    timer_wheel_add (self, start + 50, &c);         // already in the past
+    assert (timer_wheel_size (self) == 4);
+    assert (timer_wheel_next (self) <= start + 100);
+    assert (timer_wheel_expire (self, start + 100, due) == 1);
+    assert (due == std::vector <void *> ({&c}));
+    assert (timer_wheel_next (self) <= start + 105);
+    due.clear ();
+    assert (timer_wheel_expire (self, start + 104, due) == 0);
+    assert (timer_wheel_expire (self, start + 105, due) == 2);
+    assert (due == std::vector <void *> ({&a, &a}));
+
+    // removal
+    timer_wheel_add (self, start + 200, &a);
+    timer_wheel_add (self, start + 100000, &a);
+    timer_wheel_remove (self, &a);
+    assert (timer_wheel_size (self) == 1);
+    due.clear ();
+    assert (timer_wheel_expire (self, start + 200000, due) == 1);
+    assert (due == std::vector <void *> ({&b}));
+    assert (timer_wheel_size (self) == 0);
+    timer_wheel_destroy (&self);
+
+    // Every item fires in the first expire reaching its time - deadlines
+    // seconds, hours and years ahead, clock moving in small and big steps
+    self = timer_wheel_new (start);
+    const size_t count = 20000;
+    std::vector <time_t> deadlines (count);
+    std::vector <int> fired (count, 0);
+    std::vector <int> items (count);
+    unsigned int seed = 7;
+    time_t now = start;
+    size_t scheduled = 0;
+    while (now < start + 40000000) {
+        seed = seed * 1103515245 + 12345;
+        if (scheduled < count) {
+            time_t ahead;
+            switch ((seed >> 8) % 4) {
+                case 0:  ahead = (seed >> 12) % 70; break;
+                case 1:  ahead = (seed >> 12) % 5000; break;
+                case 2:  ahead = (seed >> 12) % 300000; break;
+                default: ahead = (seed >> 4) % 30000000; break;
+            }
+            deadlines [scheduled] = now + ahead;
+            timer_wheel_add (self, deadlines [scheduled], &items [scheduled]);
+            scheduled++;
+        }
+        time_t next = timer_wheel_next (self);
+        for (size_t i = 0; i < scheduled; i += 97) {
+            if (!fired [i])
+                assert (next != -1 && next <= deadlines [i]);
+        }
+        seed = seed * 1103515245 + 12345;
+        now += scheduled < count ? (seed >> 16) % 3 : (seed >> 16) % 50000;
+        due.clear ();
+        timer_wheel_expire (self, now, due);
+        for (void *item : due) {
+            size_t i = (int *) item - &items [0];
+            assert (fired [i] == 0);
+            assert (deadlines [i] <= now);
+            fired [i] = 1;
+        }
+        for (size_t i = 0; i < scheduled; i++)
+            assert (fired [i] || deadlines [i] > now);
+    }
+    assert (timer_wheel_size (self) == 0);
+    timer_wheel_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,75 @@
+/*  =========================================================================
+    timer_wheel - hierarchical timer wheel driving expiry of input values
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef TIMER_WHEEL_H_INCLUDED
+#define TIMER_WHEEL_H_INCLUDED
+
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _timer_wheel_t timer_wheel_t;
+
+//  @interface
+//  Create a new empty wheel, 'now' is the current unix time
+FTY_METRIC_COMPOSITE_EXPORT timer_wheel_t *
+    timer_wheel_new (time_t now);
+
+//  Schedule 'item' to fire once the clock reaches 'when' (unix time).
+//  Item may be scheduled several times, it then fires several times.
+FTY_METRIC_COMPOSITE_EXPORT void
+    timer_wheel_add (timer_wheel_t *self, time_t when, void *item);
+
+//  Cancel all scheduled firings of 'item'
+FTY_METRIC_COMPOSITE_EXPORT void
+    timer_wheel_remove (timer_wheel_t *self, void *item);
+
+//  Get the earliest time anything can fire, -1 if nothing is scheduled.
+//  Result is never later than the real next firing, it may be earlier.
+FTY_METRIC_COMPOSITE_EXPORT time_t
+    timer_wheel_next (timer_wheel_t *self);
+
+//  Move the clock to 'now' and append items due till then to 'due'
+//  Returns number of appended items
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    timer_wheel_expire (timer_wheel_t *self, time_t now, std::vector <void *> &due);
+
+//  Get number of scheduled firings
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    timer_wheel_size (timer_wheel_t *self);
+
+//  Destroy the wheel, scheduled items are not touched
+FTY_METRIC_COMPOSITE_EXPORT void
+    timer_wheel_destroy (timer_wheel_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    timer_wheel_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
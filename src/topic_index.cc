@@ -0,0 +1,428 @@
+/*  =========================================================================
+    topic_index - reverse index from input topic to composites
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    topic_index - reverse index from input topic to composites
+@discuss
+    One sensor metric usually feeds several composites (rack, row, room, DC
+    averages). Index maps every input topic to the list of composites
+    depending on it, so incoming metric is decoded once and handed over
+    only to the composites which need it.
+
+    Index is maintained incrementally - adding or removing one composite
+    touches only topics of that composite.
+
+    Topics are interned to dense ids when composite is added. Id points to
+    the topic entry holding dependent composites together with the slot of
+    the topic in each of them. Subject of incoming message is looked up
+    in a flat open addressing table of ids (linear probing, at most half
+    full) hashed directly from the C string, so the lookup neither
+    allocates nor walks a tree. Ids are never reused - topic nobody
+    depends on anymore just has no dependents.
+
+    Entry also knows which composite of the same process produces the
+    topic, so output of one composite can be routed to composites
+    depending on it without a trip through the broker.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <algorithm>
+#include <fstream>
+
+typedef struct {
+    std::string topic;
+    uint32_t hash;
+    std::vector <topic_dependent_t> dependents;
+    composite_t *producer;
+} topic_entry_t;
+
+struct _topic_index_t {
+    std::vector <topic_entry_t> entries;        // id -> topic entry
+    std::vector <int> table;                    // open addressing table of ids, -1 is empty
+    size_t size;                                // number of topics with dependents
+};
+
+#define TOPIC_INDEX_MIN_TABLE 64
+
+//  --------------------------------------------------------------------------
+//  FNV-1a hash of 'topic'
+
+static uint32_t
+s_hash (const char *topic)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) topic; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//  --------------------------------------------------------------------------
+//  Find table position of 'topic' - position of its id, or of the empty
+//  slot where the id belongs
+
+static size_t
+s_probe (topic_index_t *self, const char *topic, uint32_t hash)
+{
+    size_t mask = self->table.size () - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        int id = self->table [i];
+        if (id == -1)
+            return i;
+        const topic_entry_t &entry = self->entries [id];
+        if (entry.hash == hash && streq (entry.topic.c_str (), topic))
+            return i;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get id of 'topic', intern it if it is not known yet
+
+static int
+s_intern (topic_index_t *self, const std::string &topic)
+{
+    uint32_t hash = s_hash (topic.c_str ());
+    size_t pos = s_probe (self, topic.c_str (), hash);
+    if (self->table [pos] != -1)
+        return self->table [pos];
+
+    int id = self->entries.size ();
+    topic_entry_t entry;
+    entry.topic = topic;
+    entry.hash = hash;
+    entry.producer = NULL;
+    self->entries.push_back (entry);
+    if (self->entries.size () * 2 > self->table.size ()) {
+        // keep the table at most half full
+        self->table.assign (self->table.size () * 2, -1);
+        size_t mask = self->table.size () - 1;
+        for (size_t i = 0; i < self->entries.size (); i++) {
+            size_t j = self->entries [i].hash & mask;
+            while (self->table [j] != -1)
+                j = (j + 1) & mask;
+            self->table [j] = i;
+        }
+    }
+    else
+        self->table [pos] = id;
+    return id;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new empty index
+
+topic_index_t *
+topic_index_new (void)
+{
+    topic_index_t *self = new _topic_index_t ();
+    self->table.assign (TOPIC_INDEX_MIN_TABLE, -1);
+    self->size = 0;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Index all inputs of 'composite'
+
+void
+topic_index_add (topic_index_t *self, composite_t *composite)
+{
+    assert (self);
+    assert (composite);
+
+    for (const auto &topic : composite_inputs (composite)) {
+        std::vector <topic_dependent_t> &dependents = self->entries [s_intern (self, topic)].dependents;
+        // input listed twice in configuration
+        if (std::find_if (dependents.begin (), dependents.end (),
+                    [composite] (const topic_dependent_t &d) { return d.composite == composite; }) != dependents.end ())
+            continue;
+        if (dependents.empty ())
+            self->size++;
+        topic_dependent_t dependent;
+        dependent.composite = composite;
+        dependent.slot = composite_slot (composite, topic.c_str ());
+        dependents.push_back (dependent);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Remove all inputs of 'composite' from the index
+
+void
+topic_index_remove (topic_index_t *self, composite_t *composite)
+{
+    assert (self);
+    assert (composite);
+
+    for (const auto &topic : composite_inputs (composite)) {
+        int id = topic_index_id (self, topic.c_str ());
+        if (id == -1)
+            continue;
+        std::vector <topic_dependent_t> &dependents = self->entries [id].dependents;
+        if (dependents.empty ())
+            continue;
+        dependents.erase (std::remove_if (dependents.begin (), dependents.end (),
+                    [composite] (const topic_dependent_t &d) { return d.composite == composite; }), dependents.end ());
+        if (dependents.empty ())
+            self->size--;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get composites depending on 'topic' or NULL if there are none
+
+const std::vector <topic_dependent_t> *
+topic_index_lookup (topic_index_t *self, const char *topic)
+{
+    int id = topic_index_id (self, topic);
+    if (id == -1 || self->entries [id].dependents.empty ())
+        return NULL;
+    return &self->entries [id].dependents;
+}
+
+//  --------------------------------------------------------------------------
+//  Get interned id of 'topic', -1 if topic was never indexed
+
+int
+topic_index_id (topic_index_t *self, const char *topic)
+{
+    assert (self);
+    assert (topic);
+    return self->table [s_probe (self, topic, s_hash (topic))];
+}
+
+//  --------------------------------------------------------------------------
+//  Get interned id of 'topic', intern it if it is not known yet
+
+int
+topic_index_intern (topic_index_t *self, const char *topic)
+{
+    assert (self);
+    assert (topic);
+    return s_intern (self, topic);
+}
+
+//  --------------------------------------------------------------------------
+//  Get composites depending on topic with interned 'id'
+
+const std::vector <topic_dependent_t> &
+topic_index_dependents (topic_index_t *self, int id)
+{
+    assert (self);
+    assert (id >= 0 && (size_t) id < self->entries.size ());
+    return self->entries [id].dependents;
+}
+
+//  --------------------------------------------------------------------------
+//  Set composite producing 'topic'
+
+void
+topic_index_set_producer (topic_index_t *self, const char *topic, composite_t *producer)
+{
+    assert (self);
+    assert (topic);
+    self->entries [s_intern (self, topic)].producer = producer;
+}
+
+//  --------------------------------------------------------------------------
+//  Get composite producing topic with interned 'id'
+
+composite_t *
+topic_index_producer (topic_index_t *self, int id)
+{
+    assert (self);
+    assert (id >= 0 && (size_t) id < self->entries.size ());
+    return self->entries [id].producer;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of indexed topics
+
+size_t
+topic_index_size (topic_index_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the index
+
+void
+topic_index_destroy (topic_index_t **self_p)
+{
+    if (!self_p)
+        return;
+    if (*self_p) {
+        delete *self_p;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Helper test function
+//  Create composite 'name' with 'inputs'
+
+static composite_t *
+test_composite_new (const char *name, const std::vector <std::string> &inputs)
+{
+    const char *cfg = "src/selftest-rw/topic-index-test.cfg";
+    std::ofstream f (cfg);
+    f << "{\n  \"in\": [";
+    for (size_t i = 0; i < inputs.size (); i++)
+        f << (i ? ", " : " ") << "\"" << inputs [i] << "\"";
+    f << " ],\n  \"evaluation\": \"return 'sum@" << name << "', 0, '';\"\n}\n";
+    f.close ();
+
+    composite_t *composite = composite_new (name);
+    int rv = composite_load (composite, cfg);
+    assert (rv == 0);
+    zsys_file_delete (cfg);
+    return composite;
+}
+
+//  Helper test function
+//  Get composites out of 'dependents'
+
+static std::vector <composite_t *>
+test_composites (const std::vector <topic_dependent_t> *dependents)
+{
+    std::vector <composite_t *> composites;
+    for (const auto &dependent : *dependents)
+        composites.push_back (dependent.composite);
+    return composites;
+}
+
+void
+topic_index_test (bool verbose)
+{
+    printf (" * topic_index: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    zsys_dir_create ("src/selftest-rw");
+    composite_t *rack = test_composite_new ("rack", {"temperature.TH1@rc", "temperature.TH2@rc"});
+    composite_t *row = test_composite_new ("row", {"temperature.TH1@rc", "temperature.TH2@rc", "temperature.TH3@rc2"});
+    composite_t *dc = test_composite_new ("dc", {"temperature.TH1@rc", "temperature.TH3@rc2", "temperature.TH3@rc2"});
+
+    topic_index_t *self = topic_index_new ();
+    assert (self);
+    assert (topic_index_size (self) == 0);
+    assert (topic_index_lookup (self, "temperature.TH1@rc") == NULL);
+
+    topic_index_add (self, rack);
+    topic_index_add (self, row);
+    topic_index_add (self, dc);
+    assert (topic_index_size (self) == 3);
+
+    const std::vector <topic_dependent_t> *dependent = topic_index_lookup (self, "temperature.TH1@rc");
+    assert (dependent);
+    assert (test_composites (dependent) == std::vector <composite_t *> ({rack, row, dc}));
+    dependent = topic_index_lookup (self, "temperature.TH3@rc2");
+    assert (dependent);
+    assert (test_composites (dependent) == std::vector <composite_t *> ({row, dc}));     // dc listed only once
+    assert ((*dependent) [0].slot == composite_slot (row, "temperature.TH3@rc2"));
+    assert ((*dependent) [1].slot == composite_slot (dc, "temperature.TH3@rc2"));
+    assert ((*dependent) [0].slot == 2);
+    assert ((*dependent) [1].slot == 1);
+
+    // topics are interned to dense ids
+    int id = topic_index_id (self, "temperature.TH3@rc2");
+    assert (id >= 0 && id < 3);
+    assert (&topic_index_dependents (self, id) == dependent);
+    assert (topic_index_id (self, "temperature.TH4@rc") == -1);
+    assert (topic_index_lookup (self, "temperature.TH4@rc") == NULL);
+
+    // removal touches only topics of removed composite
+    topic_index_remove (self, row);
+    assert (topic_index_size (self) == 3);
+    dependent = topic_index_lookup (self, "temperature.TH2@rc");
+    assert (dependent);
+    assert (test_composites (dependent) == std::vector <composite_t *> ({rack}));
+    topic_index_remove (self, rack);
+    assert (topic_index_size (self) == 2);
+    assert (topic_index_lookup (self, "temperature.TH2@rc") == NULL);
+    dependent = topic_index_lookup (self, "temperature.TH1@rc");
+    assert (dependent);
+    assert (test_composites (dependent) == std::vector <composite_t *> ({dc}));
+
+    // add again
+    topic_index_add (self, row);
+    dependent = topic_index_lookup (self, "temperature.TH1@rc");
+    assert (test_composites (dependent) == std::vector <composite_t *> ({dc, row}));
+    topic_index_remove (self, dc);
+    topic_index_remove (self, row);
+    assert (topic_index_size (self) == 0);
+    assert (topic_index_lookup (self, "temperature.TH1@rc") == NULL);
+    assert (topic_index_id (self, "temperature.TH3@rc2") == id);     // id is kept
+
+    // producer of a topic
+    topic_index_add (self, dc);
+    assert (topic_index_id (self, "sum@rack") == -1);
+    topic_index_set_producer (self, "sum@rack", rack);
+    int rack_id = topic_index_id (self, "sum@rack");
+    assert (rack_id >= 0);
+    assert (topic_index_producer (self, rack_id) == rack);
+    assert (topic_index_lookup (self, "sum@rack") == NULL);
+    assert (topic_index_producer (self, topic_index_id (self, "temperature.TH1@rc")) == NULL);
+    topic_index_set_producer (self, "sum@rack", NULL);
+    assert (topic_index_producer (self, rack_id) == NULL);
+    topic_index_remove (self, dc);
+
+    // topic interned on its own has no dependents
+    assert (topic_index_intern (self, "sum@rack") == rack_id);
+    int row_id = topic_index_intern (self, "sum@row");
+    assert (row_id > rack_id && topic_index_id (self, "sum@row") == row_id);
+    assert (topic_index_lookup (self, "sum@row") == NULL);
+    assert (topic_index_size (self) == 0);
+
+    // table grows with number of topics
+    std::vector <std::string> many_inputs;
+    for (int i = 0; i < 1000; i++)
+        many_inputs.push_back ("temperature.TH" + std::to_string (i) + "@rack");
+    composite_t *many = test_composite_new ("many", many_inputs);
+    topic_index_add (self, many);
+    assert (topic_index_size (self) == 1000);
+    for (const auto &topic : many_inputs) {
+        dependent = topic_index_lookup (self, topic.c_str ());
+        assert (dependent);
+        assert (dependent->size () == 1);
+        assert ((*dependent) [0].composite == many);
+        assert ((*dependent) [0].slot == composite_slot (many, topic.c_str ()));
+        assert (topic_index_id (self, topic.c_str ()) < 1005);
+    }
+    topic_index_remove (self, many);
+    composite_destroy (&many);
+
+    topic_index_destroy (&self);
+    assert (self == NULL);
+    composite_destroy (&rack);
+    composite_destroy (&row);
+    composite_destroy (&dc);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,99 @@
+/*  =========================================================================
+    topic_index - reverse index from input topic to composites
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef TOPIC_INDEX_H_INCLUDED
+#define TOPIC_INDEX_H_INCLUDED
+
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _topic_index_t topic_index_t;
+
+//  Composite depending on a topic
+typedef struct {
+    composite_t *composite;
+    int slot;               // slot of the topic for composite_update_slot
+} topic_dependent_t;
+
+//  @interface
+//  Create a new empty index
+FTY_METRIC_COMPOSITE_EXPORT topic_index_t *
+    topic_index_new (void);
+
+//  Index all inputs of 'composite'. Composite must not be indexed already.
+FTY_METRIC_COMPOSITE_EXPORT void
+    topic_index_add (topic_index_t *self, composite_t *composite);
+
+//  Remove all inputs of 'composite' from the index. Topics nobody depends
+//  on anymore are dropped.
+FTY_METRIC_COMPOSITE_EXPORT void
+    topic_index_remove (topic_index_t *self, composite_t *composite);
+
+//  Get composites depending on 'topic' or NULL if there are none
+//  Ownership is NOT transferred, result is valid until next add/remove
+FTY_METRIC_COMPOSITE_EXPORT const std::vector <topic_dependent_t> *
+    topic_index_lookup (topic_index_t *self, const char *topic);
+
+//  Get interned id of 'topic', -1 if topic was never indexed. Ids are
+//  dense, starting from 0, and stay the same for the lifetime of the index.
+FTY_METRIC_COMPOSITE_EXPORT int
+    topic_index_id (topic_index_t *self, const char *topic);
+
+//  Get interned id of 'topic', interning it without any dependents when it
+//  is not known yet
+FTY_METRIC_COMPOSITE_EXPORT int
+    topic_index_intern (topic_index_t *self, const char *topic);
+
+//  Get composites depending on topic with interned 'id'
+//  Ownership is NOT transferred, result is valid until next add/remove
+FTY_METRIC_COMPOSITE_EXPORT const std::vector <topic_dependent_t> &
+    topic_index_dependents (topic_index_t *self, int id);
+
+//  Set composite producing 'topic' in this process, NULL if none
+FTY_METRIC_COMPOSITE_EXPORT void
+    topic_index_set_producer (topic_index_t *self, const char *topic, composite_t *producer);
+
+//  Get composite producing topic with interned 'id', NULL if none
+FTY_METRIC_COMPOSITE_EXPORT composite_t *
+    topic_index_producer (topic_index_t *self, int id);
+
+//  Get number of indexed topics
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    topic_index_size (topic_index_t *self);
+
+//  Destroy the index, indexed composites are not touched
+FTY_METRIC_COMPOSITE_EXPORT void
+    topic_index_destroy (topic_index_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    topic_index_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,374 @@
+/*  =========================================================================
+    value_codec - locale independent parsing and formatting of metric values
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    value_codec - locale independent parsing and formatting of metric values
+@discuss
+    Metric values travel as text. atof depends on LC_NUMERIC and turns any
+    garbage into 0.0, printf goes through the whole format machinery for
+    every published value. This codec does both directly and allocates
+    nothing.
+
+    Parsing checks the syntax first and rejects everything which is not
+    a finite decimal number. Numbers with at most 19 significant digits,
+    mantissa below 2^53 and decimal exponent within +-22 (virtually every
+    sensor reading) are converted by a single exact multiplication or
+    division, which gives correctly rounded result. The rest goes to
+    strtod_l in C locale.
+
+    Formatting scales the value to integer of 10^precision units and
+    prints its digits. Result is the same as of printf ("%.*f"): when
+    the scaled value is too close to the half between two integers to
+    decide rounding reliably (including exact ties, which printf rounds to
+    even), when it does not fit into 2^53 or is not finite, snprintf in C
+    locale is used instead.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <locale.h>
+#include <math.h>
+
+static const double s_pow10 [] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define EXACT_POW10 22
+#define MAX_MANTISSA (1ULL << 53)
+#define MAX_DIGITS 19
+
+//  --------------------------------------------------------------------------
+//  C locale for strtod_l and snprintf fallbacks
+
+static locale_t
+s_c_locale (void)
+{
+    static locale_t c_locale = newlocale (LC_ALL_MASK, "C", (locale_t) 0);
+    return c_locale;
+}
+
+static bool
+s_is_space (char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static bool
+s_is_digit (char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+//  --------------------------------------------------------------------------
+//  Parse decimal number 'text' into 'value'
+
+int
+value_codec_parse (const char *text, double &value)
+{
+    assert (text);
+    const char *p = text;
+    while (s_is_space (*p))
+        p++;
+    const char *start = p;
+    bool negative = false;
+    if (*p == '+' || *p == '-')
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;      // first MAX_DIGITS significant digits
+    int digits = 0;             // number of digits in mantissa
+    int exponent = 0;           // decimal exponent of mantissa
+    bool inexact = false;       // non zero digit did not fit into mantissa
+    bool any = false;           // at least one digit seen
+    for (; s_is_digit (*p); p++) {
+        any = true;
+        if (mantissa == 0 && *p == '0')
+            continue;
+        if (digits < MAX_DIGITS) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+        }
+        else {
+            exponent++;
+            inexact |= *p != '0';
+        }
+    }
+    if (*p == '.') {
+        for (p++; s_is_digit (*p); p++) {
+            any = true;
+            if (mantissa == 0 && *p == '0')
+                exponent--;
+            else
+            if (digits < MAX_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+                exponent--;
+            }
+            else
+                inexact |= *p != '0';
+        }
+    }
+    if (!any)
+        return -1;
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        bool exponent_negative = false;
+        if (*p == '+' || *p == '-')
+            exponent_negative = *p++ == '-';
+        if (!s_is_digit (*p))
+            return -1;
+        int e = 0;
+        for (; s_is_digit (*p); p++)
+            if (e < 100000)
+                e = e * 10 + (*p - '0');
+        exponent += exponent_negative ? -e : e;
+    }
+    while (s_is_space (*p))
+        p++;
+    if (*p != '\0')
+        return -1;
+
+    if (mantissa == 0) {
+        value = negative ? -0.0 : 0.0;
+        return 0;
+    }
+    if (!inexact && mantissa <= MAX_MANTISSA && exponent >= -EXACT_POW10 && exponent <= EXACT_POW10) {
+        // both operands are exact, so is the correctly rounded result
+        double result = (double) mantissa;
+        if (exponent < 0)
+            result /= s_pow10 [-exponent];
+        else
+            result *= s_pow10 [exponent];
+        value = negative ? -result : result;
+        return 0;
+    }
+    double result = strtod_l (start, NULL, s_c_locale ());
+    if (!isfinite (result))
+        return -1;
+    value = result;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Format 'value' by snprintf in C locale
+
+static int
+s_format_printf (double value, int precision, char *buffer, size_t size)
+{
+    locale_t old = uselocale (s_c_locale ());
+    int length = snprintf (buffer, size, "%.*f", precision, value);
+    uselocale (old);
+    if (length < 0 || (size_t) length >= size)
+        return -1;
+    return length;
+}
+
+//  --------------------------------------------------------------------------
+//  Format 'value' with 'precision' decimal places into 'buffer'
+
+int
+value_codec_format (double value, int precision, char *buffer, size_t size)
+{
+    assert (precision >= 0 && precision <= VALUE_CODEC_MAX_PRECISION);
+    assert (buffer);
+
+    if (!isfinite (value))
+        return s_format_printf (value, precision, buffer, size);
+    double scaled = fabs (value) * s_pow10 [precision];
+    if (scaled >= (double) MAX_MANTISSA)
+        return s_format_printf (value, precision, buffer, size);
+    double whole = floor (scaled);
+    double fraction = scaled - whole;
+    // scaling is off by at most half ulp - too close to call
+    if (fabs (fraction - 0.5) <= scaled * 1e-15)
+        return s_format_printf (value, precision, buffer, size);
+    uint64_t units = (uint64_t) whole + (fraction > 0.5 ? 1 : 0);
+
+    // digits from the last one
+    char reversed [MAX_DIGITS + VALUE_CODEC_MAX_PRECISION + 4];
+    int length = 0;
+    for (int i = 0; i < precision; i++) {
+        reversed [length++] = '0' + units % 10;
+        units /= 10;
+    }
+    if (precision > 0)
+        reversed [length++] = '.';
+    do {
+        reversed [length++] = '0' + units % 10;
+        units /= 10;
+    } while (units);
+    if (signbit (value))
+        reversed [length++] = '-';
+
+    if ((size_t) length >= size)
+        return -1;
+    for (int i = 0; i < length; i++)
+        buffer [i] = reversed [length - 1 - i];
+    buffer [length] = '\0';
+    return length;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Helper test function
+//  Check that 'value' is formatted as printf would do it
+
+static void
+test_format (double value, int precision)
+{
+    char expected [VALUE_CODEC_BUFFER_SIZE];
+    char buffer [VALUE_CODEC_BUFFER_SIZE];
+    snprintf (expected, sizeof (expected), "%.*f", precision, value);
+    int length = value_codec_format (value, precision, buffer, sizeof (buffer));
+    if (length == -1 || !streq (buffer, expected)) {
+        log_error ("%.17g with precision %d: expected '%s', got '%s'", value, precision, expected, buffer);
+        assert (false);
+    }
+    assert ((size_t) length == strlen (expected));
+}
+
+//  Helper test function
+//  Check that 'text' is parsed as strtod would do it
+
+static void
+test_parse (const char *text)
+{
+    double value = 0;
+    int rv = value_codec_parse (text, value);
+    assert (rv == 0);
+    double expected = strtod (text, NULL);
+    if (memcmp (&value, &expected, sizeof (double)) != 0) {
+        log_error ("'%s': expected %.17g, got %.17g", text, expected, value);
+        assert (false);
+    }
+}
+
+void
+value_codec_test (bool verbose)
+{
+    printf (" * value_codec: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    // parsing
+    double value = 0;
+    assert (value_codec_parse ("21.5", value) == 0 && value == 21.5);
+    assert (value_codec_parse ("  -7 ", value) == 0 && value == -7);
+    assert (value_codec_parse ("+.5", value) == 0 && value == 0.5);
+    assert (value_codec_parse ("5.", value) == 0 && value == 5);
+    assert (value_codec_parse ("1E3", value) == 0 && value == 1000);
+    assert (value_codec_parse ("-0", value) == 0 && value == 0 && signbit (value));
+    assert (value_codec_parse ("0.000", value) == 0 && value == 0 && !signbit (value));
+    assert (value_codec_parse ("1e-400", value) == 0 && value == 0);
+    const char *garbage [] = {
+        "", "  ", "abc", "1.2.3", "12abc", "1e", "1e+", ".", "-", "+-1", "--1", "1,5",
+        "nan", "inf", "-infinity", "0x10", "1e999", "1 2", NULL
+    };
+    for (const char **text = garbage; *text; text++) {
+        value = 42;
+        assert (value_codec_parse (*text, value) == -1);
+        assert (value == 42);
+    }
+    const char *exact [] = {
+        "0.1", "0.3", "123456789012345678", "9007199254740993", "1234567890123456789012",
+        "0.000000000000000000000123", "1.7976931348623157e308", "2.2250738585072014e-308",
+        "4.9e-324", "3.14159265358979323846264338327950288", "1e22", "1e23", "-1e-22", NULL
+    };
+    for (const char **text = exact; *text; text++)
+        test_parse (*text);
+
+    // formatting
+    char buffer [VALUE_CODEC_BUFFER_SIZE];
+    assert (value_codec_format (25, 2, buffer, sizeof (buffer)) == 5);
+    assert (streq (buffer, "25.00"));
+    assert (value_codec_format (-0.004, 2, buffer, sizeof (buffer)) == 5);
+    assert (streq (buffer, "-0.00"));
+    assert (value_codec_format (2.5, 0, buffer, sizeof (buffer)) == 1);
+    assert (streq (buffer, "2"));
+    assert (value_codec_format (123.456, 2, buffer, 6) == -1);
+    assert (value_codec_format (123.456, 2, buffer, 7) == 6);
+    assert (streq (buffer, "123.46"));
+    const double special [] = {
+        0, -0.0, 0.005, 0.015, 0.125, 1.005, 2.675, 1e15, 9007199254740993.0, 1e300, -1e-300,
+        NAN, INFINITY, -INFINITY
+    };
+    for (double v : special)
+        for (int precision = 0; precision <= VALUE_CODEC_MAX_PRECISION; precision++)
+            test_format (v, precision);
+
+    // randomized comparison with printf and strtod
+    srandom (42);
+    for (int i = 0; i < 200000; i++) {
+        double v;
+        switch (i % 4) {
+            case 0:     // typical reading
+                v = (double) (random () % 2000000 - 1000000) / s_pow10 [random () % 5];
+                break;
+            case 1:     // ties in decimal
+                v = ((double) (random () % 100000) + 0.5) / s_pow10 [random () % 4];
+                break;
+            case 2: {   // any bit pattern
+                uint64_t bits = ((uint64_t) random () << 33) ^ ((uint64_t) random () << 11) ^ random ();
+                memcpy (&v, &bits, sizeof (v));
+                if (!isfinite (v))
+                    v = 1;
+                break;
+            }
+            default:    // any magnitude
+                v = (double) random () / RAND_MAX * pow (10, random () % 40 - 20);
+                break;
+        }
+        test_format (v, random () % (VALUE_CODEC_MAX_PRECISION + 1));
+        char text [VALUE_CODEC_BUFFER_SIZE];
+        snprintf (text, sizeof (text), i % 2 ? "%.17g" : "%.3f", v);
+        test_parse (text);
+    }
+
+    // decimal comma of locale is ignored
+    if (setlocale (LC_NUMERIC, "de_DE.UTF-8") || setlocale (LC_NUMERIC, "cs_CZ.UTF-8")) {
+        assert (value_codec_parse ("1.5", value) == 0 && value == 1.5);
+        assert (value_codec_parse ("1,5", value) == -1);
+        assert (value_codec_format (0.125, 2, buffer, sizeof (buffer)) == 4);
+        assert (streq (buffer, "0.12"));
+        assert (value_codec_format (1e300, 1, buffer, sizeof (buffer)) > 0);
+        assert (strchr (buffer, '.') && !strchr (buffer, ','));
+        setlocale (LC_NUMERIC, "C");
+    }
+
+    if (verbose) {
+        const int count = 1000000;
+        int64_t start = zclock_usecs ();
+        for (int i = 0; i < count; i++)
+            snprintf (buffer, sizeof (buffer), "%.2f", i / 7.0);
+        int64_t printf_time = zclock_usecs () - start;
+        start = zclock_usecs ();
+        for (int i = 0; i < count; i++)
+            value_codec_format (i / 7.0, 2, buffer, sizeof (buffer));
+        int64_t codec_time = zclock_usecs () - start;
+        printf ("%d values: snprintf %ld us, value_codec_format %ld us\n", count, (long) printf_time, (long) codec_time);
+    }
+    //  @end
+    printf ("OK\n");
+}
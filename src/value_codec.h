@@ -0,0 +1,58 @@
+/*  =========================================================================
+    value_codec - locale independent parsing and formatting of metric values
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef VALUE_CODEC_H_INCLUDED
+#define VALUE_CODEC_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Highest supported number of decimal places
+#define VALUE_CODEC_MAX_PRECISION 15
+
+//  Buffer big enough for any formatted value
+#define VALUE_CODEC_BUFFER_SIZE 400
+
+//  @interface
+//  Parse decimal number 'text' ('.' is decimal point whatever the locale,
+//  optional exponent, surrounding spaces allowed) into 'value'.
+//  0 - success, -1 - 'text' is not a finite number, 'value' is untouched
+FTY_METRIC_COMPOSITE_EXPORT int
+    value_codec_parse (const char *text, double &value);
+
+//  Format 'value' with 'precision' decimal places into 'buffer' of 'size'
+//  bytes, the same way as printf ("%.*f") in C locale.
+//  Returns length of the text, -1 if it does not fit into the buffer.
+FTY_METRIC_COMPOSITE_EXPORT int
+    value_codec_format (double value, int precision, char *buffer, size_t size);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    value_codec_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,288 @@
+/*  =========================================================================
+    worker_pool - Work-stealing pool of threads running one batch of jobs at a time
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    worker_pool - Work-stealing pool of threads running one batch of jobs at a time
+@discuss
+    Every thread - workers and the one calling worker_pool_run - owns a
+    deque of items. Batch is split into contiguous parts, one per deque,
+    owner takes items from the back of its deque and when it runs dry,
+    steals one from the front of deque of another thread, so threads which
+    got cheap items help those which got expensive ones. Every deque has
+    its own lock, held only while an item is taken.
+
+    Pool runs one batch at a time and worker_pool_run returns only after
+    the whole batch is done, so the caller can hand results over in the
+    order of items. Item is never run twice or by two threads at once.
+@end
+*/
+
+#include "fty_metric_composite_classes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+//  Items given to one thread
+typedef struct {
+    std::mutex mutex;
+    std::deque <void *> items;
+} worker_queue_t;
+
+struct _worker_pool_t {
+    std::vector <std::thread> threads;          // workers
+    std::vector <worker_queue_t *> queues;      // one per worker, the last one of the caller
+    std::mutex mutex;                           // guards batch and stop
+    std::condition_variable wake;               // new batch or stop
+    std::condition_variable done;               // batch finished
+    uint64_t batch;                             // number of batches run
+    bool stop;                                  // workers should terminate
+    worker_pool_fn *fn;                         // job of the current batch
+    void *args;
+    std::atomic <size_t> remaining;             // items of the batch not yet finished
+    std::atomic <uint64_t> stolen;              // items run by other than their own thread
+};
+
+//  --------------------------------------------------------------------------
+//  Take next item for thread 'index', its own first, stolen one otherwise
+//  Returns NULL when every deque is empty
+
+static void *
+s_take (worker_pool_t *self, size_t index)
+{
+    worker_queue_t *own = self->queues [index];
+    {
+        std::lock_guard <std::mutex> lock (own->mutex);
+        if (!own->items.empty ()) {
+            void *item = own->items.back ();
+            own->items.pop_back ();
+            return item;
+        }
+    }
+    for (size_t i = 1; i < self->queues.size (); i++) {
+        worker_queue_t *victim = self->queues [(index + i) % self->queues.size ()];
+        std::lock_guard <std::mutex> lock (victim->mutex);
+        if (!victim->items.empty ()) {
+            void *item = victim->items.front ();
+            victim->items.pop_front ();
+            self->stolen++;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Run items of the current batch till there is none left
+
+static void
+s_work (worker_pool_t *self, size_t index)
+{
+    void *item;
+    while ((item = s_take (self, index)) != NULL) {
+        self->fn (item, self->args);
+        if (--self->remaining == 0) {
+            std::lock_guard <std::mutex> lock (self->mutex);
+            self->done.notify_all ();
+        }
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Worker thread
+
+static void
+s_worker (worker_pool_t *self, size_t index)
+{
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock <std::mutex> lock (self->mutex);
+            self->wake.wait (lock, [self, seen] { return self->stop || self->batch != seen; });
+            if (self->stop)
+                return;
+            seen = self->batch;
+        }
+        s_work (self, index);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new pool with 'workers' threads
+
+worker_pool_t *
+worker_pool_new (size_t workers)
+{
+    worker_pool_t *self = new worker_pool_t ();
+    assert (self);
+    self->batch = 0;
+    self->stop = false;
+    self->fn = NULL;
+    self->args = NULL;
+    self->remaining = 0;
+    self->stolen = 0;
+    for (size_t i = 0; i <= workers; i++)
+        self->queues.push_back (new worker_queue_t ());
+    for (size_t i = 0; i < workers; i++)
+        self->threads.push_back (std::thread (s_worker, self, i));
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of worker threads
+
+size_t
+worker_pool_size (worker_pool_t *self)
+{
+    assert (self);
+    return self->threads.size ();
+}
+
+//  --------------------------------------------------------------------------
+//  Run 'fn' for every one of 'items', wait till all of them are done
+
+void
+worker_pool_run (worker_pool_t *self, const std::vector <void *> &items, worker_pool_fn *fn, void *args)
+{
+    assert (self);
+    assert (fn);
+    if (items.empty ())
+        return;
+    size_t caller = self->threads.size ();
+    if (caller == 0 || items.size () == 1) {
+        for (void *item : items)
+            fn (item, args);
+        return;
+    }
+    {
+        std::lock_guard <std::mutex> lock (self->mutex);
+        self->fn = fn;
+        self->args = args;
+        self->remaining = items.size ();
+    }
+    // contiguous parts keep neighbouring items on one thread
+    size_t part = (items.size () + self->queues.size () - 1) / self->queues.size ();
+    for (size_t i = 0; i < self->queues.size (); i++) {
+        std::lock_guard <std::mutex> lock (self->queues [i]->mutex);
+        for (size_t j = i * part; j < std::min (items.size (), (i + 1) * part); j++)
+            self->queues [i]->items.push_back (items [j]);
+    }
+    {
+        std::lock_guard <std::mutex> lock (self->mutex);
+        self->batch++;
+        self->wake.notify_all ();
+    }
+    s_work (self, caller);
+    std::unique_lock <std::mutex> lock (self->mutex);
+    self->done.wait (lock, [self] { return self->remaining == 0; });
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of stolen items
+
+uint64_t
+worker_pool_stolen (worker_pool_t *self)
+{
+    assert (self);
+    return self->stolen;
+}
+
+//  --------------------------------------------------------------------------
+//  Stop worker threads and destroy the pool
+
+void
+worker_pool_destroy (worker_pool_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        worker_pool_t *self = *self_p;
+        {
+            std::lock_guard <std::mutex> lock (self->mutex);
+            self->stop = true;
+            self->wake.notify_all ();
+        }
+        for (auto &thread : self->threads)
+            thread.join ();
+        for (worker_queue_t *queue : self->queues)
+            delete queue;
+        delete self;
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Helper test function
+//  Count runs of item, item 'args' takes longer
+
+static void
+test_job (void *item, void *args)
+{
+    std::atomic <int> *runs = (std::atomic <int> *) item;
+    if (runs == (std::atomic <int> *) args)
+        std::this_thread::sleep_for (std::chrono::milliseconds (50));
+    (*runs)++;
+}
+
+void
+worker_pool_test (bool verbose)
+{
+    printf (" * worker_pool: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    for (size_t workers : {0, 1, 4}) {
+        worker_pool_t *self = worker_pool_new (workers);
+        assert (self);
+        assert (worker_pool_size (self) == workers);
+
+        std::vector <std::atomic <int>> runs (1000);
+        std::vector <void *> items;
+        for (auto &run : runs) {
+            run = 0;
+            items.push_back (&run);
+        }
+        // many batches, every item runs exactly once in each of them; the
+        // first thread starts by the slow item, last of its part
+        size_t slow = (runs.size () + workers) / (workers + 1) - 1;
+        for (int batch = 0; batch < 20; batch++)
+            worker_pool_run (self, items, test_job, &runs [slow]);
+        for (const auto &run : runs)
+            assert (run == 20);
+        // idle threads took over the rest of its part
+        if (workers > 0)
+            assert (worker_pool_stolen (self) > 0);
+        else
+            assert (worker_pool_stolen (self) == 0);
+
+        worker_pool_run (self, {}, test_job, NULL);
+        worker_pool_destroy (&self);
+        assert (self == NULL);
+    }
+    //  @end
+
+    printf ("OK\n");
+}
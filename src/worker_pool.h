@@ -0,0 +1,70 @@
+/*  =========================================================================
+    worker_pool - Work-stealing pool of threads running one batch of jobs at a time
+
+    Copyright (C) 2014 - 2017 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _worker_pool_t worker_pool_t;
+
+//  Job run by the pool for every item of a batch
+typedef void (worker_pool_fn) (void *item, void *args);
+
+//  @interface
+//  Create a new pool with 'workers' threads, 0 - every batch runs on the
+//  calling thread
+FTY_METRIC_COMPOSITE_EXPORT worker_pool_t *
+    worker_pool_new (size_t workers);
+
+//  Get number of worker threads
+FTY_METRIC_COMPOSITE_EXPORT size_t
+    worker_pool_size (worker_pool_t *self);
+
+//  Run 'fn' (item, 'args') for every one of 'items', each exactly once, on
+//  worker threads and the calling one. Returns when all of them are done.
+//  Items of one batch must not depend on each other.
+FTY_METRIC_COMPOSITE_EXPORT void
+    worker_pool_run (worker_pool_t *self, const std::vector <void *> &items, worker_pool_fn *fn, void *args);
+
+//  Get number of items run by other thread than the one they were given to
+FTY_METRIC_COMPOSITE_EXPORT uint64_t
+    worker_pool_stolen (worker_pool_t *self);
+
+//  Stop worker threads and destroy the pool
+FTY_METRIC_COMPOSITE_EXPORT void
+    worker_pool_destroy (worker_pool_t **self_p);
+
+//  Self test of this class
+FTY_METRIC_COMPOSITE_EXPORT void
+    worker_pool_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif